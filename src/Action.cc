@@ -47,63 +47,173 @@ void ActionList::setLimit(struct timespec &when) {
   limit = when;
 }
 
+void ActionList::setCapacity(const std::string &resource, int capacity) {
+  if(capacity < 1)
+    throw std::logic_error("invalid capacity for " + resource);
+  resources[resource].capacity = capacity;
+}
+
 void ActionList::go(bool wait_for_timeouts) {
   D("go");
   ActionListTimeoutReactor timeout_reactor;
 
+  resolve();
+  EventLoop::TimeoutId timeout = 0;
   if(limit.tv_sec)
-    eventloop->whenTimeout(limit, &timeout_reactor);
-  while(actions.size() > 0) {
+    timeout = eventloop->whenTimeout(limit, &timeout_reactor);
+  for(;;) {
     trigger();
+    if(actions.size() == 0)
+      break;
+    // Nothing running and nothing ready means the remaining actions are
+    // waiting for each other.
+    if(running == 0 && ready.empty()) {
+      if(timeout)
+        eventloop->cancelTimeout(timeout);
+      throw std::logic_error("dependency cycle involving "
+                             + actions.begin()->first);
+    }
     eventloop->wait(wait_for_timeouts);
   }
+  // The reactor is about to go out of scope
+  if(timeout)
+    eventloop->cancelTimeout(timeout);
   timedOut = timeout_reactor.timedOut;
 }
 
+// Return the part of a glob pattern before the first special character
+static std::string globPrefix(const std::string &pattern) {
+  return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+void ActionList::resolve() {
+  size_t sequence = 0;
+  for(auto &it: actions)
+    it.second->sequence = sequence++;
+  for(auto &it: actions) {
+    Action *a = it.second;
+    for(auto &p: a->predecessors)
+      resolve(a, p);
+    if(a->unfinished == 0)
+      ready.push(a);
+  }
+}
+
+void ActionList::resolve(Action *a, const ActionStatus &p) {
+  const bool needsSuccess = p.flags & ACTION_SUCCEEDED;
+  if(p.flags & ACTION_GLOB) {
+    // Only names sharing the pattern's literal prefix can match
+    const std::string prefix = globPrefix(p.name);
+    for(auto it = actions.lower_bound(prefix);
+        it != actions.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+        ++it)
+      if(it->second != a
+         && fnmatch(p.name.c_str(), it->first.c_str(), FNM_PATHNAME)
+                != FNM_NOMATCH)
+        link(a, it->second, needsSuccess);
+    if(needsSuccess)
+      for(auto it = states.lower_bound(prefix);
+          it != states.end()
+          && it->first.compare(0, prefix.size(), prefix) == 0;
+          ++it)
+        if(it->second != Action::Succeeded
+           && fnmatch(p.name.c_str(), it->first.c_str(), FNM_PATHNAME)
+                  != FNM_NOMATCH) {
+          D("action %s depends on success of failed action %s as %s",
+            a->name.c_str(), it->first.c_str(), p.name.c_str());
+          a->doomed = true;
+        }
+  } else {
+    auto it = actions.find(p.name);
+    if(it != actions.end()) {
+      link(a, it->second, needsSuccess);
+      return;
+    }
+    // P already completed or failed
+    auto d = states.find(p.name);
+    if(d == states.end())
+      throw std::logic_error(a->name + " follows unknown action " + p.name);
+    if(needsSuccess && d->second != Action::Succeeded) {
+      D("action %s depends on success of failed action %s", a->name.c_str(),
+        p.name.c_str());
+      a->doomed = true;
+    }
+  }
+}
+
+void ActionList::link(Action *a, Action *p, bool needsSuccess) {
+  p->dependents.push_back({a, needsSuccess});
+  ++a->unfinished;
+}
+
 void ActionList::trigger() {
   D("trigger");
-  Action *chosen = nullptr;
+  // Actions that complete immediately call back into here; the loop below
+  // picks up whatever they made ready.
+  if(dispatching)
+    return;
   if(limit.tv_sec) {
     struct timespec now;
     getMonotonicTime(now);
     if(now.tv_sec > limit.tv_sec
        || (now.tv_sec == limit.tv_sec && now.tv_nsec > limit.tv_nsec)) {
-      // Cancel all pending actions
-      std::vector<Action *> cancel;
-      for(auto it: actions) {
-        Action *a = it.second;
-        if(a->state == Action::Pending)
-          cancel.push_back(a);
-      }
-      for(auto a: cancel) {
-        warning(WARNING_VERBOSE, "action list timed out, cancelling %s",
-                a->name.c_str());
-        cleanup(a, false, false);
-      }
+      cancelPending();
       return;
     }
   }
-  for(auto it: actions) {
-    Action *a = it.second;
-    if(a->state != Action::Pending || blocked_by_resource(a)
-       || blocked_by_dependency(a))
+  dispatching = true;
+  while(!ready.empty()) {
+    Action *a = ready.top();
+    ready.pop();
+    if(a->state != Action::Pending) // cancelled
       continue;
-    if(failed_by_dependency(a)) {
+    if(a->doomed) {
       cleanup(a, false, false);
-      return trigger();
+      continue;
+    }
+    if(Resource *r = blocked_by_resource(a)) {
+      // Re-queued when the resource is released
+      r->waiters.push(a);
+      // If a was woken to use a spare slot in another resource, offer that
+      // slot to the next action waiting for it.
+      for(std::string &name: a->resources) {
+        Resource &other = resources[name];
+        if(&other != r && other.inUse < other.capacity)
+          wake(other);
+      }
+      continue;
+    }
+    a->state = Action::Running;
+    ++running;
+    for(std::string &r: a->resources)
+      ++resources[r].inUse;
+    D("action %s starting", a->name.c_str());
+    try {
+      a->go(eventloop, this);
+    } catch(...) {
+      dispatching = false;
+      throw;
     }
-    if(chosen == nullptr || chosen->priority < a->priority)
-      chosen = a;
   }
-  if(chosen) {
-    chosen->state = Action::Running;
-    for(std::string &r: chosen->resources)
-      resources.insert(r);
-    D("action %s starting", chosen->name.c_str());
-    chosen->go(eventloop, this);
-    // Repeat in case there are more
-    return trigger();
+  dispatching = false;
+}
+
+void ActionList::cancelPending() {
+  std::vector<Action *> cancel;
+  for(auto it: actions) {
+    Action *a = it.second;
+    if(a->state == Action::Pending)
+      cancel.push_back(a);
+  }
+  for(auto a: cancel) {
+    warning(WARNING_VERBOSE, "action list timed out, cancelling %s",
+            a->name.c_str());
+    cleanup(a, false, false);
   }
+  // The caller may destroy cancelled actions, so don't keep pointers to them
+  ready = ActionQueue();
+  for(auto &r: resources)
+    r.second.waiters = ActionQueue();
 }
 
 void ActionList::completed(Action *a, bool succeeded) {
@@ -118,12 +228,28 @@ void ActionList::cleanup(Action *a, bool succeeded, bool ran) {
     assert(a == it->second);
     if(ran) {
       assert(a->state == Action::Running);
-      for(std::string &r: a->resources)
-        resources.erase(r);
-      a->state = succeeded ? Action::Succeeded : Action::Failed;
+      --running;
+      for(std::string &name: a->resources) {
+        Resource &r = resources[name];
+        --r.inUse;
+        wake(r);
+      }
     }
+    a->state = succeeded ? Action::Succeeded : Action::Failed;
     actions.erase(it);
-    states[a->name] = succeeded ? Action::Succeeded : Action::Failed;
+    states[a->name] = a->state;
+    for(auto &d: a->dependents) {
+      Action *s = d.action;
+      if(s->state != Action::Pending)
+        continue;
+      if(d.needsSuccess && !succeeded) {
+        D("action %s depends on success of failed action %s",
+          s->name.c_str(), a->name.c_str());
+        s->doomed = true;
+      }
+      if(--s->unfinished == 0)
+        ready.push(s);
+    }
     if(ran) {
       a->done(eventloop, this);
       trigger();
@@ -132,68 +258,20 @@ void ActionList::cleanup(Action *a, bool succeeded, bool ran) {
   }
 }
 
-bool ActionList::blocked_by_resource(const Action *a) {
-  for(auto &r: a->resources)
-    if(contains(resources, r)) {
-      D("action %s blocked by resource %s", a->name.c_str(), r.c_str());
-      return true;
-    }
-  return false;
-}
-
-bool ActionList::failed_by_dependency(const Action *a) {
-  for(auto &p: a->predecessors) {
-    if(p.flags & ACTION_GLOB) {
-      for(auto it: states) {
-        if(fnmatch(p.name.c_str(), it.first.c_str(), FNM_PATHNAME)
-               != FNM_NOMATCH
-           && it.second != Action::Succeeded) {
-          assert(it.second == Action::Failed);
-          D("action %s depends on success of failed action %s as %s",
-            a->name.c_str(), it.first.c_str(), p.name.c_str());
-          return true;
-        }
-      }
-    } else {
-      auto d = states.find(p.name);
-      if(d != states.end()                    // P completed or failed
-         && (p.flags & ACTION_SUCCEEDED)      // A needs P to have succeeded
-         && d->second != Action::Succeeded) { // P failed
-        assert(d->second == Action::Failed);
-        D("action %s depends on success of failed action %s", a->name.c_str(),
-          p.name.c_str());
-        return true;
-      }
-    }
+void ActionList::wake(Resource &r) {
+  if(!r.waiters.empty()) {
+    ready.push(r.waiters.top());
+    r.waiters.pop();
   }
-  return false;
 }
 
-bool ActionList::blocked_by_dependency(const Action *a) {
-  for(auto &p: a->predecessors) {
-    if(find(p) != actions.end()) {
-      D("action %s blocked by dependency %s", a->name.c_str(), p.name.c_str());
-      return true;
-    } else { // Sanity check
-      if(!(p.flags & ACTION_GLOB)) {
-        auto d = states.find(p.name);
-        if(d == states.end())
-          throw std::logic_error(a->name + " follows unknown action " + p.name);
-      }
+ActionList::Resource *ActionList::blocked_by_resource(const Action *a) {
+  for(auto &name: a->resources) {
+    auto it = resources.find(name);
+    if(it != resources.end() && it->second.inUse >= it->second.capacity) {
+      D("action %s blocked by resource %s", a->name.c_str(), name.c_str());
+      return &it->second;
     }
   }
-  return false;
-}
-
-std::map<std::string, Action *>::iterator
-ActionList::find(const ActionStatus &as) {
-  if(as.flags & ACTION_GLOB) {
-    auto it = actions.begin();
-    while(it != actions.end()
-          && fnmatch(as.name.c_str(), it->first.c_str(), FNM_PATHNAME)
-                 == FNM_NOMATCH)
-      ++it;
-    return it;
-  } else
-    return actions.find(as.name);
+  return nullptr;
 }
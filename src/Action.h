@@ -24,17 +24,17 @@
  * Action::uses.
  *
  * An @ref ActionList is an ordered container of @ref Action objects.  Actions
- * are executed concurrently, with the restriction that no two actions can hold
- * the same resource concurrently.
+ * are executed concurrently, with the restriction that no more actions can
+ * hold a resource concurrently than its capacity allows.
  *
  * These objects are (intended to be) used wherever concurrency can be
  * exploited.  Currently, this means @ref pruneBackups and @ref retireVolumes.
  */
 
-#include <set>
 #include <string>
 #include <vector>
 #include <map>
+#include <queue>
 
 class ActionList;
 class EventLoop;
@@ -70,9 +70,11 @@ struct ActionStatus {
  * is initiated by @ref Action::go; it should call ActionList::completed when
  * it is finished.
  *
- * Actions require <i>resources</i>, which are identified by strings.  No two
- * actions that require the same resource (as identified by string comparison)
- * are run concurrently.  Resources are registered using @ref Action::uses.
+ * Actions require <i>resources</i>, which are identified by strings.  Each
+ * resource has a capacity, by default 1, and no more actions that require the
+ * same resource (as identified by string comparison) than its capacity are
+ * run concurrently.  Resources are registered using @ref Action::uses, and
+ * capacities are set using @ref ActionList::setCapacity.
  *
  * Actions have <i>dependencies</i> on other actions, identified either by
  * strings or by glob patterns.  Furthermore the dependency may either be an
@@ -95,7 +97,8 @@ public:
   /** @brief Specify a resource that this action uses
    * @param r Resource name
    *
-   * Actions that use the same resource are not run concurrently.
+   * Actions that use the same resource are not run concurrently, unless
+   * its capacity has been raised with @ref ActionList::setCapacity.
    */
   void uses(const std::string &r) {
     resources.push_back(r);
@@ -198,17 +201,50 @@ private:
 
   /** @brief Priority */
   int priority = 0;
+
+  /** @brief A dependency of another action on this one */
+  struct Dependent {
+    /** @brief Action that must follow this one */
+    Action *action;
+
+    /** @brief @c true if @ref action requires this one to succeed */
+    bool needsSuccess;
+  };
+
+  /** @brief Actions that must follow this one
+   *
+   * Filled in by @ref ActionList::go.
+   */
+  std::vector<Dependent> dependents;
+
+  /** @brief Number of predecessors that have not yet completed */
+  size_t unfinished = 0;
+
+  /** @brief Set if a predecessor that had to succeed failed */
+  bool doomed = false;
+
+  /** @brief Position in name order, used to break priority ties */
+  size_t sequence = 0;
 };
 
 /** @brief A collection of actions that are executed concurrently
  *
  * @ref Action "Actions" are executed concurrently, with the restriction that no
- * two actions can hold the same resource concurrently.
+ * more actions can hold a resource concurrently than its capacity allows.
  *
- * When a new action is to be executed, the first action that has not been
- * started and does not contradict the restrictions above, is chosen for
- * execution.  Actions are executed via Action::go; they should call
- * @ref ActionList::completed when they are finished.
+ * When a new action is to be executed, the highest-priority action that has
+ * not been started and does not contradict the restrictions above is chosen
+ * for execution; ties are broken by name.  Actions are executed via
+ * Action::go; they should call @ref ActionList::completed when they are
+ * finished.
+ *
+ * Dependencies are resolved into explicit links between actions when @ref go
+ * is called, so each glob pattern is matched only once.  After that, actions
+ * whose predecessors have all completed wait in a priority queue, and actions
+ * that are ready but need a resource that is in use wait on that resource
+ * until it is released.  The cost of scheduling is therefore proportional to
+ * the number of actions and dependencies, rather than the square of the number
+ * of actions.
  */
 class ActionList {
 public:
@@ -220,6 +256,14 @@ public:
   /** @brief Set a time limit */
   void setLimit(struct timespec &when);
 
+  /** @brief Set the capacity of a resource
+   * @param resource Resource name
+   * @param capacity Number of actions that may use @p resource at once
+   *
+   * Resources whose capacity is not set have a capacity of 1.
+   */
+  void setCapacity(const std::string &resource, int capacity);
+
   /** @brief Return true if the time limit was exceeded */
   inline bool timeLimitExceeded() const {
     return timedOut;
@@ -230,6 +274,8 @@ public:
    *
    * Adds an action to the end of the list.  @p a must remain valid at least
    * until it has been completed, i.e. until @ref Action::done is called.
+   *
+   * All actions must be added before @ref go is called.
    */
   void add(Action *a);
 
@@ -241,6 +287,9 @@ public:
    * This method repeatedly calls @ref EventLoop::wait, so if there are any
    * @ref Reactor objects attached to the event loop that do not belong to some
    * action, unexpected delays may result.
+   *
+   * Throws @c std::logic_error if an action follows an unknown action, or if
+   * the dependencies between actions form a cycle.
    */
   void go(bool wait_for_timeouts = false);
 
@@ -255,6 +304,39 @@ public:
   void completed(Action *a, bool succeeded);
 
 private:
+  /** @brief Orders the ready queue
+   *
+   * Higher priorities come first, and then lower sequence numbers.
+   */
+  struct ReadyOrder {
+    /** @brief Comparison function
+     * @param a First action
+     * @param b Second action
+     * @return @c true if @p a should be started after @p b
+     */
+    bool operator()(const Action *a, const Action *b) const {
+      if(a->priority != b->priority)
+        return a->priority < b->priority;
+      return a->sequence > b->sequence;
+    }
+  };
+
+  /** @brief Type of a queue of actions */
+  typedef std::priority_queue<Action *, std::vector<Action *>, ReadyOrder>
+      ActionQueue;
+
+  /** @brief State of a resource */
+  struct Resource {
+    /** @brief Number of actions that may hold the resource at once */
+    int capacity = 1;
+
+    /** @brief Number of actions holding the resource */
+    int inUse = 0;
+
+    /** @brief Ready actions waiting for the resource to be released */
+    ActionQueue waiters;
+  };
+
   /** @brief Event loop */
   EventLoop *eventloop;
 
@@ -273,11 +355,43 @@ private:
   /** @brief Status of completed actions */
   std::map<std::string, Action::State> states;
 
+  /** @brief Actions whose predecessors have all completed */
+  ActionQueue ready;
+
+  /** @brief Resources, by name */
+  std::map<std::string, Resource> resources;
+
+  /** @brief Number of running actions */
+  size_t running = 0;
+
+  /** @brief Set while @ref trigger is starting actions */
+  bool dispatching = false;
+
+  /** @brief Link every pending action to its predecessors */
+  void resolve();
+
+  /** @brief Link an action to one of its predecessors
+   * @param a Action
+   * @param p Predecessor
+   */
+  void resolve(Action *a, const ActionStatus &p);
+
+  /** @brief Link an action to a predecessor that is still pending
+   * @param a Action
+   * @param p Predecessor
+   * @param needsSuccess @c true if @p a requires @p p to succeed
+   */
+  void link(Action *a, Action *p, bool needsSuccess);
+
   /** @brief Start any new actions if possible */
   void trigger();
 
-  /** @brief In-use resources */
-  std::set<std::string> resources;
+  /** @brief Cancel all pending actions
+   *
+   * The ready queue and all resources' waiters are emptied, since nothing in
+   * them will be started.
+   */
+  void cancelPending();
 
   /** @brief Called when an action is complete or skipped
    * @param a Action that completed
@@ -286,29 +400,16 @@ private:
    */
   void cleanup(Action *a, bool succeeded, bool ran);
 
-  /** @brief Test whether an action is blocked by resource contention
-   * @param a Action to check
-   * @return @c true if action is blocked
-   */
-  bool blocked_by_resource(const Action *a);
-
-  /** @brief Test whether an action is blocked by a dependency
-   * @param a Action to check
-   * @return @c true if action is blocked
+  /** @brief Move the first action waiting for a resource to the ready queue
+   * @param r Resource
    */
-  bool blocked_by_dependency(const Action *a);
+  void wake(Resource &r);
 
-  /** @brief Test whether an action is failed by a dependency
+  /** @brief Find a resource that blocks an action
    * @param a Action to check
-   * @return @c true if action is failed
-   */
-  bool failed_by_dependency(const Action *a);
-
-  /** @brief Find an action by name or pattern
-   * @param as Action name or pattern to find
-   * @return Iterator pointing to action
+   * @return Resource with no capacity to spare, or a null pointer
    */
-  std::map<std::string, Action *>::iterator find(const ActionStatus &as);
+  Resource *blocked_by_resource(const Action *a);
 };
 
 #endif /* ACTION_H */
@@ -13,6 +13,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <config.h>
+#include <sys/resource.h>
 #include "Conf.h"
 #include "Device.h"
 #include "Backup.h"
@@ -20,12 +21,12 @@
 #include "Host.h"
 #include "Store.h"
 #include "Database.h"
+#include "LogCodec.h"
 #include "Utils.h"
 #include "Errors.h"
 #include "Command.h"
 #include <cstdio>
 #include <cassert>
-#include <regex>
 
 // Return the path to this backup
 std::string Backup::backupPath() const {
@@ -38,6 +39,11 @@ std::string Backup::backupPath() const {
 }
 
 void Backup::insert(Database &db, bool replace) const {
+  const std::string &log = getContents();
+  int codec = LOG_CODEC_RAW;
+  const std::string data
+      = globalDatabaseVersion < 11 ? log : encodeLog(log, codec);
+  const int logType = codec == LOG_CODEC_RAW ? SQL_STRING : SQL_BLOB;
   const std::string command = replace ? "INSERT OR REPLACE" : "INSERT";
   if(globalDatabaseVersion < 11)
     Database::Statement(db,
@@ -50,30 +56,86 @@ void Backup::insert(Database &db, bool replace) const {
                         &volume->name, SQL_STRING, &deviceName, SQL_STRING, &id,
                         SQL_INT64, (sqlite_int64)time, SQL_INT64,
                         (sqlite_int64)pruned, SQL_INT, waitStatus, SQL_INT,
-                        status, SQL_STRING, &contents, SQL_END)
+                        status, SQL_STRING, &log, SQL_END)
         .next();
   else
     Database::Statement(
         db,
         (command
          + " INTO backup"
-           " (host,volume,device,id,time,pruned,rc,status,log,finishTime)"
-           " VALUES (?,?,?,?,?,?,?,?,?,?)")
+           " (host,volume,device,id,time,pruned,rc,status,log,logCodec,"
+           "finishTime,userTime,systemTime,maxRSS,inBlocks,outBlocks,"
+           "filesTransferred,totalSize,transferredSize,literalData,matchedData,"
+           "speedup)"
+           " VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)")
             .c_str(),
         SQL_STRING, &volume->parent->name, SQL_STRING, &volume->name,
         SQL_STRING, &deviceName, SQL_STRING, &id, SQL_INT64, (sqlite_int64)time,
         SQL_INT64, (sqlite_int64)pruned, SQL_INT, waitStatus, SQL_INT, status,
-        SQL_STRING, &contents, SQL_INT64, (sqlite_int64)finishTime, SQL_END)
+        logType, &data, SQL_INT, codec, SQL_INT64, (sqlite_int64)finishTime,
+        SQL_INT64,
+        (sqlite_int64)userTime, SQL_INT64, (sqlite_int64)systemTime, SQL_INT64,
+        (sqlite_int64)maxRSS, SQL_INT64, (sqlite_int64)inBlocks, SQL_INT64,
+        (sqlite_int64)outBlocks, SQL_INT64,
+        (sqlite_int64)stats.filesTransferred, SQL_INT64,
+        (sqlite_int64)stats.totalSize, SQL_INT64,
+        (sqlite_int64)stats.transferredSize, SQL_INT64,
+        (sqlite_int64)stats.literalData, SQL_INT64,
+        (sqlite_int64)stats.matchedData, SQL_DOUBLE, stats.speedup, SQL_END)
         .next();
 }
 
 void Backup::update(Database &db) const {
+  if(contentsChanged) {
+    updateContents(db);
+    return;
+  }
+  // The log hasn't changed, so leave it alone
+  if(globalDatabaseVersion < 11)
+    Database::Statement(db,
+                        "UPDATE backup SET rc=?,status=?,time=?,pruned=?"
+                        " WHERE host=? AND volume=? AND device=? AND id=?",
+                        SQL_INT, waitStatus, SQL_INT, status, SQL_INT64,
+                        (sqlite_int64)time, SQL_INT64, (sqlite_int64)pruned,
+                        SQL_STRING, &volume->parent->name, SQL_STRING,
+                        &volume->name, SQL_STRING, &deviceName, SQL_STRING,
+                        &id, SQL_END)
+        .next();
+  else
+    Database::Statement(
+        db,
+        "UPDATE backup SET rc=?,status=?,time=?,pruned=?,"
+        "finishTime=?,userTime=?,systemTime=?,maxRSS=?,inBlocks=?,outBlocks=?,"
+        "filesTransferred=?,totalSize=?,transferredSize=?,literalData=?,"
+        "matchedData=?,speedup=?"
+        " WHERE host=? AND volume=? AND device=? AND id=?",
+        SQL_INT, waitStatus, SQL_INT, status, SQL_INT64, (sqlite_int64)time,
+        SQL_INT64, (sqlite_int64)pruned, SQL_INT64, (sqlite_int64)finishTime,
+        SQL_INT64, (sqlite_int64)userTime, SQL_INT64, (sqlite_int64)systemTime,
+        SQL_INT64, (sqlite_int64)maxRSS, SQL_INT64, (sqlite_int64)inBlocks,
+        SQL_INT64, (sqlite_int64)outBlocks, SQL_INT64,
+        (sqlite_int64)stats.filesTransferred, SQL_INT64,
+        (sqlite_int64)stats.totalSize, SQL_INT64,
+        (sqlite_int64)stats.transferredSize, SQL_INT64,
+        (sqlite_int64)stats.literalData, SQL_INT64,
+        (sqlite_int64)stats.matchedData, SQL_DOUBLE, stats.speedup, SQL_STRING,
+        &volume->parent->name, SQL_STRING, &volume->name, SQL_STRING,
+        &deviceName, SQL_STRING, &id, SQL_END)
+        .next();
+}
+
+void Backup::updateContents(Database &db) const {
+  const std::string &log = getContents();
+  int codec = LOG_CODEC_RAW;
+  const std::string data
+      = globalDatabaseVersion < 11 ? log : encodeLog(log, codec);
+  const int logType = codec == LOG_CODEC_RAW ? SQL_STRING : SQL_BLOB;
   if(globalDatabaseVersion < 11)
     Database::Statement(db,
                         "UPDATE backup SET rc=?,status=?,log=?,time=?,pruned=?"
                         " WHERE host=? AND volume=? AND device=? AND id=?",
                         SQL_INT, waitStatus, SQL_INT, status, SQL_STRING,
-                        &contents, SQL_INT64, (sqlite_int64)time, SQL_INT64,
+                        &log, SQL_INT64, (sqlite_int64)time, SQL_INT64,
                         (sqlite_int64)pruned, SQL_STRING, &volume->parent->name,
                         SQL_STRING, &volume->name, SQL_STRING, &deviceName,
                         SQL_STRING, &id, SQL_END)
@@ -81,15 +143,35 @@ void Backup::update(Database &db) const {
   else
     Database::Statement(
         db,
-        "UPDATE backup SET rc=?,status=?,log=?,time=?,pruned=?,finishTime=?"
+        "UPDATE backup SET rc=?,status=?,log=?,logCodec=?,time=?,pruned=?,"
+        "finishTime=?,userTime=?,systemTime=?,maxRSS=?,inBlocks=?,outBlocks=?,"
+        "filesTransferred=?,totalSize=?,transferredSize=?,literalData=?,"
+        "matchedData=?,speedup=?"
         " WHERE host=? AND volume=? AND device=? AND id=?",
-        SQL_INT, waitStatus, SQL_INT, status, SQL_STRING, &contents, SQL_INT64,
-        (sqlite_int64)time, SQL_INT64, (sqlite_int64)pruned, SQL_INT64,
-        (sqlite_int64)finishTime, SQL_STRING, &volume->parent->name, SQL_STRING,
-        &volume->name, SQL_STRING, &deviceName, SQL_STRING, &id, SQL_END)
+        SQL_INT, waitStatus, SQL_INT, status, logType, &data, SQL_INT, codec,
+        SQL_INT64, (sqlite_int64)time, SQL_INT64, (sqlite_int64)pruned,
+        SQL_INT64, (sqlite_int64)finishTime, SQL_INT64, (sqlite_int64)userTime,
+        SQL_INT64, (sqlite_int64)systemTime, SQL_INT64, (sqlite_int64)maxRSS,
+        SQL_INT64, (sqlite_int64)inBlocks, SQL_INT64, (sqlite_int64)outBlocks,
+        SQL_INT64,
+        (sqlite_int64)stats.filesTransferred, SQL_INT64,
+        (sqlite_int64)stats.totalSize, SQL_INT64,
+        (sqlite_int64)stats.transferredSize, SQL_INT64,
+        (sqlite_int64)stats.literalData, SQL_INT64,
+        (sqlite_int64)stats.matchedData, SQL_DOUBLE, stats.speedup, SQL_STRING,
+        &volume->parent->name, SQL_STRING, &volume->name, SQL_STRING,
+        &deviceName, SQL_STRING, &id, SQL_END)
         .next();
 }
 
+void Backup::setResourceUsage(const struct rusage &ru) {
+  userTime = (int64_t)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+  systemTime = (int64_t)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+  maxRSS = ru.ru_maxrss;
+  inBlocks = ru.ru_inblock;
+  outBlocks = ru.ru_oublock;
+}
+
 void Backup::remove(Database &db) const {
   Database::Statement(db,
                       "DELETE FROM backup"
@@ -100,11 +182,40 @@ void Backup::remove(Database &db) const {
       .next();
 }
 
+const std::string &Backup::getContents() const {
+  if(contentsDeferred) {
+    contents = globalConfig.readLog(*this);
+    contentsDeferred = false;
+  }
+  return contents;
+}
+
+void Backup::setContents(const std::string &c) {
+  if(!contentsDeferred && contents == c)
+    return;
+  contents = c;
+  contentsDeferred = false;
+  contentsChanged = true;
+}
+
+void Backup::deferContents(size_t size) {
+  contents.clear();
+  contentsDeferred = true;
+  contentsChanged = false;
+  deferredSize = size;
+}
+
 void Backup::setStatus(int n) {
   if(status != n) {
-    status = n;
+    // Keep the volume's totals up to date.  Only a change to or from
+    // COMPLETE matters.
     if(volume)
-      volume->calculate();
+      volume->removeTotals(this);
+    status = n;
+    if(volume) {
+      volume->addTotals(this);
+      volume->checkTotals();
+    }
   }
 }
 
@@ -112,23 +223,5 @@ Device *Backup::getDevice() const {
   return volume->parent->parent->findDevice(deviceName);
 }
 
-long long Backup::getSize() const {
-  static std::regex size_regexp("Total file size: ([0-9,]+) bytes");
-  std::smatch mr;
-  if(!std::regex_search(contents, mr, size_regexp))
-    return -1;
-  std::string size_string;
-  for(auto it = mr[1].first; it != mr[1].second; ++it) {
-    auto ch = *it;
-    if(isdigit(ch))
-      size_string += ch;
-  }
-  try {
-    return parseInteger(size_string, 0, std::numeric_limits<long long>::max());
-  } catch(SyntaxError &e) {
-    return -1;
-  }
-}
-
 const char *const backup_status_names[] = {"unknown", "underway", "complete",
                                            "failed",  "pruning",  "pruned"};
@@ -20,8 +20,11 @@
  */
 
 #include <string>
+#include <cstdint>
 #include "Date.h"
+#include "RsyncStats.h"
 
+struct rusage;
 class Database;
 class Volume;
 class Device;
@@ -93,6 +96,35 @@ public:
    */
   time_t finishTime = 0;
 
+  /** @brief User CPU time used by @c rsync, in microseconds
+   *
+   * This and the other resource usage members are 0 if not known.
+   */
+  int64_t userTime = 0;
+
+  /** @brief System CPU time used by @c rsync, in microseconds */
+  int64_t systemTime = 0;
+
+  /** @brief Maximum resident set size of @c rsync, in kilobytes */
+  int64_t maxRSS = 0;
+
+  /** @brief Number of blocks read by @c rsync */
+  int64_t inBlocks = 0;
+
+  /** @brief Number of blocks written by @c rsync */
+  int64_t outBlocks = 0;
+
+  /** @brief Statistics from @c rsync
+   *
+   * These are extracted from the log contents when the backup finishes.
+   */
+  RsyncStats stats;
+
+  /** @brief Record resource usage
+   * @param ru Resource usage of @c rsync
+   */
+  void setResourceUsage(const struct rusage &ru);
+
   /** @brief Time backup pruned
    *
    * The meaning of this member depends on the value of @ref Backup::status
@@ -109,9 +141,6 @@ public:
   /** @brief Device containing backup */
   std::string deviceName;
 
-  /** @brief Log contents */
-  std::string contents;
-
   /** @brief Volume backed up */
   Volume *volume = nullptr;
 
@@ -150,6 +179,10 @@ public:
 
   /** @brief Update this backup in the database
    * @param db Database to update
+   *
+   * The log is only written if it has been changed since it was read from
+   * the database (see @ref contentsStored).  Otherwise the stored log is left
+   * alone, and need not be read first.
    */
   void update(Database &db) const;
 
@@ -168,13 +201,82 @@ public:
   /** @brief Return a size estimate for this backup
    * @return Size in bytes, or -1 if no estimate is available
    */
-  long long getSize() const;
+  long long getSize() const {
+    return stats.totalSize;
+  }
 
   /** @brief Set the status of this backup
    * @param n New status (see @ref BackupStatus)
    *
-   * Calls Volume::calculate if necessary. */
+   * Updates the volume's totals if necessary. */
   void setStatus(int n);
+
+  /** @brief Get the log contents
+   * @return Log contents
+   *
+   * If the log has not been read from the database yet, it is read now.
+   */
+  const std::string &getContents() const;
+
+  /** @brief Set the log contents
+   * @param c New log contents
+   *
+   * The log will be written to the database by the next @ref update.
+   */
+  void setContents(const std::string &c);
+
+  /** @brief Note that the log contents match the database
+   *
+   * Used after the backup has been read from, or written to, the database.
+   */
+  void contentsStored() {
+    contentsChanged = false;
+  }
+
+  /** @brief Arrange for the log contents to be read on demand
+   * @param size Size of the log contents
+   *
+   * The log is found by host, volume, device and ID, so @ref volume must be
+   * set before it is read.
+   */
+  void deferContents(size_t size);
+
+  /** @brief Test whether the log contents are in memory
+   * @return @c true if @ref getContents will not access the database
+   */
+  bool contentsLoaded() const {
+    return !contentsDeferred;
+  }
+
+  /** @brief Test whether there are any log contents
+   * @return @c true if the log is nonempty
+   *
+   * Does not read the log from the database.
+   */
+  bool hasContents() const {
+    return contentsDeferred ? deferredSize > 0 : contents.size() > 0;
+  }
+
+private:
+  /** @brief Update this backup in the database, including the log
+   * @param db Database to update
+   */
+  void updateContents(Database &db) const;
+
+  /** @brief Log contents
+   *
+   * Only valid if @ref contentsDeferred is @c false.
+   */
+  mutable std::string contents;
+
+  /** @brief Set if @ref contents must be read from the database */
+  mutable bool contentsDeferred = false;
+
+  /** @brief Size of deferred log contents */
+  size_t deferredSize = 0;
+
+  /** @brief Set if @ref contents differs from the database */
+  bool contentsChanged = false;
 };
 
 /** @brief Comparison for backup pointers */
@@ -54,9 +54,14 @@ const BackupPolicy *BackupPolicy::find(const std::string &name) {
   return it->second;
 }
 
-void validateBackupPolicy(const Volume *volume) {
+const BackupParameters &BackupPolicy::parameters(const Volume *volume) {
+  assert(volume->backupPolicyParameters); // policy not validated
+  return *volume->backupPolicyParameters;
+}
+
+void validateBackupPolicy(Volume *volume) {
   const BackupPolicy *policy = BackupPolicy::find(volume->backupPolicy);
-  policy->validate(volume);
+  volume->backupPolicyParameters.reset(policy->compile(volume));
 }
 
 BackupPolicy::policies_type *BackupPolicy::policies;
@@ -27,6 +27,17 @@ class Volume;
 class Device;
 class PolicyParameter;
 
+/** @brief Backup parameters of one volume, ready for use
+ *
+ * Each policy that has parameters derives its own class from this, and
+ * creates an instance for each volume in @ref BackupPolicy::compile.
+ */
+class BackupParameters {
+public:
+  /** @brief Destructor */
+  virtual ~BackupParameters() = default;
+};
+
 /** @brief Base class for backup policies
  */
 class BackupPolicy {
@@ -37,10 +48,15 @@ public:
    */
   BackupPolicy(const std::string &name);
 
-  /** @brief Validate a backup policy
+  /** @brief Validate and convert the backup parameters of a volume
    * @param volume Volume to validate
+   * @return Converted parameters
+   * @throws ConfigError if the parameters are not valid
+   *
+   * This happens once for each volume, when the configuration is validated.
+   * The result is saved as @ref Volume::backupPolicyParameters.
    */
-  virtual void validate(const Volume *volume) const = 0;
+  virtual BackupParameters *compile(const Volume *volume) const = 0;
 
   /** @brief Get a parameter value
    * @param volume Volume to get parameter from
@@ -70,6 +86,13 @@ public:
    */
   virtual bool backup(const Volume *volume, const Device *device) const = 0;
 
+protected:
+  /** @brief Get the converted backup parameters of a volume
+   * @param volume Volume
+   * @return Parameters returned by @ref compile for @p volume
+   */
+  static const BackupParameters &parameters(const Volume *volume);
+
 private:
   /** @brief Type for @ref policies */
   typedef std::map<std::string, const BackupPolicy *> policies_type;
@@ -80,7 +103,9 @@ private:
 
 /** @brief Validate the backup policy for a volume
  * @param volume Volume to validate
+ *
+ * Sets @ref Volume::backupPolicyParameters.
  */
-void validateBackupPolicy(const Volume *volume);
+void validateBackupPolicy(Volume *volume);
 
 #endif /* BACKUPPOLICY_H */
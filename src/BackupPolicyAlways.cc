@@ -22,7 +22,9 @@ class BackupPolicyAlways: public BackupPolicy {
 public:
   BackupPolicyAlways(): BackupPolicy("always") {}
 
-  void validate(const Volume *) const override {}
+  BackupParameters *compile(const Volume *) const override {
+    return new BackupParameters();
+  }
 
   bool backup(const Volume *, const Device *) const override {
     return true;
@@ -25,7 +25,9 @@ class BackupPolicyDaily: public BackupPolicy {
 public:
   BackupPolicyDaily(): BackupPolicy("daily") {}
 
-  void validate(const Volume *) const override {}
+  BackupParameters *compile(const Volume *) const override {
+    return new BackupParameters();
+  }
 
   bool backup(const Volume *volume, const Device *device) const override {
     Date today = Date::today("BACKUP");
@@ -22,25 +22,35 @@
 #include "Errors.h"
 #include "BackupPolicy.h"
 
+/** @brief Parameters for the @c interval backup policy */
+struct IntervalParameters: public BackupParameters {
+  /** @brief Minimum interval between backups, in seconds */
+  long long minInterval;
+};
+
 /** @brief The @c interval backup policy; backups are separate by a configurable
  * minimum interval. */
 class BackupPolicyInterval: public BackupPolicy {
 public:
   BackupPolicyInterval(): BackupPolicy("interval") {}
 
-  void validate(const Volume *volume) const override {
+  BackupParameters *compile(const Volume *volume) const override {
     const PolicyParameter &minInterval = get(volume, "min-interval");
+    IntervalParameters p;
     try {
-      if(parseTimeInterval(minInterval.value) < 1)
+      p.minInterval = parseTimeInterval(minInterval.value);
+      if(p.minInterval < 1)
         throw SyntaxError("min-interval too small");
     } catch(SyntaxError &e) {
       throw ConfigError(minInterval.location, e.what());
     }
+    return new IntervalParameters(p);
   }
 
   bool backup(const Volume *volume, const Device *device) const override {
     time_t now = Date::now("BACKUP");
-    int minInterval = parseTimeInterval(get(volume, "min-interval").value);
+    const long long minInterval =
+        static_cast<const IntervalParameters &>(parameters(volume)).minInterval;
     for(const Backup *backup: volume->backups)
       if(backup->getStatus() == COMPLETE && now - backup->time < minInterval
          && backup->deviceName == device->name)
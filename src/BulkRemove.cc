@@ -17,12 +17,105 @@
 #include "Utils.h"
 #include "BulkRemove.h"
 #include "Conf.h"
+#include "Errors.h"
+#include "EventLoop.h"
+#include "Action.h"
+#include "IO.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Find the remover for the device containing path
+static TreeRemover &remover(const std::string &path) {
+  static std::map<dev_t, std::unique_ptr<TreeRemover>> removers;
+  struct stat sb;
+  // If path doesn't exist then any remover will do
+  dev_t dev = lstat(path.c_str(), &sb) == 0 ? sb.st_dev : 0;
+  auto &r = removers[dev];
+  if(!r) {
+    TreeRemover::IOClass ioClass = TreeRemover::IO_DEFAULT;
+    if(globalConfig.removeIOClass == "idle")
+      ioClass = TreeRemover::IO_IDLE;
+    else if(globalConfig.removeIOClass == "best-effort")
+      ioClass = TreeRemover::IO_BEST_EFFORT;
+    r.reset(new TreeRemover(globalConfig.removeThreads, ioClass,
+                            globalConfig.removeIOLevel));
+  }
+  return *r;
+}
+
+BulkRemove::~BulkRemove() {
+  if(job) {
+    job->cancel();
+    job->wait();
+  }
+  if(doneFD >= 0)
+    close(doneFD);
+}
 
 void BulkRemove::initialize(const std::string &path) {
-  // Invoking rm makes more sense than re-implementing it.
+  this->path = path;
+  // The rm command is only used if it has been configured (for testing)
   std::vector<std::string> cmd = {globalConfig.rm, "-rf", path};
   setCommand(cmd);
   reporting(globalWarningMask & WARNING_VERBOSE, false);
   // BulkRemoves only get created when the caller has committed to removing
   // things, so no point checking command.act here.
 }
+
+void BulkRemove::go(EventLoop *e, ActionList *al) {
+  if(globalConfig.rmConfigured) {
+    Subprocess::go(e, al);
+    return;
+  }
+  D("removing %s in-process", path.c_str());
+  int p[2];
+  if(pipe(p) < 0)
+    throw IOError("creating pipe", errno);
+  doneFD = p[0];
+  actionlist = al;
+  e->whenReadable(doneFD, &monitor);
+  e->whenTerminated(&monitor);
+  job = remover(path).remove(path, p[1]);
+}
+
+void BulkRemove::removed(EventLoop *e) {
+  e->cancelRead(doneFD);
+  e->cancelTerminated(&monitor);
+  close(doneFD);
+  doneFD = -1;
+  job->wait();
+  std::string where;
+  int errno_value = job->getError(where);
+  if(job->wasCancelled())
+    status = SIGTERM; // as if rm had been killed
+  else if(errno_value) {
+    // The caller reports the failure; this is the equivalent of rm's
+    // diagnostic
+    warning(WARNING_ALWAYS, "cannot remove %s: %s", where.c_str(),
+            strerror(errno_value));
+    status = 1 << 8; // as if rm had exited with status 1
+  } else
+    status = 0;
+  D("removed %s: %ju inodes, %ju bytes freed", path.c_str(),
+    (uintmax_t)job->getInodes(), (uintmax_t)job->getBytes());
+  actionlist->completed(this, status == 0);
+}
+
+void BulkRemove::Monitor::onReadable(EventLoop *e, int, const void *,
+                                     size_t n) {
+  // Nothing is written; end of file means the removal has completed
+  if(n == 0)
+    parent->removed(e);
+}
+
+void BulkRemove::Monitor::onReadError(EventLoop *e, int, int) {
+  parent->removed(e);
+}
+
+void BulkRemove::Monitor::onTerminate(EventLoop *) {
+  parent->job->cancel();
+}
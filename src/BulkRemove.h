@@ -22,19 +22,28 @@
  */
 
 #include "Subprocess.h"
+#include "TreeRemover.h"
+#include <cstdint>
+#include <memory>
 
 /** @brief Bulk remove files and directories, as if by @c rm @c -rf.
  *
  * A @ref BulkRemove is a @ref Subprocess and therefore an @ref Action; it can
  * be invoked either with BulkRemove::runAndWait or as part of an @ref
  * ActionList.
+ *
+ * As part of an @ref ActionList, the removal is done within this process by a
+ * @ref TreeRemover shared by all removals from the same device, unless the @c
+ * rm directive has been used.  The wait status is then synthesized: 0 on
+ * success, an exit status of 1 on error and termination by @c SIGTERM if
+ * cancelled by @ref EventLoop::terminateSubprocesses.
  */
 class BulkRemove: public Subprocess {
 public:
   /** @brief Constructor
    * @param name Action name
    */
-  BulkRemove(const std::string &name): Subprocess(name) {}
+  BulkRemove(const std::string &name): Subprocess(name), monitor(this) {}
 
   /** @brief Constructor
    * @param name Action name
@@ -43,16 +52,72 @@ public:
    * The effect is equivalent to @c rm @c -rf.
    */
   BulkRemove(const std::string &name, const std::string &path):
-      Subprocess(name) {
+      Subprocess(name), monitor(this) {
     initialize(path);
   }
 
+  /** @brief Destructor
+   *
+   * Any in-process removal is cancelled.
+   */
+  ~BulkRemove() override;
+
   /** @brief Initialize the bulk remover
    * @param path Base path to remove
    *
    * The effect is equivalent to @c rm @c -rf.
    */
   void initialize(const std::string &path);
+
+  void go(EventLoop *e, ActionList *al) override;
+
+  /** @brief Return the number of inodes freed by an in-process removal */
+  uint64_t getInodes() const {
+    return job ? job->getInodes() : 0;
+  }
+
+  /** @brief Return the number of bytes freed by an in-process removal */
+  uint64_t getBytes() const {
+    return job ? job->getBytes() : 0;
+  }
+
+private:
+  /** @brief Event loop integration for in-process removal */
+  class Monitor: public ::Reactor {
+  public:
+    /** @brief Constructor
+     * @param parent Owning @ref BulkRemove
+     */
+    Monitor(BulkRemove *parent): parent(parent) {}
+
+    void onReadable(EventLoop *e, int fd, const void *ptr, size_t n) override;
+    void onReadError(EventLoop *e, int fd, int errno_value) override;
+    void onTerminate(EventLoop *e) override;
+
+  private:
+    /** @brief Owning @ref BulkRemove */
+    BulkRemove *parent;
+  };
+
+  /** @brief Called when an in-process removal completes
+   * @param e Event loop
+   */
+  void removed(EventLoop *e);
+
+  /** @brief Base path to remove */
+  std::string path;
+
+  /** @brief Event loop integration */
+  Monitor monitor;
+
+  /** @brief In-process removal, or a null pointer */
+  std::shared_ptr<TreeRemover::Job> job;
+
+  /** @brief Reads end of file when @ref job completes, or -1 */
+  int doneFD = -1;
+
+  /** @brief Containing action list */
+  ActionList *actionlist = nullptr;
 };
 
 #endif /* BULKREMOVE_H */
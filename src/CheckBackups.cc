@@ -16,6 +16,7 @@
 #include "rsbackup.h"
 #include "Command.h"
 #include "Conf.h"
+#include "Defaults.h"
 #include "Device.h"
 #include "Errors.h"
 #include "Host.h"
@@ -50,6 +51,8 @@ static void checkTopLevelFiles(std::vector<std::string> &unexpected,
   std::set<std::string> expected;
   expected.insert("device-id");
   expected.insert("lost+found");
+  // Pruned backups waiting to be removed
+  expected.insert(TRASH_DIRECTORY);
   for(auto h: globalConfig.hosts) {
     expected.insert(h.first);
   }
@@ -39,6 +39,9 @@ enum {
   UNMOUNTED_STORE = 269,
   CHECK_UNEXPECTED = 270,
   LATEST = 271,
+  EXPLAIN_QUERIES = 272,
+  COMPACT_LOGS = 273,
+  RECLAIM = 274,
 };
 
 const struct option Command::options[] = {
@@ -50,6 +53,7 @@ const struct option Command::options[] = {
     {"email", required_argument, nullptr, 'e'},
     {"prune", no_argument, nullptr, 'p'},
     {"prune-incomplete", no_argument, nullptr, 'P'},
+    {"reclaim", no_argument, nullptr, RECLAIM},
     {"store", required_argument, nullptr, 's'},
     {"unmounted-store", required_argument, nullptr, UNMOUNTED_STORE},
     {"retire-device", no_argument, nullptr, RETIRE_DEVICE},
@@ -68,6 +72,7 @@ const struct option Command::options[] = {
     {"no-errors", no_argument, nullptr, NO_REPEAT_ERRORS},
     {"warn-all", no_argument, nullptr, 'W'},
     {"debug", no_argument, nullptr, 'd'},
+    {"explain-queries", no_argument, nullptr, EXPLAIN_QUERIES},
     {"logs", required_argument, nullptr, LOG_VERBOSITY},
     {"dump-config", no_argument, nullptr, DUMP_CONFIG},
     {"database", required_argument, nullptr, 'D'},
@@ -75,6 +80,7 @@ const struct option Command::options[] = {
     {"check-unexpected", no_argument, nullptr, CHECK_UNEXPECTED},
     {"null", no_argument, nullptr, '0'},
     {"latest", no_argument, nullptr, LATEST},
+    {"compact-logs", no_argument, nullptr, COMPACT_LOGS},
     {nullptr, 0, nullptr, 0}};
 
 void Command::help() {
@@ -97,6 +103,7 @@ const char *Command::helpString() {
          "  --prune, -p             Prune old backups of selected volumes "
          "(default: all)\n"
          "  --prune-incomplete, -P  Prune incomplete backups\n"
+         "  --reclaim               Remove pruned backups from devices\n"
          "  --retire                Retire volumes (must specify at least "
          "one)\n"
          "  --forget-only           Retire from database but not disk (with "
@@ -105,6 +112,7 @@ const char *Command::helpString() {
          "one)\n"
          "  --check-unexpected      Check backup media for unexpected files\n"
          "  --latest                Display path to latest available backup\n"
+         "  --compact-logs          Compress logs stored in the database\n"
          "  --dump-config           Dump parsed configuration\n"
          "\n"
          "Additional options:\n"
@@ -118,6 +126,7 @@ const char *Command::helpString() {
          "  --dry-run, -n           Dry run only\n"
          "  --verbose, -v           Verbose output\n"
          "  --debug, -d             Debug output\n"
+         "  --explain-queries       Display database query plans\n"
          "  --database, -D PATH     Override database path\n"
          "  --null, -0              \\0-terminate filenames with "
          "--check-unexpected\n"
@@ -169,6 +178,7 @@ void Command::parse(int argc, const char *const *argv) {
     case 'e': email = new std::string(optarg); break;
     case 'p': prune = true; break;
     case 'P': pruneIncomplete = true; break;
+    case RECLAIM: reclaim = true; break;
     case 's':
       stores.push_back(optarg);
       enable_warning(WARNING_STORE);
@@ -186,6 +196,7 @@ void Command::parse(int argc, const char *const *argv) {
     case 'f': force = true; break;
     case 'v': enable_warning(WARNING_VERBOSE); break;
     case 'd': globalDebug = true; break;
+    case EXPLAIN_QUERIES: explainQueries = true; break;
     case 'D': globalDatabase = optarg; break;
     case RETIRE_DEVICE: retireDevice = true; break;
     case RETIRE: retire = true; break;
@@ -202,6 +213,7 @@ void Command::parse(int argc, const char *const *argv) {
     case FORGET_ONLY: forgetOnly = true; break;
     case CHECK_UNEXPECTED: checkUnexpected = true; break;
     case LATEST: latest = true; break;
+    case COMPACT_LOGS: compactLogs = true; break;
     case '0': eol = 0; break;
     default: exit(1);
     }
@@ -275,6 +287,10 @@ void Command::parse(int argc, const char *const *argv) {
       throw CommandError("no arguments allowed to --check-unexpected");
     if(dumpConfig)
       throw CommandError("no arguments allowed to --dump-config");
+    if(compactLogs && countActions() == 1)
+      throw CommandError("no arguments allowed to --compact-logs");
+    if(reclaim && countActions() == 1)
+      throw CommandError("no arguments allowed to --reclaim");
   }
 }
 
@@ -65,6 +65,12 @@ public:
    */
   bool pruneIncomplete = false;
 
+  /** @brief @c --reclaim action
+   *
+   * The default is @c false.
+   */
+  bool reclaim = false;
+
   /** @brief @c --retire action
    *
    * The default is @c false.
@@ -95,15 +101,23 @@ public:
    */
   bool latest = false;
 
+  /** @brief @c --compact-logs action
+   *
+   * The default is @c false.
+   */
+  bool compactLogs = false;
+
   /** @brief Return the number of action options requested */
   inline int countActions() const {
     return backup + !!html + !!text + !!email + prune + pruneIncomplete
-           + retireDevice + retire + checkUnexpected + dumpConfig + latest;
+           + reclaim + retireDevice + retire + checkUnexpected + dumpConfig
+           + latest + compactLogs;
   }
 
   /** @brief Return true if there are any read-write actions */
   inline bool readWriteActions() const {
-    return backup || prune || pruneIncomplete || retireDevice || retire;
+    return backup || prune || pruneIncomplete || reclaim || retireDevice
+           || retire || compactLogs;
   }
 
   /** @brief Output file for HTML report or null pointer */
@@ -156,6 +170,12 @@ public:
    */
   bool forgetOnly = false;
 
+  /** @brief Log query plans
+   *
+   * The default is @c false.
+   */
+  bool explainQueries = false;
+
   /** @brief Log summary verbosity */
   LogVerbosity logVerbosity = Failed;
 
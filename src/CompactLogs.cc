@@ -0,0 +1,88 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Database.h"
+#include "DatabaseWriter.h"
+#include "IO.h"
+#include "LogCodec.h"
+#include "Utils.h"
+#include <vector>
+
+/** @brief Number of logs to compress per transaction */
+#define COMPACT_BATCH 1000
+
+void compactLogs() {
+  Database &reader = globalConfig.getReaderDb();
+  if(globalDatabaseVersion < 11) {
+    // Only possible with --dry-run, since otherwise the database is upgraded
+    warning(WARNING_DATABASE, "database does not support compressed logs");
+    return;
+  }
+  struct Row {
+    int64_t rowid;
+    std::string data;
+  };
+  int64_t lastRowid = -1;
+  size_t compacted = 0, before = 0, after = 0;
+  for(;;) {
+    // Logs are processed in batches, so that memory use is bounded and
+    // each transaction is short.
+    std::vector<Row> rows;
+    size_t seen = 0;
+    {
+      Database::Statement stmt(reader,
+                               "SELECT rowid,log FROM backup"
+                               " WHERE rowid > ?"
+                               " AND (logCodec IS NULL OR logCodec=?)"
+                               " AND length(log) >= ?"
+                               " ORDER BY rowid LIMIT ?",
+                               SQL_INT64, (sqlite_int64)lastRowid, SQL_INT,
+                               LOG_CODEC_RAW, SQL_INT, LOG_COMPRESS_MIN,
+                               SQL_INT, COMPACT_BATCH, SQL_END);
+      while(stmt.next()) {
+        ++seen;
+        lastRowid = stmt.get_int64(0);
+        const std::string log = stmt.get_blob(1);
+        int codec;
+        std::string data = encodeLog(log, codec, true /*best*/);
+        if(codec == LOG_CODEC_RAW)
+          continue;
+        ++compacted;
+        before += log.size();
+        after += data.size();
+        rows.push_back({lastRowid, std::move(data)});
+      }
+    }
+    if(rows.size() && globalCommand.act)
+      globalConfig.getWriter().execute([&rows](Database &db) {
+        for(const auto &row: rows)
+          Database::Statement(db,
+                              "UPDATE backup SET log=?,logCodec=?"
+                              " WHERE rowid=?",
+                              SQL_BLOB, &row.data, SQL_INT, LOG_CODEC_ZLIB,
+                              SQL_INT64, (sqlite_int64)row.rowid, SQL_END)
+              .next();
+      });
+    if(seen < COMPACT_BATCH)
+      break;
+  }
+  IO::out.writef("%s %zu logs, saving %zu bytes\n",
+                 globalCommand.act ? "compacted" : "would compact", compacted,
+                 before - after);
+  IO::out.flush();
+}
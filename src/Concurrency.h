@@ -16,19 +16,41 @@
 #ifndef CONCURRENCY_H
 # define CONCURRENCY_H
 
+/** @file Concurrency.h
+ * @brief Counted concurrency limits
+ */
+
+/** @brief A resource that can be used by a limited number of things at once */
 class ConcurrencyLimit {
 public:
-  inline ConcurrencyLimit(int max = 1): unused(max) {}
+  /** @brief Constructor
+   * @param max Number of concurrent users permitted
+   */
+  inline ConcurrencyLimit(int max = 1): unused(max), capacity(max) {}
 
+  /** @brief Test whether the resource has spare capacity
+   * @return @c true if it can be taken now
+   */
   inline bool usable() const {
     return unused > 0;
   }
 
+  /** @brief Return the number of concurrent users permitted */
+  inline int limit() const {
+    return capacity;
+  }
+
 private:
+  /** @brief Remaining capacity */
   int unused;
+
+  /** @brief Total capacity */
+  int capacity;
   friend class TakeConcurrencyLimit;
 };
 
+/** @brief Hold one unit of a @ref ConcurrencyLimit for the lifetime of the
+ * object */
 class TakeConcurrencyLimit {
 public:
   inline TakeConcurrencyLimit(ConcurrencyLimit &cl): limit(&cl) {
@@ -14,6 +14,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <config.h>
 #include <cerrno>
+#include <cstring>
 #include <regex>
 #include <sstream>
 #include <boost/filesystem.hpp>
@@ -30,6 +31,8 @@
 #include "Command.h"
 #include "Utils.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
+#include "LogCodec.h"
 #include "PrunePolicy.h"
 #include "ConfDirective.h"
 #include "Device.h"
@@ -47,6 +50,11 @@ Conf::Conf() {
 Conf::~Conf() {
   delete deviceColorStrategy;
   deviceColorStrategy = nullptr;
+  // Outstanding updates are completed before the database is closed
+  delete writer;
+  writer = nullptr;
+  delete readerDb;
+  readerDb = nullptr;
   delete db;
   db = nullptr;
   for(auto &d: devices)
@@ -88,6 +96,13 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
     os << indent(step) << "database " << quote(database) << '\n';
   d(os, "", step);
 
+  d(os, "# Time to wait for a lock on the database", step);
+  d(os, "#  database-busy-timeout INTERVAL", step);
+  if(databaseBusyTimeout != DEFAULT_DATABASE_BUSY_TIMEOUT)
+    os << indent(step) << "database-busy-timeout "
+       << formatTimeInterval(databaseBusyTimeout) << '\n';
+  d(os, "", step);
+
   d(os, "# Path to lock file", step);
   d(os, "#  lock PATH", step);
   if(lock.size())
@@ -112,6 +127,28 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
     os << "device " << quote(d.first) << '\n';
   d(os, "", step);
 
+  d(os, "# Concurrency limits for devices, groups and removals (default 1)", step);
+  d(os, "#  max-concurrency device|group|removal NAME COUNT", step);
+  for(auto &d: devices)
+    if(d.second->concurrency.limit() != 1)
+      os << indent(step) << "max-concurrency device " << quote(d.first) << ' '
+         << d.second->concurrency.limit() << '\n';
+  for(auto &d: devices)
+    if(d.second->removalConcurrency != 1)
+      os << indent(step) << "max-concurrency removal " << quote(d.first) << ' '
+         << d.second->removalConcurrency << '\n';
+  for(auto &g: groupConcurrency)
+    os << indent(step) << "max-concurrency group " << quote(g.first) << ' '
+       << g.second << '\n';
+  d(os, "", step);
+
+  d(os, "# Maximum percentage of space and inodes to use on each device", step);
+  d(os, "#  max-usage PERCENT", step);
+  d(os, "#  max-file-usage PERCENT", step);
+  os << indent(step) << "max-usage " << maxUsage << '\n';
+  os << indent(step) << "max-file-usage " << maxFileUsage << '\n';
+  d(os, "", step);
+
   d(os, "# The time period to keep records of pruned backups for", step);
   d(os, "#  keep-prune-logs INTERVAL", step);
   os << indent(step) << "keep-prune-logs " << formatTimeInterval(keepPruneLogs)
@@ -124,6 +161,24 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
      << '\n';
   d(os, "", step);
 
+  d(os, "# Maximum number of backups to run concurrently", step);
+  d(os, "#  backup-threads COUNT", step);
+  os << indent(step) << "backup-threads " << backupThreads << '\n';
+  d(os, "", step);
+
+  d(os, "# Number of threads removing backups from each device", step);
+  d(os, "#  remove-threads COUNT", step);
+  os << indent(step) << "remove-threads " << removeThreads << '\n';
+  d(os, "", step);
+
+  d(os, "# I/O priority for removing backups", step);
+  d(os, "#  remove-io-priority default|idle|best-effort LEVEL", step);
+  os << indent(step) << "remove-io-priority " << removeIOClass;
+  if(removeIOClass == "best-effort")
+    os << ' ' << removeIOLevel;
+  os << '\n';
+  d(os, "", step);
+
   d(os, "# ---- Reporting ----", step);
   d(os, "", step);
 
@@ -139,7 +194,7 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
   os << indent(step) << "sendmail " << quote(sendmail) << '\n';
   d(os, "", step);
 
-  if(rm != DEFAULT_RM) {
+  if(rmConfigured) {
     d(os, "# rm command", step);
     d(os, "#  rm COMMAND", step);
     os << indent(step) << "rm " << quote(rm) << '\n';
@@ -164,6 +219,7 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
   d(os, "#   logs              -- logs of failed backups", step);
   d(os, "#   p:TEXT            -- arbitrary text", step);
   d(os, "#   prune-logs[:INTERVAL] -- pruning logs (default 3 days)", step);
+  d(os, "#   resources         -- rsync resource usage table", step);
   d(os, "#   summary           -- summary table", step);
   d(os, "#   title:TITLE       -- report title", step);
   d(os, "#   warnings          -- warning messages", step);
@@ -398,17 +454,22 @@ void Conf::readState() {
   const bool progress = (globalWarningMask & WARNING_VERBOSE) && isatty(2);
 
   // Read database contents
-  // Better would be to read only the rows required, on demand.
+  // From version 11 the logs are not read here; only their lengths are
+  // fetched, and the contents are read on demand by Backup::getContents().
   {
     const char *cmd = nullptr;
-    Database &db = getdb();
+    Database &db = getReaderDb();
 
     if(globalDatabaseVersion < 11)
       cmd = "SELECT host,volume,device,id,time,pruned,rc,status,log"
             " FROM backup";
     else
       cmd = "SELECT "
-            "host,volume,device,id,time,pruned,rc,status,log,finishtime"
+            "host,volume,device,id,time,pruned,rc,status,length(log),"
+            "finishtime,"
+            "userTime,systemTime,maxRSS,inBlocks,outBlocks,"
+            "filesTransferred,totalSize,transferredSize,literalData,"
+            "matchedData,speedup"
             " FROM backup";
 
     Database::Statement stmt(db, cmd, SQL_END);
@@ -422,11 +483,26 @@ void Conf::readState() {
       backup.pruned = stmt.get_int64(5);
       backup.waitStatus = stmt.get_int(6);
       backup.setStatus(stmt.get_int(7));
-      backup.contents = stmt.get_blob(8);
-      if(globalDatabaseVersion < 11)
+      if(globalDatabaseVersion < 11) {
+        backup.setContents(stmt.get_blob(8));
+        backup.contentsStored();
         backup.finishTime = 0;
-      else
+        backup.stats.parse(backup.getContents());
+      } else {
+        backup.deferContents(stmt.get_int64(8));
         backup.finishTime = stmt.get_int64(9);
+        backup.userTime = stmt.get_int64(10);
+        backup.systemTime = stmt.get_int64(11);
+        backup.maxRSS = stmt.get_int64(12);
+        backup.inBlocks = stmt.get_int64(13);
+        backup.outBlocks = stmt.get_int64(14);
+        backup.stats.filesTransferred = stmt.get_int64(15);
+        backup.stats.totalSize = stmt.get_int64(16);
+        backup.stats.transferredSize = stmt.get_int64(17);
+        backup.stats.literalData = stmt.get_int64(18);
+        backup.stats.matchedData = stmt.get_int64(19);
+        backup.stats.speedup = stmt.get_double(20);
+      }
       addBackup(backup, hostName, volumeName);
     }
   }
@@ -435,6 +511,17 @@ void Conf::readState() {
     progressBar(IO::err, nullptr, 0, 0);
 }
 
+std::string Conf::readLog(const Backup &backup) {
+  Database::Statement stmt(
+      getReaderDb(),
+      "SELECT log,logCodec FROM backup"
+      " WHERE host=? AND volume=? AND device=? AND id=?",
+      SQL_STRING, &backup.volume->parent->name, SQL_STRING,
+      &backup.volume->name, SQL_STRING, &backup.deviceName, SQL_STRING,
+      &backup.id, SQL_END);
+  return stmt.next() ? decodeLog(stmt.get_blob(0), stmt.get_int(1)) : "";
+}
+
 void Conf::addBackup(Backup &backup, const std::string &hostName,
                      const std::string &volumeName, bool forceWarn) {
   const bool progress = (globalWarningMask & WARNING_VERBOSE) && isatty(2);
@@ -532,20 +619,24 @@ Database &Conf::getdb() {
       else
         globalDatabase = logs + "/" DEFAULT_DATABASE;
     }
+    const int timeout = databaseBusyTimeout * 1000;
     if(globalCommand.act && globalCommand.readWriteActions()) {
-      db = new Database(globalDatabase);
+      db = new Database(globalDatabase, true, timeout);
       if(!db->hasTable("backup"))
         createTables();
       else
         updateTables();
+      // Reads use a separate connection, so they are not blocked by (and
+      // don't see) the writer's transactions.
+      readerDb = new Database(globalDatabase, false, timeout);
     } else {
       try {
-        db = new Database(globalDatabase, false);
+        db = new Database(globalDatabase, false, timeout);
       } catch(DatabaseError &) {
         // If we cannot open the database even with -n then we
         // create a throwaway in-memory database so that we can
         // make some progress in showing what we'd do anyway.
-        db = new Database(":memory:");
+        db = new Database(":memory:", true, timeout);
         createTables(true);
       }
     }
@@ -559,6 +650,23 @@ Database &Conf::getdb() {
   return *db;
 }
 
+Database &Conf::getReaderDb() {
+  Database &d = getdb();
+  return readerDb ? *readerDb : d;
+}
+
+DatabaseWriter &Conf::getWriter() {
+  Database &d = getdb();
+  if(!writer)
+    writer = new DatabaseWriter(d);
+  return *writer;
+}
+
+void Conf::syncDatabase() {
+  if(writer)
+    writer->sync();
+}
+
 /** @brief Columns for the backup table */
 static const struct {
   const char *name;
@@ -577,6 +685,28 @@ static const struct {
     {"log", "BLOB", 0},
     // Added in 11.0
     {"finishTime", "INTEGER", 11},
+    {"userTime", "INTEGER", 11},
+    {"systemTime", "INTEGER", 11},
+    {"maxRSS", "INTEGER", 11},
+    {"inBlocks", "INTEGER", 11},
+    {"outBlocks", "INTEGER", 11},
+    {"filesTransferred", "INTEGER", 11},
+    {"totalSize", "INTEGER", 11},
+    {"transferredSize", "INTEGER", 11},
+    {"literalData", "INTEGER", 11},
+    {"matchedData", "INTEGER", 11},
+    {"speedup", "REAL", 11},
+    {"logCodec", "INTEGER", 11},
+};
+
+/** @brief Indexes on the backup table */
+static const struct {
+  const char *name;
+  const char *columns;
+  int version;
+} backup_indexes[] = {
+    {"backup_host_volume_device_time", "host,volume,device,time", 11},
+    {"backup_status_pruned", "status,pruned", 11},
 };
 
 void Conf::createTables(bool commitAnyway) {
@@ -591,6 +721,10 @@ void Conf::createTables(bool commitAnyway) {
 
   db->begin();
   db->execute(schema.str());
+  for(const auto &bi: backup_indexes)
+    if(globalDatabaseVersion >= bi.version)
+      db->execute(std::string("CREATE INDEX ") + bi.name + " ON backup ("
+                  + bi.columns + ")");
   db->commit(commitAnyway);
 }
 
@@ -601,15 +735,82 @@ int Conf::supportedDatabaseVersion() {
   return maximum_seen;
 }
 
+/** @brief Find the columns present in the backup table
+ * @param db Database
+ * @param columns Where to put column names
+ */
+static void getBackupColumns(Database &db, std::set<std::string> &columns) {
+  Database::Statement stmt(
+      db, "SELECT name FROM pragma_table_info('backup');", SQL_END);
+  while(stmt.next())
+    columns.insert(stmt.get_string(0));
+}
+
+/** @brief Find the indexes present on the backup table
+ * @param db Database
+ * @param indexes Where to put index names
+ */
+static void getBackupIndexes(Database &db, std::set<std::string> &indexes) {
+  Database::Statement stmt(db,
+                           "SELECT name FROM sqlite_master"
+                           " WHERE type='index' AND tbl_name='backup'",
+                           SQL_END);
+  while(stmt.next())
+    indexes.insert(stmt.get_string(0));
+}
+
+/** @brief Extract rsync statistics from logs where not already done
+ * @param db Database
+ *
+ * Rows are identified by the @c totalSize column being null, which is
+ * only the case for rows that predate it.  Only called when that column is
+ * added, since the query has to read every log.
+ */
+static void backfillStats(Database &db) {
+  struct Row {
+    std::string host, volume, device, id;
+    RsyncStats stats;
+  };
+  std::vector<Row> rows;
+  {
+    Database::Statement stmt(db,
+                             "SELECT host,volume,device,id,log,logCodec"
+                             " FROM backup WHERE totalSize IS NULL",
+                             SQL_END);
+    while(stmt.next()) {
+      Row row;
+      row.host = stmt.get_string(0);
+      row.volume = stmt.get_string(1);
+      row.device = stmt.get_string(2);
+      row.id = stmt.get_string(3);
+      row.stats.parse(decodeLog(stmt.get_blob(4), stmt.get_int(5)));
+      rows.push_back(row);
+    }
+  }
+  if(rows.size())
+    warning(WARNING_DATABASE,
+            "upgrading database: extracting rsync statistics for %zu backups",
+            rows.size());
+  for(const auto &row: rows)
+    Database::Statement(
+        db,
+        "UPDATE backup SET filesTransferred=?,totalSize=?,transferredSize=?,"
+        "literalData=?,matchedData=?,speedup=?"
+        " WHERE host=? AND volume=? AND device=? AND id=?",
+        SQL_INT64, (sqlite_int64)row.stats.filesTransferred, SQL_INT64,
+        (sqlite_int64)row.stats.totalSize, SQL_INT64,
+        (sqlite_int64)row.stats.transferredSize, SQL_INT64,
+        (sqlite_int64)row.stats.literalData, SQL_INT64,
+        (sqlite_int64)row.stats.matchedData, SQL_DOUBLE, row.stats.speedup,
+        SQL_STRING, &row.host, SQL_STRING, &row.volume, SQL_STRING,
+        &row.device, SQL_STRING, &row.id, SQL_END)
+        .next();
+}
+
 int Conf::identifyDatabaseVersion() {
   // Find out what columns exist
   std::set<std::string> backup_current_columns;
-  {
-    Database::Statement stmt(
-        *db, "SELECT name FROM pragma_table_info('backup');", SQL_END);
-    while(stmt.next())
-      backup_current_columns.insert(stmt.get_string(0));
-  }
+  getBackupColumns(*db, backup_current_columns);
   int maximum_usable = supportedDatabaseVersion();
   for(const auto &bc: backup_columns) {
     if(backup_current_columns.find(bc.name) == backup_current_columns.end()) {
@@ -623,11 +824,16 @@ int Conf::identifyDatabaseVersion() {
 void Conf::updateTables() {
   db->begin();
 
-  // Find out what version we're on
-  int currentVersion = identifyDatabaseVersion();
-  // Add missing columns to get up to the latest
+  // Find out what columns exist
+  std::set<std::string> backup_current_columns;
+  getBackupColumns(*db, backup_current_columns);
+  // Add missing columns to get up to the latest.  Columns are checked
+  // individually since a version may gain columns during its development.
+  bool addedStats = false;
   for(const auto &bc: backup_columns) {
-    if(bc.version > currentVersion) {
+    if(backup_current_columns.find(bc.name) == backup_current_columns.end()) {
+      if(!strcmp(bc.name, "totalSize"))
+        addedStats = true;
       char buffer[256];
       warning(WARNING_DATABASE, "upgrading database version: adding column %s",
               bc.name);
@@ -636,6 +842,21 @@ void Conf::updateTables() {
       db->execute(buffer);
     }
   }
+  // Add missing indexes
+  std::set<std::string> backup_current_indexes;
+  getBackupIndexes(*db, backup_current_indexes);
+  for(const auto &bi: backup_indexes) {
+    if(backup_current_indexes.find(bi.name) == backup_current_indexes.end()) {
+      warning(WARNING_DATABASE, "upgrading database version: adding index %s",
+              bi.name);
+      db->execute(std::string("CREATE INDEX ") + bi.name + " ON backup ("
+                  + bi.columns + ")");
+    }
+  }
+  // Fill in rsync statistics for backups made before they were recorded.
+  // This reads every log, so it is only done when the columns first appear.
+  if(addedStats)
+    backfillStats(*db);
   db->commit();
 }
 
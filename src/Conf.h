@@ -55,6 +55,7 @@ class Device;
 class Host;
 class Volume;
 class Database;
+class DatabaseWriter;
 class Backup;
 
 /** @brief Compare two strings as names
@@ -116,16 +117,23 @@ public:
 
   /** @brief Maximum device usage
    *
-   * Corresponds to @c max-usage.  Currently not implemented.
+   * Corresponds to @c max-usage.  A percentage; 100 means no limit.
    */
   int maxUsage = DEFAULT_MAX_USAGE;
 
   /** @brief Maximum file usage
    *
-   * Corresponds to @c max-file-usage.  Currently not implemented.
+   * Corresponds to @c max-file-usage.  A percentage; 100 means no limit.
    */
   int maxFileUsage = DEFAULT_MAX_FILE_USAGE;
 
+  /** @brief Concurrency limits for groups
+   *
+   * Corresponds to @c max-concurrency @c group.  Groups not listed here have a
+   * limit of 1.
+   */
+  std::map<std::string, int> groupConcurrency;
+
   /** @brief Permit public stores */
   bool publicStores = false;
 
@@ -135,6 +143,9 @@ public:
   /** @brief Database path */
   std::string database;
 
+  /** @brief Time to wait for a lock on the database, in seconds */
+  int databaseBusyTimeout = DEFAULT_DATABASE_BUSY_TIMEOUT;
+
   /** @brief Lockfile path */
   std::string lock;
 
@@ -144,12 +155,33 @@ public:
   /** @brief Maximum time to spend pruning */
   int pruneTimeout = DEFAULT_PRUNE_TIMEOUT;
 
+  /** @brief Number of backup worker threads */
+  int backupThreads = DEFAULT_BACKUP_THREADS;
+
+  /** @brief Number of threads removing backups from each device */
+  int removeThreads = DEFAULT_REMOVE_THREADS;
+
+  /** @brief I/O scheduling class for removing backups
+   *
+   * One of @c default, @c best-effort or @c idle.
+   */
+  std::string removeIOClass = DEFAULT_REMOVE_IO_CLASS;
+
+  /** @brief I/O priority level for removing backups, with @c best-effort */
+  int removeIOLevel = DEFAULT_REMOVE_IO_LEVEL;
+
   /** @brief Path to @c sendmail */
   std::string sendmail = DEFAULT_SENDMAIL;
 
   /** @brief @c rm command (overridden for testing only) */
   std::string rm = DEFAULT_RM;
 
+  /** @brief Set if @ref rm was configured
+   *
+   * If so, backups are removed by running @ref rm rather than in-process.
+   */
+  bool rmConfigured = false;
+
   /** @brief Pre-device-hook, run before a device is accessed */
   std::vector<std::string> preDevice;
 
@@ -223,6 +255,7 @@ public:
                                      "warnings",
                                      "h2:Summary",
                                      "summary",
+                                     "resources",
                                      "history-graph",
                                      "h2:Logfiles",
                                      "logs",
@@ -242,7 +275,11 @@ public:
    */
   void read();
 
-  /** @brief Validate a read configuration file */
+  /** @brief Validate a read configuration file
+   *
+   * The backup and pruning policy parameters of each volume are converted
+   * into the form that the policies use.
+   */
   void validate() const;
 
   /** @brief Add a host
@@ -326,6 +363,33 @@ public:
    */
   Database &getdb();
 
+  /** @brief Get a read-only database access object
+   * @return Reference to database object
+   *
+   * If the database is open for writing then this is a separate connection,
+   * which will not see updates that are still queued in the writer.
+   */
+  Database &getReaderDb();
+
+  /** @brief Get the database writer
+   * @return Reference to database writer
+   *
+   * All database updates should be made via the writer.
+   */
+  DatabaseWriter &getWriter();
+
+  /** @brief Wait for all queued database updates to be committed */
+  void syncDatabase();
+
+  /** @brief Read the log of a backup from the database
+   * @param backup Backup whose log is wanted
+   * @return Log contents, or an empty string if the row does not exist
+   *
+   * The row is found by its primary key, which doesn't change when the row
+   * is replaced.  Used by Backup::getContents() to load logs on demand.
+   */
+  std::string readLog(const Backup &backup);
+
   ConfBase *getParent() const override;
 
   std::string what() const override;
@@ -367,6 +431,12 @@ private:
   /** @brief Database access object */
   Database *db = nullptr;
 
+  /** @brief Read-only database access object, or a null pointer */
+  Database *readerDb = nullptr;
+
+  /** @brief Database writer */
+  DatabaseWriter *writer = nullptr;
+
   /** @brief Create database tables
    * @brief commitAnyway Commit even if @c -n option specified
    * @brief version Database version to create (for upgrade testing only)
@@ -148,6 +148,14 @@ void ConfBase::write(std::ostream &os, int step, bool verbose) const {
      << '\n';
   d(os, "", 0);
 
+  if(!sshMultiplex || (parent && sshMultiplex != parent->sshMultiplex)) {
+    d(os, "# Share one SSH connection per host", step);
+    d(os, "#  ssh-multiplex true|false", step);
+    os << indent(step) << "ssh-multiplex "
+       << (sshMultiplex ? "true" : "false") << '\n';
+    d(os, "", 0);
+  }
+
   d(os, "# Maximum time to wait for a hook to complete", step);
   d(os, "#  hook-timeout INTERVAL", step);
   if(hookTimeout)
@@ -168,6 +176,14 @@ void ConfBase::write(std::ostream &os, int step, bool verbose) const {
     d(os, "", 0);
   }
 
+  if(linkDestDepth != DEFAULT_LINK_DEST_DEPTH
+     || (parent && linkDestDepth != parent->linkDestDepth)) {
+    d(os, "# Number of recent backups to link against", step);
+    d(os, "# link-dest-depth COUNT", step);
+    os << indent(step) << "link-dest-depth " << linkDestDepth << '\n';
+    d(os, "", 0);
+  }
+
   d(os, "# rsync base options", step);
   d(os, "# rsync-base-options OPTION ...", step);
   os << indent(step) << "rsync-base-options";
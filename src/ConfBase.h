@@ -74,7 +74,9 @@ public:
       rsyncBaseOptions(parent->rsyncBaseOptions),
       rsyncExtraOptions(parent->rsyncExtraOptions),
       rsyncRemote(parent->rsyncRemote), rsyncLinkDest(parent->rsyncLinkDest),
-      sshTimeout(parent->sshTimeout), hookTimeout(parent->hookTimeout),
+      linkDestDepth(parent->linkDestDepth),
+      sshTimeout(parent->sshTimeout), sshMultiplex(parent->sshMultiplex),
+      hookTimeout(parent->hookTimeout),
       hostCheck(parent->hostCheck), devicePattern(parent->devicePattern),
       earliest(parent->earliest), latest(parent->latest), group(parent->group) {
   }
@@ -147,9 +149,15 @@ public:
   /** @brief whether to enable --link-dest */
   bool rsyncLinkDest = true;
 
+  /** @brief Number of recent backups to offer to --link-dest */
+  int linkDestDepth = DEFAULT_LINK_DEST_DEPTH;
+
   /** @brief Timeout to pass to SSH */
   int sshTimeout = DEFAULT_SSH_TIMEOUT;
 
+  /** @brief Whether to share one SSH connection per host */
+  bool sshMultiplex = true;
+
   /** @brief hook timeout */
   int hookTimeout = 0;
 
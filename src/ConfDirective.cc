@@ -231,6 +231,47 @@ static const struct DeviceDirective: public ConfDirective {
   }
 } device_directive;
 
+/** @brief The @c max-concurrency directive
+ *
+ * At the top level this sets the limit for a device or concurrency group, or
+ * the number of concurrent removals from a device.  Inside a host it limits
+ * the number of concurrent backups of that host.
+ */
+static const struct MaxConcurrencyDirective: public ConfDirective {
+  MaxConcurrencyDirective():
+      ConfDirective("max-concurrency", 1, 3, LEVEL_TOP | LEVEL_HOST) {}
+  void check(const ConfContext &cc) const override {
+    ConfDirective::check(cc);
+    size_t args = cc.bits.size() - 1;
+    if(cc.host) {
+      if(args != 1)
+        throw SyntaxError("wrong number of arguments to '" + name + "'");
+    } else {
+      if(args != 3)
+        throw SyntaxError("wrong number of arguments to '" + name + "'");
+      if(cc.bits[1] != "device" && cc.bits[1] != "group"
+         && cc.bits[1] != "removal")
+        throw SyntaxError("invalid '" + name + "' type '" + cc.bits[1] + "'");
+    }
+  }
+  void set(ConfContext &cc) const override {
+    int limit = parseInteger(cc.bits[cc.bits.size() - 1], 1,
+                             std::numeric_limits<int>::max());
+    if(cc.host)
+      cc.host->maxConcurrency = limit;
+    else if(cc.bits[1] == "device" || cc.bits[1] == "removal") {
+      Device *device = cc.conf->findDevice(cc.bits[2]);
+      if(!device)
+        throw SyntaxError("unknown device '" + cc.bits[2] + "'");
+      if(cc.bits[1] == "device")
+        device->concurrency = ConcurrencyLimit(limit);
+      else
+        device->removalConcurrency = limit;
+    } else
+      cc.conf->groupConcurrency[cc.bits[2]] = limit;
+  }
+} max_concurrency_directive;
+
 /** @brief The @c max-usage directive */
 static const struct MaxUsageDirective: public ConfDirective {
   MaxUsageDirective(): ConfDirective("max-usage", 1, 1) {}
@@ -271,6 +312,15 @@ static const struct DatabaseDirective: public ConfDirective {
   }
 } database_directive;
 
+/** @brief The @c database-busy-timeout directive */
+static const struct DatabaseBusyTimeoutDirective: public ConfDirective {
+  DatabaseBusyTimeoutDirective(): ConfDirective("database-busy-timeout", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->databaseBusyTimeout = parseTimeInterval(
+        cc.bits[1], std::numeric_limits<int>::max() / 1000);
+  }
+} database_busy_timeout_directive;
+
 /** @brief The @c lock directive */
 static const struct LockDirective: public ConfDirective {
   LockDirective(): ConfDirective("lock", 1, 1) {}
@@ -292,6 +342,7 @@ static const struct RmDirective: public ConfDirective {
   RmDirective(): ConfDirective("rm", 1, 1) {}
   void set(ConfContext &cc) const override {
     cc.conf->rm = cc.bits[1];
+    cc.conf->rmConfigured = true;
   }
 } rm_directive;
 
@@ -327,6 +378,46 @@ static const struct PruneTimeoutDirective: public ConfDirective {
   }
 } prune_timeout_directive;
 
+/** @brief The @c backup-threads directive */
+static const struct BackupThreadsDirective: public ConfDirective {
+  BackupThreadsDirective(): ConfDirective("backup-threads", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->backupThreads =
+        parseInteger(cc.bits[1], 1, std::numeric_limits<int>::max());
+  }
+} backup_threads_directive;
+
+/** @brief The @c remove-threads directive */
+static const struct RemoveThreadsDirective: public ConfDirective {
+  RemoveThreadsDirective(): ConfDirective("remove-threads", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->removeThreads =
+        parseInteger(cc.bits[1], 1, std::numeric_limits<int>::max());
+  }
+} remove_threads_directive;
+
+/** @brief The @c remove-io-priority directive */
+static const struct RemoveIOPriorityDirective: public ConfDirective {
+  RemoveIOPriorityDirective(): ConfDirective("remove-io-priority", 1, 2) {}
+  void check(const ConfContext &cc) const override {
+    ConfDirective::check(cc);
+    const std::string &ioClass = cc.bits[1];
+    if(ioClass == "best-effort") {
+      if(cc.bits.size() != 3)
+        throw SyntaxError("'" + name + " best-effort' requires a level");
+    } else if(ioClass == "default" || ioClass == "idle") {
+      if(cc.bits.size() != 2)
+        throw SyntaxError("wrong number of arguments to '" + name + "'");
+    } else
+      throw SyntaxError("invalid '" + name + "' class '" + ioClass + "'");
+  }
+  void set(ConfContext &cc) const override {
+    cc.conf->removeIOClass = cc.bits[1];
+    if(cc.bits.size() > 2)
+      cc.conf->removeIOLevel = parseInteger(cc.bits[2], 0, 7);
+  }
+} remove_io_priority_directive;
+
 /** @brief The @c include directive */
 static const struct IncludeDirective: public ConfDirective {
   IncludeDirective(): ConfDirective("include", 1, 1) {}
@@ -649,6 +740,15 @@ static const struct SshTimeoutDirective: InheritableDirective {
   }
 } ssh_timeout_directive;
 
+/** @brief The @c ssh-multiplex directive */
+static const struct SshMultiplexDirective: InheritableDirective {
+  SshMultiplexDirective():
+      InheritableDirective("ssh-multiplex", 1, 1, LEVEL_TOP | LEVEL_HOST) {}
+  void set(ConfContext &cc) const override {
+    cc.context->sshMultiplex = get_boolean(cc);
+  }
+} ssh_multiplex_directive;
+
 /** @brief The @c rsync-command directive */
 static const struct RsyncCommandDirective: InheritableDirective {
   RsyncCommandDirective(): InheritableDirective("rsync-command", 1, 1) {}
@@ -665,6 +765,14 @@ static const struct RsyncLinkDestDirective: InheritableDirective {
   }
 } rsync_link_dest_directive;
 
+/** @brief The @c link-dest-depth directive */
+static const struct LinkDestDepthDirective: InheritableDirective {
+  LinkDestDepthDirective(): InheritableDirective("link-dest-depth", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->linkDestDepth = parseInteger(cc.bits[1], 1, MAX_LINK_DEST);
+  }
+} link_dest_depth_directive;
+
 /** @brief The @c rsync-base-options directive */
 static const struct RsyncBaseOptionsDirective: InheritableDirective {
   RsyncBaseOptionsDirective():
@@ -17,22 +17,62 @@
 #include "Database.h"
 #include "Errors.h"
 #include "Utils.h"
+#include "IO.h"
 #include <cstdio>
+#include <map>
 
-Database::Database(const std::string &path, bool rw) {
-  int rc = sqlite3_open_v2(path.c_str(), &db,
-                           rw ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
-                              : SQLITE_OPEN_READONLY,
-                           nullptr);
+Database::Database(const std::string &path, bool rw, int timeout) {
+  if(rw) {
+    open(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, timeout);
+    try {
+      // Allow readers to proceed while a write is in progress
+      Statement(*this, "PRAGMA journal_mode=WAL", SQL_END).next();
+    } catch(std::exception &) {
+      close();
+      throw;
+    }
+    return;
+  }
+  open(path, SQLITE_OPEN_READONLY, timeout);
+  // Reading from a database in WAL mode fails if the -shm file can't be
+  // created.  Find out now, without using the statement cache.
+  int rc = sqlite3_exec(db, "PRAGMA schema_version", nullptr, nullptr,
+                        nullptr);
+  if(rc != SQLITE_CANTOPEN && rc != SQLITE_READONLY)
+    return;
+  warning(WARNING_DATABASE, "%s: %s: reading without locking", path.c_str(),
+          sqlite3_errmsg(db));
+  close();
+  // Make a URI that refers to the same file but marks it immutable
+  std::string uri = "file:";
+  for(char c: path) {
+    if(c == '%' || c == '?' || c == '#') {
+      char buffer[8];
+      snprintf(buffer, sizeof buffer, "%%%02X", (unsigned char)c);
+      uri += buffer;
+    } else
+      uri += c;
+  }
+  uri += "?immutable=1";
+  open(uri, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, timeout);
+}
+
+void Database::open(const std::string &path, int flags, int timeout) {
+  int rc = sqlite3_open_v2(path.c_str(), &db, flags, nullptr);
   if(rc != SQLITE_OK) {
     try {
       error("sqlite3_open_v2 " + path, rc);
     } catch(std::exception &) {
-      sqlite3_close_v2(db);
-      db = nullptr;
+      close();
       throw;
     }
   }
+  sqlite3_busy_timeout(db, timeout);
+}
+
+void Database::close() {
+  sqlite3_close_v2(db);
+  db = nullptr;
 }
 
 void Database::error(sqlite3 *db, const std::string &description, int rc) {
@@ -70,7 +110,85 @@ void Database::rollback() {
   execute("ROLLBACK");
 }
 
+void Database::setStatementCacheSize(size_t n) {
+  std::lock_guard<std::mutex> guard(cacheLock);
+  cacheSize = n;
+  trim();
+}
+
+size_t Database::getStatementsPrepared() {
+  std::lock_guard<std::mutex> guard(cacheLock);
+  return prepared;
+}
+
+sqlite3_stmt *Database::lookup(const char *cmd) {
+  std::lock_guard<std::mutex> guard(cacheLock);
+  auto it = cacheIndex.find(cmd);
+  if(it == cacheIndex.end()) {
+    ++prepared;
+    return nullptr;
+  }
+  sqlite3_stmt *stmt = *it->second;
+  cache.erase(it->second);
+  cacheIndex.erase(it);
+  return stmt;
+}
+
+void Database::release(sqlite3_stmt *stmt) {
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  std::lock_guard<std::mutex> guard(cacheLock);
+  const std::string cmd = sqlite3_sql(stmt);
+  // If the same command was in use more than once, keep only one copy
+  if(cacheSize == 0 || cacheIndex.find(cmd) != cacheIndex.end()) {
+    sqlite3_finalize(stmt);
+    return;
+  }
+  cache.push_front(stmt);
+  cacheIndex[cmd] = cache.begin();
+  trim();
+}
+
+void Database::explain(const char *cmd) {
+  sqlite3_stmt *stmt;
+  const std::string query = std::string("EXPLAIN QUERY PLAN ") + cmd;
+  int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+  if(rc != SQLITE_OK)
+    error("sqlite3_prepare_v2: " + query, rc);
+  // Each row has columns id, parent, notused, detail; a parent of 0 means a
+  // top-level step.
+  std::map<int, int> depths;
+  std::string plan;
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    int id = sqlite3_column_int(stmt, 0);
+    int parent = sqlite3_column_int(stmt, 1);
+    int depth = depths[id] = parent ? depths[parent] + 1 : 1;
+    plan += std::string(2 * depth, ' ');
+    plan += (const char *)sqlite3_column_text(stmt, 3);
+    plan += '\n';
+  }
+  sqlite3_finalize(stmt);
+  if(rc != SQLITE_DONE)
+    error("sqlite3_step: " + query, rc);
+  // Commands that don't access any tables have no plan
+  if(plan.size())
+    IO::err.writef("QUERY PLAN: %s\n%s", cmd, plan.c_str());
+}
+
+void Database::trim() {
+  while(cache.size() > cacheSize) {
+    sqlite3_stmt *stmt = cache.back();
+    cacheIndex.erase(sqlite3_sql(stmt));
+    cache.pop_back();
+    sqlite3_finalize(stmt);
+  }
+}
+
 Database::~Database() {
+  for(auto stmt: cache)
+    sqlite3_finalize(stmt);
+  cache.clear();
+  cacheIndex.clear();
   int rc = sqlite3_close_v2(db);
   db = nullptr;
   if(rc != SQLITE_OK)
@@ -107,34 +225,45 @@ void Database::Statement::prepare(const char *cmd, ...) {
 void Database::Statement::vprepare(const char *cmd, va_list ap) {
   if(stmt)
     throw std::logic_error("Database::Statement::vprepare: already prepared");
-  const char *tail;
-  D("vprepare: %s", cmd);
-  int rc = sqlite3_prepare_v2(db, cmd, -1, &stmt, &tail);
-  if(rc != SQLITE_OK)
-    error(std::string("sqlite3_prepare_v2: ") + cmd, rc);
-  if(tail && *tail)
-    throw std::logic_error(
-        std::string("Database::Statement::vprepare: trailing junk: \"") + tail
-        + "\"");
+  stmt = database.lookup(cmd);
+  if(stmt)
+    D("vprepare (cached): %s", cmd);
+  else {
+    const char *tail;
+    D("vprepare: %s", cmd);
+    int rc = sqlite3_prepare_v2(db, cmd, -1, &stmt, &tail);
+    if(rc != SQLITE_OK)
+      error(std::string("sqlite3_prepare_v2: ") + cmd, rc);
+    if(tail && *tail) {
+      sqlite3_finalize(stmt);
+      stmt = nullptr;
+      throw std::logic_error(
+          std::string("Database::Statement::vprepare: trailing junk: \"")
+          + tail + "\"");
+    }
+    if(globalCommand.explainQueries)
+      database.explain(cmd);
+  }
   try {
     param = 1;
-    vbind(ap);
+    vbind(va_arg(ap, int), ap);
   } catch(std::runtime_error &e) {
-    sqlite3_finalize(stmt);
+    database.release(stmt);
     stmt = nullptr;
     throw;
   }
 }
 
-void Database::Statement::vbind(va_list ap) {
-  int t, i, rc;
+void Database::Statement::vbind(int t, va_list ap) {
+  int i, rc;
   sqlite3_int64 i64;
+  double f;
   const char *cs;
   const std::string *s;
 
   if(param <= 0)
     throw std::logic_error("Database::Statement::vbind: invalid 'param' value");
-  while((t = va_arg(ap, int)) != SQL_END) {
+  for(; t != SQL_END; t = va_arg(ap, int)) {
     switch(t) {
     case SQL_INT:
       i = va_arg(ap, int);
@@ -150,6 +279,13 @@ void Database::Statement::vbind(va_list ap) {
       if(rc != SQLITE_OK)
         error("sqlite3_bind_int64", rc);
       break;
+    case SQL_DOUBLE:
+      f = va_arg(ap, double);
+      D("vbind %d: %g", param, f);
+      rc = sqlite3_bind_double(stmt, param, f);
+      if(rc != SQLITE_OK)
+        error("sqlite3_bind_double", rc);
+      break;
     case SQL_STRING:
       s = va_arg(ap, const std::string *);
       D("vbind %d: %.*s", param, (int)s->size(), s->data());
@@ -205,6 +341,12 @@ sqlite_int64 Database::Statement::get_int64(int col) {
   return n;
 }
 
+double Database::Statement::get_double(int col) {
+  double f = sqlite3_column_double(stmt, col);
+  D("get_double %2d: %g", col, f);
+  return f;
+}
+
 std::string Database::Statement::get_string(int col) {
   const unsigned char *t = sqlite3_column_text(stmt, col);
   int nt = sqlite3_column_bytes(stmt, col);
@@ -220,5 +362,7 @@ std::string Database::Statement::get_blob(int col) {
 }
 
 Database::Statement::~Statement() {
-  sqlite3_finalize(stmt);
+  // Keep the statement for reuse
+  if(stmt)
+    database.release(stmt);
 }
@@ -17,7 +17,11 @@
 #define DATABASE_H
 
 #include <sqlite3.h>
+#include <list>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include "Defaults.h"
 
 /** @file Database.h
  * @brief %Database support
@@ -41,6 +45,9 @@
 /** @brief Bind a @c const @c char @c * as text */
 #define SQL_CSTRING 5
 
+/** @brief Bind a @c double */
+#define SQL_DOUBLE 6
+
 /** @brief A database handle */
 class Database {
 public:
@@ -51,7 +58,7 @@ public:
      * @param d Database
      * @throw DatabaseError if an error occurs
      */
-    inline Statement(Database &d): db(d.db) {}
+    inline Statement(Database &d): database(d), db(d.db) {}
 
     /** @brief Create a statement, prepare it with a command and bind data it
      * @param d Database
@@ -67,6 +74,7 @@ public:
      * - @ref SQL_STRING, followed by a @c const @c std::string @c * parameter
      * value.
      * - @ref SQL_CSTRING, followed by a @c const @c char @c * parameter value.
+     * - @ref SQL_DOUBLE, followed by a @c double parameter value.
      */
     Statement(Database &d, const char *cmd, ...);
 
@@ -86,6 +94,7 @@ public:
      * - @ref SQL_STRING, followed by a @c const @c std::string @c * parameter
      * value.
      * - @ref SQL_CSTRING, followed by a @c const @c char @c * parameter value.
+     * - @ref SQL_DOUBLE, followed by a @c double parameter value.
      */
     void prepare(const char *cmd, ...);
 
@@ -108,6 +117,12 @@ public:
      */
     sqlite_int64 get_int64(int col);
 
+    /** @brief Get a @c double value
+     * @param col Column number from 0
+     * @return Floating point value
+     */
+    double get_double(int col);
+
     /** @brief Get a @c std::string value as text
      * @param col Column number from 0
      * @return String value
@@ -132,13 +147,14 @@ public:
     void vprepare(const char *cmd, va_list ap);
 
     /** @brief Bind to a statement
+     * @param t Type of first parameter, or @ref SQL_END
      * @param ap Binding information
      * @throw DatabaseError if an error occurs
      *
      * Depends on @ref param being initialized so only callable from or after
      * @ref vprepare and its callers.
      */
-    void vbind(va_list ap);
+    void vbind(int t, va_list ap);
 
     /** @brief Raise an error
      * @param description Context for error
@@ -153,6 +169,9 @@ public:
     /** @brief Underlying statement handle */
     sqlite3_stmt *stmt = nullptr;
 
+    /** @brief Database */
+    Database &database;
+
     /** @brief Underlying database handle */
     sqlite3 *db = nullptr;
 
@@ -165,11 +184,23 @@ public:
   /** @brief Create a database object
    * @param path Path to database
    * @param rw Read-write mode
+   * @param timeout Busy timeout in milliseconds
    * @throw DatabaseError if an error occurs
    *
-   * In read-write mode, the database is created if it does not exist.
+   * In read-write mode, the database is created if it does not exist, and is
+   * switched to write-ahead logging, so that readers in other connections
+   * don't block writers.
+   *
+   * Reading a database in write-ahead logging mode requires its @c -shm and
+   * @c -wal files, which can only be created with write access to the
+   * directory containing it.  If they cannot be created in read-only mode,
+   * the database file is read without locking or consulting them instead.
+   * Any updates not yet copied from the @c -wal file will not be seen.
+   *
+   * If the database is locked then operations are retried for up to @p
+   * timeout milliseconds before @ref DatabaseBusy is thrown.
    */
-  Database(const std::string &path, bool rw = true);
+  Database(const std::string &path, bool rw = true, int timeout = 0);
 
   Database(const Database &) = delete;
   Database &operator=(const Database &) = delete;
@@ -203,6 +234,17 @@ public:
   /** @brief Abandon a transaction */
   void rollback();
 
+  /** @brief Set the size of the prepared statement cache
+   * @param n Maximum number of statements to cache, or 0 to disable caching
+   */
+  void setStatementCacheSize(size_t n);
+
+  /** @brief Return the number of statements prepared so far
+   *
+   * Statements reused from the cache are not counted.
+   */
+  size_t getStatementsPrepared();
+
   /** @brief Destructor */
   ~Database();
 
@@ -210,6 +252,63 @@ private:
   /** @brief Underlying database handle */
   sqlite3 *db = nullptr;
 
+  /** @brief Open the underlying database handle
+   * @param path Path or URI of database
+   * @param flags Flags for @c sqlite3_open_v2
+   * @param timeout Busy timeout in milliseconds
+   * @throw DatabaseError if an error occurs
+   */
+  void open(const std::string &path, int flags, int timeout);
+
+  /** @brief Close the underlying database handle
+   *
+   * Only used during construction, before any statements are cached.
+   */
+  void close();
+
+  /** @brief Find a statement in the cache
+   * @param cmd Command
+   * @return Prepared statement, or a null pointer
+   *
+   * A statement returned by this function is removed from the cache until it
+   * is passed to @ref release.
+   */
+  sqlite3_stmt *lookup(const char *cmd);
+
+  /** @brief Return a statement to the cache
+   * @param stmt Statement
+   *
+   * The statement is reset and its bindings cleared.  If the cache is full,
+   * the least recently used statement is finalized.
+   */
+  void release(sqlite3_stmt *stmt);
+
+  /** @brief Display the query plan for a command
+   * @param cmd Command
+   *
+   * Used when @c --explain-queries is in effect.
+   */
+  void explain(const char *cmd);
+
+  /** @brief Finalize statements until the cache is within its size limit */
+  void trim();
+
+  /** @brief Protects the statement cache */
+  std::mutex cacheLock;
+
+  /** @brief Cached statements, most recently used first */
+  std::list<sqlite3_stmt *> cache;
+
+  /** @brief Index of @ref cache by SQL text */
+  std::unordered_map<std::string, std::list<sqlite3_stmt *>::iterator>
+      cacheIndex;
+
+  /** @brief Maximum size of @ref cache */
+  size_t cacheSize = DEFAULT_STATEMENT_CACHE_SIZE;
+
+  /** @brief Number of statements prepared */
+  size_t prepared = 0;
+
   /** @brief Raise an error
    * @param description Context for error
    * @param rc Error code
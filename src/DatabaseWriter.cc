@@ -0,0 +1,231 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "DatabaseWriter.h"
+#include "Database.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "Utils.h"
+
+DatabaseWriter::DatabaseWriter(Database &db_): db(db_) {
+  thread = std::thread(&DatabaseWriter::writer, this);
+}
+
+DatabaseWriter::~DatabaseWriter() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    work.notify_one();
+  }
+  thread.join();
+  report();
+}
+
+void DatabaseWriter::submit(Job job) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back({job, nullptr});
+    ++submitted;
+    work.notify_one();
+  }
+  report();
+}
+
+void DatabaseWriter::execute(Job job) {
+  Result result;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    queue.push_back({job, &result});
+    ++submitted;
+    work.notify_one();
+    while(!result.finished)
+      done.wait(guard);
+  }
+  report();
+  if(result.error)
+    std::rethrow_exception(result.error);
+}
+
+void DatabaseWriter::sync() {
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    const size_t target = submitted;
+    while(completed < target)
+      done.wait(guard);
+  }
+  report();
+}
+
+DatabaseWriter::Batch::Batch(DatabaseWriter &writer_, EventLoop *eventloop_,
+                             Clock *clock_):
+    writer(writer_), eventloop(eventloop_),
+    clock(clock_ ? clock_ : getMonotonicTime) {}
+
+void DatabaseWriter::Batch::add(Job job) {
+  struct timespec now;
+  clock(now);
+  if(jobs.size() == 0) {
+    deadline = now;
+    deadline.tv_sec += DATABASE_BATCH_DELAY;
+    if(eventloop)
+      timeout = eventloop->whenTimeout(deadline, this);
+  }
+  jobs.push_back(job);
+  if(jobs.size() >= DATABASE_BATCH_JOBS || now >= deadline)
+    flush();
+}
+
+void DatabaseWriter::Batch::onTimeout(EventLoop *, const struct timespec &) {
+  timeout = 0;
+  flush();
+}
+
+void DatabaseWriter::Batch::flush() {
+  if(timeout) {
+    eventloop->cancelTimeout(timeout);
+    timeout = 0;
+  }
+  if(jobs.size() == 0)
+    return;
+  std::vector<Job> batch;
+  batch.swap(jobs);
+  writer.submit([batch = std::move(batch)](Database &db) {
+    for(auto &job: batch)
+      job(db);
+  });
+}
+
+size_t DatabaseWriter::getCommits() {
+  std::lock_guard<std::mutex> guard(lock);
+  return commits;
+}
+
+void DatabaseWriter::writer() {
+  std::unique_lock<std::mutex> guard(lock);
+  for(;;) {
+    while(queue.empty() && !stopping)
+      work.wait(guard);
+    // Outstanding jobs are completed before stopping
+    if(queue.empty())
+      return;
+    // Everything that has accumulated is committed together
+    std::vector<Entry> batch;
+    batch.swap(queue);
+    D("database writer: %zu jobs", batch.size());
+    {
+      release_guard<std::mutex> release(lock);
+      commitBatch(batch);
+    }
+    for(auto &e: batch)
+      if(e.result)
+        e.result->finished = true;
+    completed += batch.size();
+    done.notify_all();
+  }
+}
+
+void DatabaseWriter::commitBatch(std::vector<Entry> &batch) {
+  try {
+    transaction(batch.begin(), batch.end());
+    for(auto &e: batch)
+      finish(e, nullptr);
+    return;
+  } catch(DatabaseBusy &) {
+    // Retrying jobs separately would just mean waiting even longer
+    for(auto &e: batch)
+      finish(e, std::current_exception());
+    return;
+  } catch(std::runtime_error &) {
+    if(batch.size() == 1) {
+      finish(batch[0], std::current_exception());
+      return;
+    }
+  }
+  // Something other than contention went wrong.  Commit each job separately,
+  // so that only the faulty one fails.
+  for(auto it = batch.begin(); it != batch.end(); ++it) {
+    try {
+      transaction(it, it + 1);
+      finish(*it, nullptr);
+    } catch(std::runtime_error &) {
+      finish(*it, std::current_exception());
+    }
+  }
+}
+
+void DatabaseWriter::transaction(std::vector<Entry>::iterator first,
+                                 std::vector<Entry>::iterator last) {
+  for(int attempt = 0;; ++attempt) {
+    try {
+      db.begin();
+      for(auto it = first; it != last; ++it)
+        it->job(db);
+      db.commit();
+      std::lock_guard<std::mutex> guard(lock);
+      ++commits;
+      return;
+    } catch(DatabaseBusy &e) {
+      rollback();
+      if(attempt >= DATABASE_BUSY_RETRIES)
+        throw;
+      // The busy timeout has already expired, so there is no need to wait
+      // before trying again.
+      defer(false, std::string("retrying database update: ") + e.what());
+    } catch(std::runtime_error &) {
+      rollback();
+      throw;
+    }
+  }
+}
+
+void DatabaseWriter::rollback() {
+  try {
+    db.rollback();
+  } catch(DatabaseError &) {
+    // The transaction may already have been rolled back
+  }
+}
+
+void DatabaseWriter::finish(Entry &e, std::exception_ptr error) {
+  if(e.result)
+    e.result->error = error;
+  else if(error) {
+    try {
+      std::rethrow_exception(error);
+    } catch(std::runtime_error &exception) {
+      defer(true, std::string("database update failed: ") + exception.what());
+    }
+  }
+}
+
+void DatabaseWriter::defer(bool isError, const std::string &message) {
+  std::lock_guard<std::mutex> guard(lock);
+  messages.push_back({isError, message});
+}
+
+void DatabaseWriter::report() {
+  std::vector<Message> pending;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    pending.swap(messages);
+  }
+  for(auto &m: pending) {
+    if(m.isError)
+      ::error("%s", m.text.c_str());
+    else
+      warning(WARNING_DATABASE, "%s", m.text.c_str());
+  }
+}
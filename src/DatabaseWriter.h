@@ -0,0 +1,283 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef DATABASEWRITER_H
+#define DATABASEWRITER_H
+/** @file DatabaseWriter.h
+ * @brief Serialized database updates
+ */
+
+#include <condition_variable>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "EventLoop.h"
+
+class Database;
+
+/** @brief Perform all database updates from a single thread
+ *
+ * Updates are submitted as jobs, which are executed in order by a dedicated
+ * writer thread.  Whatever jobs have accumulated by the time the writer is
+ * ready are committed together in a single transaction, so concurrent backups
+ * share commits rather than contending for the database lock.
+ *
+ * If the database is busy (i.e. the busy timeout expired) the transaction is
+ * retried, up to @ref DATABASE_BUSY_RETRIES times; the database should
+ * reflect the state of the backups on disk.  If it is still busy, all the
+ * jobs fail.  If any other error occurs, the jobs are retried one per
+ * transaction, so that only the job responsible fails.
+ *
+ * Jobs must not use the global lock.
+ *
+ * The writer thread does not report anything itself, since @ref error and
+ * @ref warning may only be called with the global lock held.  Failures of
+ * jobs submitted with @ref submit, and retries, are reported by the next call
+ * to @ref submit, @ref execute or @ref sync, or by the destructor.  Callers
+ * must hold the global lock.
+ *
+ * All methods are thread-safe.
+ */
+class DatabaseWriter {
+public:
+  /** @brief Type of a job */
+  typedef std::function<void(Database &)> Job;
+
+  /** @brief Collect jobs and submit them in bounded groups
+   *
+   * Jobs added to a batch are submitted as a single job once @ref
+   * DATABASE_BATCH_JOBS have accumulated, or when a job is added @ref
+   * DATABASE_BATCH_DELAY seconds or more after the first of them.  If the
+   * batch is attached to an event loop, they are also submitted when that
+   * delay expires while the event loop is running.  Anything left over is
+   * submitted when the batch is flushed or destroyed.
+   *
+   * This is for bulk updates, such as recording the outcome of a large prune,
+   * which would otherwise cost a commit each, or one unbounded transaction.
+   *
+   * A batch is not thread-safe.
+   */
+  class Batch: public Reactor {
+  public:
+    /** @brief Type of a clock function
+     *
+     * Must behave like @ref getMonotonicTime.
+     */
+    typedef void Clock(struct timespec &now);
+
+    /** @brief Constructor
+     * @param writer_ Writer to submit jobs to
+     * @param eventloop_ Event loop to flush from, or a null pointer
+     * @param clock_ Clock, or a null pointer to use @ref getMonotonicTime
+     *
+     * If @p eventloop_ is not a null pointer then the batch must be
+     * destroyed before it.
+     */
+    Batch(DatabaseWriter &writer_, EventLoop *eventloop_ = nullptr,
+          Clock *clock_ = nullptr);
+
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+    /** @brief Destructor
+     *
+     * Submits any jobs not yet submitted, but does not wait for them.
+     */
+    ~Batch() override {
+      flush();
+    }
+
+    /** @brief Add a job
+     * @param job Job to execute
+     */
+    void add(Job job);
+
+    /** @brief Submit any jobs not yet submitted */
+    void flush();
+
+    /** @brief Called when the delay has expired
+     * @param e Event loop
+     * @param now Current time
+     *
+     * Submits any jobs not yet submitted.
+     */
+    void onTimeout(EventLoop *e, const struct timespec &now) override;
+
+  private:
+    /** @brief Writer to submit jobs to */
+    DatabaseWriter &writer;
+
+    /** @brief Event loop to flush from, or a null pointer */
+    EventLoop *eventloop;
+
+    /** @brief Clock */
+    Clock *clock;
+
+    /** @brief Jobs not yet submitted */
+    std::vector<Job> jobs;
+
+    /** @brief When the jobs in @ref jobs are due to be submitted */
+    struct timespec deadline;
+
+    /** @brief Pending timeout in @ref eventloop, or 0 */
+    EventLoop::TimeoutId timeout = 0;
+  };
+
+  /** @brief Constructor
+   * @param db Database to update
+   *
+   * Starts the writer thread.  @p db must not be used for anything else while
+   * the writer exists.
+   */
+  DatabaseWriter(Database &db);
+
+  DatabaseWriter(const DatabaseWriter &) = delete;
+  DatabaseWriter &operator=(const DatabaseWriter &) = delete;
+
+  /** @brief Destructor
+   *
+   * Waits for all outstanding jobs to complete and stops the writer thread.
+   */
+  ~DatabaseWriter();
+
+  /** @brief Submit a job without waiting for it
+   * @param job Job to execute
+   *
+   * If the job fails, an error is reported by a later call (see above).
+   */
+  void submit(Job job);
+
+  /** @brief Submit a job and wait for it to be committed
+   * @param job Job to execute
+   *
+   * If the job fails, the exception it raised is rethrown.
+   */
+  void execute(Job job);
+
+  /** @brief Wait for all jobs submitted so far to be committed */
+  void sync();
+
+  /** @brief Return the number of transactions committed so far */
+  size_t getCommits();
+
+private:
+  /** @brief Outcome of a job that is being waited for */
+  struct Result {
+    /** @brief Set when the job has completed */
+    bool finished = false;
+
+    /** @brief Exception raised by the job, if any */
+    std::exception_ptr error;
+  };
+
+  /** @brief A queued job */
+  struct Entry {
+    /** @brief Job to execute */
+    Job job;
+
+    /** @brief Where to record completion, or a null pointer */
+    Result *result;
+  };
+
+  /** @brief Writer thread body */
+  void writer();
+
+  /** @brief Commit a batch of jobs
+   * @param batch Jobs to commit
+   */
+  void commitBatch(std::vector<Entry> &batch);
+
+  /** @brief Execute some jobs in a single transaction
+   * @param first First job to execute
+   * @param last End of jobs to execute
+   *
+   * If the database is busy, the transaction is retried, up to @ref
+   * DATABASE_BUSY_RETRIES times.  Any other error, or the database still
+   * being busy, rolls back the transaction and is rethrown.
+   */
+  void transaction(std::vector<Entry>::iterator first,
+                   std::vector<Entry>::iterator last);
+
+  /** @brief Roll back the current transaction, if there is one */
+  void rollback();
+
+  /** @brief Record the outcome of a job
+   * @param e Job
+   * @param error Exception raised by the job, or a null pointer
+   */
+  void finish(Entry &e, std::exception_ptr error);
+
+  /** @brief A message waiting to be reported */
+  struct Message {
+    /** @brief @c true for an error, @c false for a warning */
+    bool isError;
+
+    /** @brief Text of the message */
+    std::string text;
+  };
+
+  /** @brief Queue a message to be reported by a thread holding the global lock
+   * @param isError @c true for an error, @c false for a warning
+   * @param message Text of the message
+   *
+   * Called from the writer thread.
+   */
+  void defer(bool isError, const std::string &message);
+
+  /** @brief Report any messages queued by the writer thread
+   *
+   * Must be called with the global lock held and @ref lock not held.
+   */
+  void report();
+
+  /** @brief Database to update */
+  Database &db;
+
+  /** @brief Protects everything below */
+  std::mutex lock;
+
+  /** @brief Signaled when there is work or when the writer should stop */
+  std::condition_variable work;
+
+  /** @brief Signaled when jobs complete */
+  std::condition_variable done;
+
+  /** @brief Jobs waiting to be executed */
+  std::vector<Entry> queue;
+
+  /** @brief Messages waiting to be reported */
+  std::vector<Message> messages;
+
+  /** @brief Number of jobs submitted */
+  size_t submitted = 0;
+
+  /** @brief Number of jobs completed */
+  size_t completed = 0;
+
+  /** @brief Number of transactions committed */
+  size_t commits = 0;
+
+  /** @brief Set to stop the writer thread */
+  bool stopping = false;
+
+  /** @brief Writer thread */
+  std::thread thread;
+};
+
+#endif /* DATABASEWRITER_H */
@@ -64,11 +64,17 @@
 /** @brief Default age for pruning logs in report */
 #define DEFAULT_PRUNE_REPORT_AGE 3
 
-/** @brief Default maximum disk usage */
-#define DEFAULT_MAX_USAGE 80
+/** @brief Default maximum disk usage
+ *
+ * The default is not to limit usage.
+ */
+#define DEFAULT_MAX_USAGE 100
 
-/** @brief Default maximum inode usage */
-#define DEFAULT_MAX_FILE_USAGE 80
+/** @brief Default maximum inode usage
+ *
+ * The default is not to limit usage.
+ */
+#define DEFAULT_MAX_FILE_USAGE 100
 
 /** @brief Default log directory */
 #define DEFAULT_LOGS "/var/log/backup"
@@ -76,9 +82,73 @@
 /** @brief Default database filename */
 #define DEFAULT_DATABASE "backups.db"
 
+/** @brief Default number of backups to offer to @c rsync @c --link-dest */
+#define DEFAULT_LINK_DEST_DEPTH 1
+
+/** @brief Maximum number of @c --link-dest options supported by @c rsync */
+#define MAX_LINK_DEST 20
+
 /** @brief Default SSH timeout */
 #define DEFAULT_SSH_TIMEOUT 60
 
+/** @brief Default number of backup worker threads */
+#define DEFAULT_BACKUP_THREADS 16
+
+/** @brief Default number of threads removing backups from each device */
+#define DEFAULT_REMOVE_THREADS 4
+
+/** @brief Default I/O scheduling class for removing backups */
+#define DEFAULT_REMOVE_IO_CLASS "idle"
+
+/** @brief Default I/O priority level for removing backups */
+#define DEFAULT_REMOVE_IO_LEVEL 4
+
+/** @brief Name of the directory in each store holding pruned backups
+ *
+ * Pruned backups are renamed into this directory and removed from there.
+ */
+#define TRASH_DIRECTORY ".trash"
+
+/** @brief Number of recent backups used to estimate backup durations */
+#define DURATION_ESTIMATE_BACKUPS 10
+
+/** @brief How long an idle SSH master connection persists
+ *
+ * Master connections are normally shut down explicitly; this is just a
+ * backstop in case that doesn't happen.
+ */
+#define DEFAULT_SSH_CONTROL_PERSIST 600
+
+/** @brief Default number of prepared statements to cache per database */
+#define DEFAULT_STATEMENT_CACHE_SIZE 32
+
+/** @brief Default database busy timeout
+ *
+ * How long to wait for a lock on the database before giving up.
+ */
+#define DEFAULT_DATABASE_BUSY_TIMEOUT 60
+
+/** @brief Number of times to retry a database update if the database is busy
+ *
+ * Each attempt waits for the database busy timeout.
+ */
+#define DATABASE_BUSY_RETRIES 10
+
+/** @brief Maximum number of jobs in a database update batch
+ *
+ * See @ref DatabaseWriter::Batch.
+ */
+#define DATABASE_BATCH_JOBS 500
+
+/** @brief Maximum delay before submitting a database update batch, in seconds
+ *
+ * See @ref DatabaseWriter::Batch.
+ */
+#define DATABASE_BATCH_DELAY 1
+
+/** @brief Seconds allowed for a batch-mode pruning subprogram to reply */
+#define PRUNE_EXEC_TIMEOUT 600
+
 /** @brief Default pruning timeout */
 #define DEFAULT_PRUNE_TIMEOUT 0
 
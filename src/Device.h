@@ -44,6 +44,12 @@ public:
   /** @brief Number of accesses permitted */
   ConcurrencyLimit concurrency;
 
+  /** @brief Number of backups that may be removed at once
+   *
+   * Corresponds to @c max-concurrency @c removal.
+   */
+  int removalConcurrency = 1;
+
   /** @brief Validity test for device names
    * @param n Name of device
    * @return true if @p n is a valid device name, else false
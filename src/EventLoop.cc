@@ -23,7 +23,51 @@
 #include <sys/wait.h>
 #include <sys/resource.h>
 #include <sys/time.h>
-#include <signal.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#if HAVE_SYS_EPOLL_H && HAVE_DECL_SYS_PIDFD_OPEN
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+/** @brief How often to poll subprocesses with the select backend */
+#define SUBPROCESS_POLL_NS 100000000
+
+/** @brief Size of the buffer used to read input */
+#define READ_BUFFER 65536
+
+/** @brief Maximum bytes to move in one call to @c splice(2) */
+#define SPLICE_MAX (1024 * 1024)
+
+/** @brief Maximum events to collect in one call to @c epoll_wait(2) */
+#define EPOLL_EVENTS 256
+
+#if USE_EPOLL
+/** @brief Open a process file descriptor
+ * @param pid Process ID
+ * @return File descriptor or -1 on error
+ */
+static int pidfdOpen(pid_t pid) {
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/** @brief Test whether the kernel supports process file descriptors
+ * @return @c true if they are supported
+ *
+ * They were introduced in Linux 5.3.
+ */
+static bool pidfdSupported() {
+  static const bool supported = [] {
+    int fd = pidfdOpen(getpid());
+    if(fd < 0)
+      return false;
+    close(fd);
+    return true;
+  }();
+  return supported;
+}
+#endif
 
 void Reactor::onReadable(EventLoop *, int, const void *, size_t) {
   throw std::logic_error("Reactor::onReadable");
@@ -45,69 +89,305 @@ void Reactor::onWait(EventLoop *, pid_t, int, const struct rusage &) {
   throw std::logic_error("Reactor::onWait");
 }
 
-EventLoop::EventLoop() {}
+void Reactor::onTerminate(EventLoop *) {
+  throw std::logic_error("Reactor::onTerminate");
+}
+
+EventLoop::EventLoop(Backend backend) {
+#if USE_EPOLL
+  if(backend == Epoll && pidfdSupported()) {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0 && errno != ENOSYS)
+      throw IOError("epoll_create1", errno);
+  }
+#endif
+}
 
-EventLoop::~EventLoop() {}
+EventLoop::~EventLoop() {
+  for(auto &p: pidfds)
+    close(p.second);
+  if(epfd >= 0)
+    close(epfd);
+}
 
-void EventLoop::whenReadable(int fd, Reactor *r) {
+void EventLoop::whenReadable(int fd, Reactor *r, int sink) {
   readers[fd] = r;
+  if(sink >= 0)
+    sinks[fd] = sink;
+  else
+    sinks.erase(fd);
   reconf = true;
+  updateEpoll(fd);
 }
 
 void EventLoop::cancelRead(int fd) {
   readers.erase(fd);
+  sinks.erase(fd);
   reconf = true;
+  updateEpoll(fd);
 }
 
 void EventLoop::whenWritable(int fd, Reactor *r) {
   writers[fd] = r;
   reconf = true;
+  updateEpoll(fd);
 }
 
 void EventLoop::cancelWrite(int fd) {
   writers.erase(fd);
   reconf = true;
+  updateEpoll(fd);
 }
 
-void EventLoop::whenTimeout(const struct timespec &t, Reactor *r) {
-  timeouts.insert({t, r});
+EventLoop::TimeoutId EventLoop::whenTimeout(const struct timespec &t,
+                                            Reactor *r) {
   reconf = true;
+  return timeouts.add(t, r);
+}
+
+void EventLoop::cancelTimeout(TimeoutId id) {
+  timeouts.cancel(id);
 }
 
 void EventLoop::whenWaited(pid_t pid, Reactor *r) {
   waiters[pid] = r;
   reconf = true;
+#if USE_EPOLL
+  if(epfd >= 0 && pidfds.find(pid) == pidfds.end()) {
+    int fd = pidfdOpen(pid);
+    if(fd < 0)
+      throw SystemError("pidfd_open", errno);
+    // If a file descriptor with the same number was closed without being
+    // cancelled, forget about it.
+    registered.erase(fd);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      int save_errno = errno;
+      close(fd);
+      throw IOError("epoll_ctl", save_errno);
+    }
+    pidfds[pid] = fd;
+    pidfdOwners[fd] = pid;
+  }
+#endif
+}
+
+void EventLoop::cancelWait(pid_t pid) {
+  waiters.erase(pid);
+#if USE_EPOLL
+  auto it = pidfds.find(pid);
+  if(it != pidfds.end()) {
+    const int fd = it->second;
+    // A child that has not yet exec'd may hold a copy of the file descriptor,
+    // so closing it is not enough to remove it from the epoll set.
+    if(epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr) < 0)
+      throw IOError("epoll_ctl", errno);
+    close(fd);
+    pidfdOwners.erase(fd);
+    pidfds.erase(it);
+  }
+#endif
+}
+
+void EventLoop::updateEpoll(int fd) {
+#if USE_EPOLL
+  if(epfd < 0)
+    return;
+  uint32_t events = 0;
+  if(readers.find(fd) != readers.end())
+    events |= EPOLLIN;
+  if(writers.find(fd) != writers.end())
+    events |= EPOLLOUT;
+  auto it = registered.find(fd);
+  const uint32_t current = it != registered.end() ? it->second : 0;
+  if(events == current)
+    return;
+  if(events == 0) {
+    registered.erase(it);
+    // EBADF means the file descriptor was closed before being cancelled, which
+    // removes it from the epoll set anyway.
+    if(epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr) < 0 && errno != EBADF
+       && errno != ENOENT)
+      throw IOError("epoll_ctl", errno);
+    return;
+  }
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  int rc = epoll_ctl(epfd, current ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+  // The file descriptor may have been closed and reopened since it was
+  // registered, in which case the registration is either gone or stale.
+  if(rc < 0 && errno == ENOENT)
+    rc = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  else if(rc < 0 && errno == EEXIST)
+    rc = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+  if(rc < 0)
+    throw IOError("epoll_ctl", errno);
+  registered[fd] = events;
+#endif
 }
 
 void EventLoop::wait(bool wait_for_timeouts) {
+  if(epfd >= 0)
+    waitEpoll(wait_for_timeouts);
+  else
+    waitSelect(wait_for_timeouts);
+}
+
+bool EventLoop::checkTimeouts(struct timespec &ts) {
+  if(timeouts.size() == 0) {
+    ts.tv_sec = -1;
+    ts.tv_nsec = 0;
+    return false;
+  }
+  struct timespec now;
+  getMonotonicTime(now);
+  if(Reactor *r = timeouts.expire(now)) {
+    r->onTimeout(this, now);
+    return true;
+  }
+  timeouts.next(now, ts);
+  if(ts.tv_sec >= 10)
+    ts.tv_sec = 10;
+  return false;
+}
+
+void EventLoop::readAndNotify(int fd, Reactor *r) {
+  auto si = sinks.find(fd);
+  if(si != sinks.end()) {
+    transfer(fd, si->second, r);
+    return;
+  }
+  char buffer[READ_BUFFER];
+  ssize_t nbytes = read(fd, buffer, sizeof buffer);
+  if(nbytes < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return;
+    r->onReadError(this, fd, errno);
+  } else
+    r->onReadable(this, fd, buffer, nbytes);
+}
+
+void EventLoop::transfer(int fd, int sink, Reactor *r) {
+  ssize_t nbytes;
+#if HAVE_SPLICE
+  nbytes = splice(fd, nullptr, sink, nullptr, SPLICE_MAX,
+                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if(nbytes >= 0) {
+    r->onReadable(this, fd, nullptr, nbytes);
+    return;
+  }
+  if(errno == EINTR || errno == EAGAIN)
+    return;
+  // EINVAL means that splice doesn't support this combination of files
+  if(errno != EINVAL && errno != ENOSYS) {
+    r->onReadError(this, fd, errno);
+    return;
+  }
+#endif
+  char buffer[READ_BUFFER];
+  nbytes = read(fd, buffer, sizeof buffer);
+  if(nbytes < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return;
+    r->onReadError(this, fd, errno);
+    return;
+  }
+  for(ssize_t written = 0; written < nbytes;) {
+    ssize_t n = write(sink, buffer + written, nbytes - written);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      r->onReadError(this, fd, errno);
+      return;
+    }
+    written += n;
+  }
+  r->onReadable(this, fd, nullptr, nbytes);
+}
+
+bool EventLoop::reap(pid_t pid) {
+  struct rusage ru;
+  int status, rc = wait4(pid, &status, WNOHANG, &ru);
+  if(rc < 0) {
+    if(errno == EINTR)
+      return false;
+    throw SystemError("wait4", errno);
+  }
+  if(rc == 0)
+    return false;
+  Reactor *r = waiters.at(pid);
+  cancelWait(pid);
+  r->onWait(this, pid, status, ru);
+  return true;
+}
+
+void EventLoop::waitEpoll(bool wait_for_timeouts) {
+#if USE_EPOLL
+  struct epoll_event events[EPOLL_EVENTS];
+  while(readers.size() > 0 || writers.size() > 0 || waiters.size() > 0
+        || (wait_for_timeouts && timeouts.size() > 0)) {
+    struct timespec ts;
+    if(checkTimeouts(ts))
+      continue;
+    // Round up, so as not to wake up just before the timeout
+    const int timeout = ts.tv_sec < 0 ? -1
+                                      : ts.tv_sec * 1000
+                                            + (ts.tv_nsec + 999999) / 1000000;
+    int n = epoll_wait(epfd, events, EPOLL_EVENTS, timeout);
+    if(n < 0) {
+      if(errno != EINTR)
+        throw IOError("epoll_wait", errno);
+      continue;
+    }
+    reconf = false;
+    for(int i = 0; i < n && !reconf; ++i) {
+      const int fd = events[i].data.fd;
+      const uint32_t ev = events[i].events;
+      auto pi = pidfdOwners.find(fd);
+      if(pi != pidfdOwners.end()) {
+        reap(pi->second);
+        continue;
+      }
+      if(ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        auto ri = readers.find(fd);
+        if(ri != readers.end()) {
+          readAndNotify(fd, ri->second);
+          if(reconf)
+            break;
+        }
+      }
+      if(ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+        auto wi = writers.find(fd);
+        if(wi != writers.end())
+          wi->second->onWritable(this, fd);
+      }
+    }
+  }
+#else
+  (void)wait_for_timeouts;
+  throw std::logic_error("EventLoop::waitEpoll");
+#endif
+}
+
+void EventLoop::waitSelect(bool wait_for_timeouts) {
   while(readers.size() > 0 || writers.size() > 0 || waiters.size() > 0
         || (wait_for_timeouts && timeouts.size() > 0)) {
     fd_set rfds, wfds;
     struct timespec ts, *tsp;
     int maxfd = -1, n;
-    if(timeouts.size() > 0) {
-      auto it = timeouts.begin();
-      struct timespec now, first = it->first;
-      getMonotonicTime(now);
-      if(now >= first) {
-        Reactor *r = it->second;
-        timeouts.erase(it);
-        r->onTimeout(this, now);
-        continue;
-      }
-      ts = first - now;
-      if(ts.tv_sec >= 10)
-        ts.tv_sec = 10;
-      tsp = &ts;
-    } else
-      tsp = nullptr;
+    if(checkTimeouts(ts))
+      continue;
+    tsp = ts.tv_sec >= 0 ? &ts : nullptr;
     // Ideally we would wait for SIGCHLD. But this is a threaded program now,
     // and distribution child termination notifications to the right thread is
     // too hard. So we just poll.
     if(waiters.size() > 0) {
-      if(tsp == nullptr || ts.tv_sec > 0 || ts.tv_nsec > 100000000) {
+      if(tsp == nullptr || ts.tv_sec > 0 || ts.tv_nsec > SUBPROCESS_POLL_NS) {
         ts.tv_sec = 0;
-        ts.tv_nsec = 100000000;
+        ts.tv_nsec = SUBPROCESS_POLL_NS;
         tsp = &ts;
       }
     }
@@ -115,11 +395,15 @@ void EventLoop::wait(bool wait_for_timeouts) {
     FD_ZERO(&wfds);
     for(auto &r: readers) {
       int fd = r.first;
+      if(fd >= FD_SETSIZE)
+        throw IOError("pselect", EINVAL);
       FD_SET(fd, &rfds);
       maxfd = std::max(maxfd, fd);
     }
     for(auto &w: writers) {
       int fd = w.first;
+      if(fd >= FD_SETSIZE)
+        throw IOError("pselect", EINVAL);
       FD_SET(fd, &wfds);
       maxfd = std::max(maxfd, fd);
     }
@@ -132,14 +416,7 @@ void EventLoop::wait(bool wait_for_timeouts) {
       for(auto &r: readers) {
         int fd = r.first;
         if(FD_ISSET(fd, &rfds)) {
-          char buffer[4096];
-          ssize_t nbytes = read(fd, buffer, sizeof buffer);
-          if(nbytes < 0) {
-            if(errno == EINTR || errno == EAGAIN)
-              continue;
-            r.second->onReadError(this, fd, errno);
-          } else
-            r.second->onReadable(this, fd, buffer, nbytes);
+          readAndNotify(fd, r.second);
           if(reconf)
             break;
         }
@@ -154,18 +431,9 @@ void EventLoop::wait(bool wait_for_timeouts) {
       }
     }
     for(auto wi = waiters.begin(); wi != waiters.end();) {
-      struct rusage ru;
-      int status, pid = wait4(wi->first, &status, WNOHANG, &ru);
-      if(pid < 0) {
-        if(errno != EINTR)
-          throw SystemError("wait4", errno);
-      }
-      if(pid) {
-        Reactor *r = wi->second;
-        wi = waiters.erase(wi);
-        r->onWait(this, pid, status, ru);
-      } else
-        ++wi;
+      const pid_t pid = wi->first;
+      ++wi;
+      reap(pid);
     }
   }
 }
@@ -173,4 +441,16 @@ void EventLoop::wait(bool wait_for_timeouts) {
 void EventLoop::terminateSubprocesses() {
   for(auto it = waiters.begin(); it != waiters.end(); ++it)
     kill(it->first, SIGTERM);
+  // Reactors may cancel themselves
+  std::set<Reactor *> notify = terminated;
+  for(Reactor *r: notify)
+    r->onTerminate(this);
+}
+
+void EventLoop::whenTerminated(Reactor *r) {
+  terminated.insert(r);
+}
+
+void EventLoop::cancelTerminated(Reactor *r) {
+  terminated.erase(r);
 }
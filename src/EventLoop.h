@@ -30,6 +30,10 @@
  */
 
 #include <map>
+#include <set>
+#include <cstdint>
+#include <sys/types.h>
+#include "TimerWheel.h"
 
 class EventLoop;
 class Reactor;
@@ -42,6 +46,7 @@ class Reactor;
  * - @ref EventLoop::whenWritable
  * - @ref EventLoop::whenTimeout
  * - @ref EventLoop::whenWaited
+ * - @ref EventLoop::whenTerminated
  *
  * Normally you would implement at least one of the @c on... methods.  Those
  * that are not implemented will raise @c std::logic_error.  However they will
@@ -55,13 +60,17 @@ public:
   /** @brief Called when a file descriptor is readable
    * @param e Calling event loop
    * @param fd File descriptor
-   * @param ptr Bytes read from @p fd
+   * @param ptr Bytes read from @p fd, or a null pointer
    * @param n Number of bytes at @p ptr
    *
    * This will be called when bytes are read from @p fd, or when it reaches end
    * of file, if @ref EventLoop::whenReadable was used to attach this reactor
    * to an event loop.
    *
+   * If a sink was supplied to @ref EventLoop::whenReadable then the bytes have
+   * already been written to it, @p ptr is a null pointer and @p n is the number
+   * of bytes transferred.
+   *
    * @p n will be 0 at EOF.  (Currently) the implementation must cancel reads
    * (using @ref EventLoop::cancelRead) even at EOF, or the event loop will
    * just call it again.
@@ -120,6 +129,16 @@ public:
    */
   virtual void onWait(EventLoop *e, pid_t pid, int status,
                       const struct rusage &ru);
+
+  /** @brief Called when work is to be abandoned
+   * @param e Calling event loop
+   *
+   * This will be called by @ref EventLoop::terminateSubprocesses, if @ref
+   * EventLoop::whenTerminated was used to attach this reactor to an event
+   * loop.  It is intended for work done within this process, which cannot be
+   * stopped with a signal.
+   */
+  virtual void onTerminate(EventLoop *e);
 };
 
 /** @brief An event loop supporting asynchronous I/O
@@ -128,13 +147,32 @@ public:
  * together.  All I/O, subprocess and timeout events are reflected in calls to
  * methods of the @ref Reactor class.
  *
- * (Currently) only one event loop object may exist at a time.  This limitation
- * is due to the signal handling strategy.
+ * Where possible, file descriptors are monitored with @c epoll(7), and each
+ * subprocess is monitored via a process file descriptor (see @c
+ * pidfd_open(2)), so that termination is noticed immediately.  Otherwise @c
+ * pselect(2) is used and subprocesses are polled for periodically; in this
+ * case file descriptors must be below @c FD_SETSIZE.
+ *
+ * File descriptors should be cancelled before they are closed.
  */
 class EventLoop: private Reactor {
 public:
-  /** @brief Construct an event loop */
-  EventLoop();
+  /** @brief Mechanisms for waiting for events */
+  enum Backend {
+    /** @brief @c epoll(7) and process file descriptors */
+    Epoll,
+
+    /** @brief @c pselect(2) and polling for subprocesses */
+    Select,
+  };
+
+  /** @brief Construct an event loop
+   * @param backend Preferred mechanism
+   *
+   * If @ref Epoll is requested but not supported by the platform or the
+   * kernel, @ref Select is used instead.
+   */
+  EventLoop(Backend backend = Epoll);
 
   EventLoop(const EventLoop &) = delete;
   EventLoop &operator=(const EventLoop &) = delete;
@@ -145,11 +183,17 @@ public:
   /** @brief Notify reactor when a file descriptor is readable
    * @param fd File descriptor to monitor
    * @param r Reactor to notify
+   * @param sink File descriptor to copy input to, or -1
    *
    * The reactor is notified by calling @ref Reactor::onReadable and @ref
    * Reactor::onReadError.
+   *
+   * If @p sink is not -1 then input is written to it (using @c splice(2) if
+   * possible, so that the data is never copied through user space) rather than
+   * being passed to the reactor.  Errors writing to @p sink are reported as
+   * read errors.
    */
-  void whenReadable(int fd, Reactor *r);
+  void whenReadable(int fd, Reactor *r, int sink = -1);
 
   /** @brief Stop monitoring a file descriptor for readability
    * @param fd File descriptor to stop monitoring
@@ -169,13 +213,24 @@ public:
    */
   void cancelWrite(int fd);
 
+  /** @brief Identifies a timeout */
+  typedef TimerWheel::Id TimeoutId;
+
   /** @brief Notify a reactor at a future time
    * @param t (Monotonic) timestamp to wait for (see @ref getMonotonicTime)
    * @param r Reactor to notify
+   * @return Identifier for use with @ref cancelTimeout
    *
    * The reactor is notified by calling @ref Reactor::onTimeout.
    */
-  void whenTimeout(const struct timespec &t, Reactor *r);
+  TimeoutId whenTimeout(const struct timespec &t, Reactor *r);
+
+  /** @brief Cancel a timeout
+   * @param id Identifier returned by @ref whenTimeout
+   *
+   * It is not an error if the timeout has already happened.
+   */
+  void cancelTimeout(TimeoutId id);
 
   /** @brief Notify a reactor when a subprocess terminates
    * @param pid Subprocess
@@ -193,6 +248,18 @@ public:
    */
   void cancelWait(pid_t pid);
 
+  /** @brief Notify a reactor when work is to be abandoned
+   * @param r Reactor to notify
+   *
+   * The reactor is notified by calling @ref Reactor::onTerminate.
+   */
+  void whenTerminated(Reactor *r);
+
+  /** @brief Stop notifying a reactor when work is to be abandoned
+   * @param r Reactor to stop notifying
+   */
+  void cancelTerminated(Reactor *r);
+
   /** @brief Wait until there is nothing left to wait for
    * @param wait_for_timeouts Whether to wait for timeouts
    *
@@ -202,22 +269,86 @@ public:
    */
   void wait(bool wait_for_timeouts = false);
 
-  /** @brief Send all current subprocesses SIGTERM */
+  /** @brief Send all current subprocesses SIGTERM
+   *
+   * Reactors attached with @ref whenTerminated are also notified.
+   */
   void terminateSubprocesses();
 
+  /** @brief Return the mechanism in use */
+  Backend getBackend() const {
+    return epfd >= 0 ? Epoll : Select;
+  }
+
 private:
+  /** @brief Wait for and dispatch events using @c epoll(7) */
+  void waitEpoll(bool wait_for_timeouts);
+
+  /** @brief Wait for and dispatch events using @c pselect(2) */
+  void waitSelect(bool wait_for_timeouts);
+
+  /** @brief Dispatch the first timeout if it has expired
+   * @param ts Where to store how long to wait for the next timeout
+   * @return @c true if a timeout was dispatched
+   *
+   * If there are no timeouts then @p ts is set to a negative value.
+   */
+  bool checkTimeouts(struct timespec &ts);
+
+  /** @brief Read from a file descriptor and notify its reader
+   * @param fd File descriptor
+   * @param r Reactor to notify
+   */
+  void readAndNotify(int fd, Reactor *r);
+
+  /** @brief Copy input to a sink and notify its reader
+   * @param fd File descriptor
+   * @param sink File descriptor to write to
+   * @param r Reactor to notify
+   */
+  void transfer(int fd, int sink, Reactor *r);
+
+  /** @brief Reap a subprocess if it has terminated and notify its reactor
+   * @param pid Subprocess
+   * @return @c true if the subprocess was reaped
+   */
+  bool reap(pid_t pid);
+
+  /** @brief Bring the epoll registration of a file descriptor up to date
+   * @param fd File descriptor
+   */
+  void updateEpoll(int fd);
+
+  /** @brief epoll file descriptor, or -1 for the select backend */
+  int epfd = -1;
+
+  /** @brief Events registered with @ref epfd, by file descriptor */
+  std::map<int, uint32_t> registered;
+
+  /** @brief Process file descriptors, by subprocess */
+  std::map<pid_t, int> pidfds;
+
+  /** @brief Subprocesses, by process file descriptor */
+  std::map<int, pid_t> pidfdOwners;
+
   /** @brief File descriptors monitored for reading */
   std::map<int, Reactor *> readers;
 
+  /** @brief Where to send input, for readers that have a sink */
+  std::map<int, int> sinks;
+
   /** @brief File descriptors monitored for writing */
   std::map<int, Reactor *> writers;
 
   /** @brief Timeouts */
-  std::multimap<struct timespec, Reactor *> timeouts;
+  TimerWheel timeouts;
 
   /** @brief Subprocesses */
   std::map<pid_t, Reactor *> waiters;
 
+  /** @brief Reactors to notify when work is abandoned */
+  std::set<Reactor *> terminated;
+
   /** @brief Set if reactors change
    *
    * This variable allows the event loop to detect that one of the
@@ -225,7 +356,7 @@ private:
    * EventLoop::waiters has changed, and therefore to stop relying on
    * iterators that refer to them.
    */
-  bool reconf;
+  bool reconf = false;
 };
 
 #endif /* EVENTLOOP_H */
@@ -32,10 +32,10 @@ void FileLock::ensureOpen() {
   if((fd = open(path.c_str(), O_WRONLY | O_CREAT, 0666)) < 0)
     throw IOError("opening " + path, errno);
   int flags;
-  if((flags = fcntl(fd, F_GETFL)) < 0)
-    throw IOError("fcntl F_GETFL " + path, errno);
-  if(fcntl(fd, F_SETFL, flags | FD_CLOEXEC) < 0)
-    throw IOError("fcntl F_SETFL " + path, errno);
+  if((flags = fcntl(fd, F_GETFD)) < 0)
+    throw IOError("fcntl F_GETFD " + path, errno);
+  if(fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0)
+    throw IOError("fcntl F_SETFD " + path, errno);
 }
 
 bool FileLock::acquire(bool wait) {
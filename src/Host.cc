@@ -18,6 +18,8 @@
 #include "Volume.h"
 #include "Host.h"
 #include "Subprocess.h"
+#include "Utils.h"
+#include "SshMultiplex.h"
 #include <cstdio>
 #include <cstdarg>
 #include <ostream>
@@ -57,14 +59,30 @@ std::string Host::sshPrefix() const {
   return s == "localhost" ? "" : s + ":";
 }
 
+std::string Host::rsyncShell() const {
+  if(hostname == "localhost" || !sshMultiplex)
+    return "";
+  std::vector<std::string> args;
+  SshMultiplex::options(this, args);
+  std::string shell = "ssh";
+  for(auto &arg: args)
+    shell += " " + arg;
+  return shell;
+}
+
 bool Host::available() const {
   // localhost is always available
   if(hostname == "localhost")
     return true;
   if(hostCheck.at(0) == "always-up")
     return true;
-  if(hostCheck.at(0) == "ssh")
+  if(hostCheck.at(0) == "ssh") {
+    // Starting the master connection is just as good a test as running a
+    // command.
+    if(sshMultiplex)
+      return SshMultiplex::start(this);
     return invoke(nullptr, "true", (const char *)nullptr) == 0;
+  }
   if(hostCheck.at(0) == "command") {
     std::vector<std::string> args(hostCheck.begin() + 1, hostCheck.end());
     args.push_back(hostname);
@@ -112,6 +130,12 @@ void Host::write(std::ostream &os, int step, bool verbose) const {
   d(os, "# Priority for this host (higher priority = backed up earlier)", step);
   d(os, "#   priority INTEGER", step);
   os << indent(step) << "priority " << priority << '\n';
+  d(os, "", step);
+
+  d(os, "# Maximum concurrent backups of this host; default is no limit", step);
+  d(os, "#   max-concurrency COUNT", step);
+  if(maxConcurrency)
+    os << indent(step) << "max-concurrency " << maxConcurrency << '\n';
 
   for(auto &v: volumes) {
     os << '\n';
@@ -131,6 +155,8 @@ int Host::invoke(std::string *capture, const char *cmd, ...) const {
       snprintf(buffer, sizeof buffer, "%d", sshTimeout);
       args.push_back(std::string("-oConnectTimeout=") + buffer);
     }
+    if(sshMultiplex)
+      SshMultiplex::options(this, args);
     args.push_back(userAndHost());
   }
   args.push_back(cmd);
@@ -150,6 +176,15 @@ int Host::invoke(std::string *capture, const char *cmd, ...) const {
   }
 }
 
+int Host::invokeScript(std::string *capture, const std::string &script) const {
+  if(hostname == "localhost")
+    return invoke(capture, "sh", "-c", script.c_str(), (const char *)nullptr);
+  // ssh passes its arguments to the remote shell as a single string, so the
+  // script must be quoted.
+  return invoke(capture, "sh", "-c", shellQuote(script).c_str(),
+                (const char *)nullptr);
+}
+
 ConfBase *Host::getParent() const {
   return parent;
 }
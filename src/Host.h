@@ -62,6 +62,12 @@ public:
   /** @brief Priority of this host */
   int priority = 0;
 
+  /** @brief Maximum concurrent backups of this host
+   *
+   * 0 means no limit other than those of groups and devices.
+   */
+  int maxConcurrency = 0;
+
   /** @brief Unrecognized volume names found in logs
    *
    * Maps volume names to device names.
@@ -99,6 +105,11 @@ public:
    */
   std::string sshPrefix() const;
 
+  /** @brief Remote shell for @c rsync
+   * @return Value for @c --rsh, or "" to use the default
+   */
+  std::string rsyncShell() const;
+
   /** @brief Test if host available
    * @return true if host is available
    */
@@ -118,6 +129,15 @@ public:
    */
   int invoke(std::string *capture, const char *cmd, ...) const;
 
+  /** @brief Run a shell script on the host and return its exit status
+   * @param capture Where to put capture stdout, or null pointer
+   * @param script Shell script to run
+   * @return Exit status
+   *
+   * The script is run with @c sh(1), whatever the remote user's login shell.
+   */
+  int invokeScript(std::string *capture, const std::string &script) const;
+
   ConfBase *getParent() const override;
 
   std::string what() const override;
@@ -0,0 +1,324 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Json.h"
+#include "Errors.h"
+#include <cstdio>
+#include <cstring>
+
+/** @brief Maximum nesting depth accepted by @ref Json::parse */
+#define JSON_MAX_DEPTH 64
+
+/** @brief Recursive-descent JSON parser */
+class JsonParser {
+public:
+  /** @brief Constructor
+   * @param s_ Text to parse
+   */
+  JsonParser(const std::string &s_): s(s_) {}
+
+  /** @brief Parse the whole text
+   * @param v Where to store value
+   */
+  void parse(Json &v) {
+    value(v, 0);
+    space();
+    if(pos < s.size())
+      fail("unexpected trailing characters");
+  }
+
+private:
+  /** @brief Text being parsed */
+  const std::string &s;
+
+  /** @brief Current position in @ref s */
+  size_t pos = 0;
+
+  /** @brief Report a syntax error at the current position
+   * @param what Description of error
+   */
+  [[noreturn]] void fail(const std::string &what) {
+    char buffer[64];
+    snprintf(buffer, sizeof buffer, " at offset %zu", pos);
+    throw SyntaxError("invalid JSON: " + what + buffer);
+  }
+
+  /** @brief Skip whitespace */
+  void space() {
+    while(pos < s.size()
+          && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n'
+              || s[pos] == '\r'))
+      ++pos;
+  }
+
+  /** @brief Skip whitespace and a required character
+   * @param c Character
+   */
+  void expect(char c) {
+    space();
+    if(pos >= s.size() || s[pos] != c)
+      fail(std::string("expected '") + c + "'");
+    ++pos;
+  }
+
+  /** @brief Skip whitespace and an optional character
+   * @param c Character
+   * @return @c true if @p c was found
+   */
+  bool accept(char c) {
+    space();
+    if(pos < s.size() && s[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  /** @brief Skip a required keyword
+   * @param word Keyword
+   */
+  void keyword(const char *word) {
+    const size_t len = strlen(word);
+    if(s.compare(pos, len, word) != 0)
+      fail("unrecognized value");
+    pos += len;
+  }
+
+  /** @brief Parse a value
+   * @param v Where to store value
+   * @param depth Nesting depth
+   */
+  void value(Json &v, int depth) {
+    if(depth > JSON_MAX_DEPTH)
+      fail("nested too deeply");
+    space();
+    if(pos >= s.size())
+      fail("unexpected end of input");
+    switch(s[pos]) {
+    case '{':
+      ++pos;
+      v.type = Json::Object;
+      if(accept('}'))
+        return;
+      do {
+        std::string name;
+        space();
+        string(name);
+        expect(':');
+        value(v.object[name], depth + 1);
+      } while(accept(','));
+      expect('}');
+      return;
+    case '[':
+      ++pos;
+      v.type = Json::Array;
+      if(accept(']'))
+        return;
+      do {
+        v.array.emplace_back();
+        value(v.array.back(), depth + 1);
+      } while(accept(','));
+      expect(']');
+      return;
+    case '"':
+      v.type = Json::String;
+      string(v.string);
+      return;
+    case 't':
+      keyword("true");
+      v.type = Json::Boolean;
+      v.boolean = true;
+      return;
+    case 'f':
+      keyword("false");
+      v.type = Json::Boolean;
+      v.boolean = false;
+      return;
+    case 'n':
+      keyword("null");
+      v.type = Json::Null;
+      return;
+    default:
+      v.type = Json::Number;
+      number(v.string);
+      return;
+    }
+  }
+
+  /** @brief Skip one or more digits */
+  void digits() {
+    const size_t start = pos;
+    while(pos < s.size() && s[pos] >= '0' && s[pos] <= '9')
+      ++pos;
+    if(pos == start)
+      fail("invalid number");
+  }
+
+  /** @brief Parse a number
+   * @param n Where to store text of number
+   */
+  void number(std::string &n) {
+    const size_t start = pos;
+    if(pos < s.size() && s[pos] == '-')
+      ++pos;
+    // No leading zeros
+    if(pos < s.size() && s[pos] == '0')
+      ++pos;
+    else
+      digits();
+    if(pos < s.size() && s[pos] == '.') {
+      ++pos;
+      digits();
+    }
+    if(pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+      ++pos;
+      if(pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+        ++pos;
+      digits();
+    }
+    n.assign(s, start, pos - start);
+  }
+
+  /** @brief Parse four hex digits
+   * @return Value
+   */
+  unsigned hex4() {
+    unsigned u = 0;
+    for(int i = 0; i < 4; ++i, ++pos) {
+      if(pos >= s.size())
+        fail("unexpected end of input");
+      const char c = s[pos];
+      u <<= 4;
+      if(c >= '0' && c <= '9')
+        u += c - '0';
+      else if(c >= 'a' && c <= 'f')
+        u += c - 'a' + 10;
+      else if(c >= 'A' && c <= 'F')
+        u += c - 'A' + 10;
+      else
+        fail("invalid \\u escape");
+    }
+    return u;
+  }
+
+  /** @brief Append a code point as UTF-8
+   * @param out String to append to
+   * @param u Code point
+   */
+  void utf8(std::string &out, unsigned u) {
+    if(u < 0x80)
+      out += (char)u;
+    else if(u < 0x800) {
+      out += (char)(0xC0 | (u >> 6));
+      out += (char)(0x80 | (u & 0x3F));
+    } else if(u < 0x10000) {
+      out += (char)(0xE0 | (u >> 12));
+      out += (char)(0x80 | ((u >> 6) & 0x3F));
+      out += (char)(0x80 | (u & 0x3F));
+    } else {
+      out += (char)(0xF0 | (u >> 18));
+      out += (char)(0x80 | ((u >> 12) & 0x3F));
+      out += (char)(0x80 | ((u >> 6) & 0x3F));
+      out += (char)(0x80 | (u & 0x3F));
+    }
+  }
+
+  /** @brief Parse a string
+   * @param out Where to store string
+   */
+  void string(std::string &out) {
+    if(pos >= s.size() || s[pos] != '"')
+      fail("expected string");
+    ++pos;
+    out.clear();
+    for(;;) {
+      if(pos >= s.size())
+        fail("unterminated string");
+      const char c = s[pos++];
+      if(c == '"')
+        return;
+      if((unsigned char)c < 0x20)
+        fail("control character in string");
+      if(c != '\\') {
+        out += c;
+        continue;
+      }
+      if(pos >= s.size())
+        fail("unterminated string");
+      switch(s[pos++]) {
+      case '"': out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/': out += '/'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+        unsigned u = hex4();
+        if(u >= 0xD800 && u < 0xDC00) {
+          // High surrogate, which must be followed by a low surrogate
+          if(s.compare(pos, 2, "\\u") != 0)
+            fail("unpaired surrogate");
+          pos += 2;
+          const unsigned low = hex4();
+          if(low < 0xDC00 || low >= 0xE000)
+            fail("unpaired surrogate");
+          u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+        } else if(u >= 0xDC00 && u < 0xE000)
+          fail("unpaired surrogate");
+        utf8(out, u);
+        break;
+      }
+      default: fail("invalid escape");
+      }
+    }
+  }
+};
+
+const Json *Json::find(const std::string &name) const {
+  if(type != Object)
+    return nullptr;
+  auto it = object.find(name);
+  return it != object.end() ? &it->second : nullptr;
+}
+
+Json Json::parse(const std::string &s) {
+  Json v;
+  JsonParser(s).parse(v);
+  return v;
+}
+
+std::string Json::quote(const std::string &s) {
+  std::string q = "\"";
+  for(char c: s) {
+    switch(c) {
+    case '"': q += "\\\""; break;
+    case '\\': q += "\\\\"; break;
+    case '\n': q += "\\n"; break;
+    case '\r': q += "\\r"; break;
+    case '\t': q += "\\t"; break;
+    default:
+      if((unsigned char)c < 0x20) {
+        char buffer[8];
+        snprintf(buffer, sizeof buffer, "\\u%04x", (unsigned char)c);
+        q += buffer;
+      } else
+        q += c;
+    }
+  }
+  q += '"';
+  return q;
+}
@@ -0,0 +1,92 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef JSON_H
+#define JSON_H
+/** @file Json.h
+ * @brief Minimal JSON support
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+/** @brief A JSON value
+ *
+ * This is just enough JSON to talk to external programs.  Numbers are kept
+ * as their original text, so that integers of any size survive intact.
+ */
+struct Json {
+  /** @brief Possible types of value */
+  enum Type {
+    /** @brief @c null */
+    Null,
+
+    /** @brief @c true or @c false */
+    Boolean,
+
+    /** @brief A number */
+    Number,
+
+    /** @brief A string */
+    String,
+
+    /** @brief An array */
+    Array,
+
+    /** @brief An object */
+    Object,
+  };
+
+  /** @brief Type of this value */
+  Type type = Null;
+
+  /** @brief Value of a @ref Boolean */
+  bool boolean = false;
+
+  /** @brief Value of a @ref String, or text of a @ref Number */
+  std::string string;
+
+  /** @brief Elements of an @ref Array */
+  std::vector<Json> array;
+
+  /** @brief Members of an @ref Object */
+  std::map<std::string, Json> object;
+
+  /** @brief Find a member of an object
+   * @param name Member name
+   * @return Pointer to member, or a null pointer
+   *
+   * Returns a null pointer if this value is not an object.
+   */
+  const Json *find(const std::string &name) const;
+
+  /** @brief Parse a JSON value
+   * @param s JSON text
+   * @return Value
+   * @throws SyntaxError if @p s is not valid JSON
+   *
+   * Whitespace is allowed before and after the value, but nothing else.
+   */
+  static Json parse(const std::string &s);
+
+  /** @brief Quote a string for JSON
+   * @param s UTF-8 string
+   * @return JSON string, including the quotes
+   */
+  static std::string quote(const std::string &s);
+};
+
+#endif /* JSON_H */
@@ -0,0 +1,84 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "LogCodec.h"
+#include "Errors.h"
+#include <zlib.h>
+
+/** @brief Raise an error from zlib
+ * @param what Operation that failed
+ * @param s Stream state
+ * @param rc Error code
+ * @throws Error
+ */
+[[noreturn]] static void zlibError(const char *what, const z_stream &s,
+                                   int rc) {
+  throw Error(std::string(what) + ": "
+              + (s.msg ? s.msg : "error " + std::to_string(rc)));
+}
+
+std::string encodeLog(const std::string &log, int &codec, bool best) {
+  codec = LOG_CODEC_RAW;
+  if(log.size() < LOG_COMPRESS_MIN)
+    return log;
+  z_stream s = {};
+  int rc = deflateInit(&s, best ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION);
+  if(rc != Z_OK)
+    zlibError("deflateInit", s, rc);
+  std::string data(deflateBound(&s, log.size()), 0);
+  s.next_in = (Bytef *)log.data();
+  s.avail_in = log.size();
+  s.next_out = (Bytef *)&data[0];
+  s.avail_out = data.size();
+  // The output buffer is big enough for a single call
+  rc = deflate(&s, Z_FINISH);
+  deflateEnd(&s);
+  if(rc != Z_STREAM_END)
+    zlibError("deflate", s, rc);
+  data.resize(s.total_out);
+  if(data.size() >= log.size())
+    return log;
+  codec = LOG_CODEC_ZLIB;
+  return data;
+}
+
+std::string decodeLog(const std::string &data, int codec) {
+  switch(codec) {
+  case LOG_CODEC_RAW: return data;
+  case LOG_CODEC_ZLIB: break;
+  default: throw Error("unknown log codec " + std::to_string(codec));
+  }
+  z_stream s = {};
+  int rc = inflateInit(&s);
+  if(rc != Z_OK)
+    zlibError("inflateInit", s, rc);
+  std::string log;
+  char buffer[65536];
+  s.next_in = (Bytef *)data.data();
+  s.avail_in = data.size();
+  do {
+    s.next_out = (Bytef *)buffer;
+    s.avail_out = sizeof buffer;
+    rc = inflate(&s, Z_NO_FLUSH);
+    if(rc != Z_OK && rc != Z_STREAM_END) {
+      inflateEnd(&s);
+      // Truncated input shows up as no progress being possible
+      zlibError("inflate", s, rc == Z_BUF_ERROR ? Z_DATA_ERROR : rc);
+    }
+    log.append(buffer, sizeof buffer - s.avail_out);
+  } while(rc != Z_STREAM_END);
+  inflateEnd(&s);
+  return log;
+}
@@ -0,0 +1,63 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef LOGCODEC_H
+#define LOGCODEC_H
+/** @file LogCodec.h
+ * @brief Compression of backup logs
+ */
+
+#include <string>
+
+/** @brief Log stored as-is
+ *
+ * This is also the meaning of a null codec, i.e. rows that predate
+ * compression.
+ */
+#define LOG_CODEC_RAW 0
+
+/** @brief Log compressed with zlib */
+#define LOG_CODEC_ZLIB 1
+
+/** @brief Smallest log worth compressing
+ *
+ * Smaller logs (e.g. pruning reasons) are stored as-is; there's little to
+ * gain and it keeps them readable with the @c sqlite3 command.
+ */
+#define LOG_COMPRESS_MIN 512
+
+/** @brief Encode a log for storage
+ * @param log Log contents
+ * @param codec Set to the codec used
+ * @param best Use the best (and slowest) compression
+ * @return Encoded log
+ *
+ * If the log is too small, or doesn't compress, it is returned unchanged and
+ * @p codec is set to @ref LOG_CODEC_RAW.
+ *
+ * Logs written during backups and pruning use the default compression
+ * level; @c --compact-logs uses @p best.
+ */
+std::string encodeLog(const std::string &log, int &codec, bool best = false);
+
+/** @brief Decode a stored log
+ * @param data Encoded log
+ * @param codec Codec used to encode @p data
+ * @return Log contents
+ * @throws Error if @p codec is unknown or @p data is corrupt
+ */
+std::string decodeLog(const std::string &data, int codec);
+
+#endif /* LOGCODEC_H */
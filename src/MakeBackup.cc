@@ -25,6 +25,9 @@
 #include <sysexits.h>
 #include <thread>
 #include <condition_variable>
+#include <limits>
+#include <list>
+#include <set>
 #include "rsbackup.h"
 #include "Conf.h"
 #include "Device.h"
@@ -38,13 +41,17 @@
 #include "Errors.h"
 #include "Utils.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 #include "BulkRemove.h"
-
-static std::condition_variable cond;
+#include "BackupPolicy.h"
+#include "SshMultiplex.h"
 
 /** @brief rsync exit status indicating a file vanished during backup */
 const int RERR_VANISHED = 24;
 
+/** @brief Size of reads from a spool file */
+#define SPOOL_READ_BUFFER 65536
+
 /** @brief State of pre-volume-hook execution */
 enum PRE_VOLUME_HOOK_STATE {
   /** @brief Haven't run pre-volume-hook yet */
@@ -117,21 +124,65 @@ public:
   /** @brief Current work */
   const char *what = "pending";
 
+  /** @brief Spool file for @c rsync output */
+  const std::string spoolPath;
+
+  /** @brief File descriptor for @ref spoolPath, or -1 */
+  int spoolFD = -1;
+
   /** @brief Log output */
   std::string log;
 
+  /** @brief Resource usage of @c rsync */
+  struct rusage rsyncUsage = {};
+
   /** @brief Constructor */
   MakeBackup(Volume *volume_, const Device *device_);
 
-  /** @brief Find backups to link against. */
-  void getOldBackups(std::vector<const Backup *> &oldBackups) const;
+  /** @brief Find backups to link against.
+   * @param oldBackups Where to put backups, newest first
+   * @param depth Number of recent backups to consider
+   *
+   * The @p depth most recent usable backups on the target device are
+   * selected.  The most recent complete backup is always included, even if it
+   * is older than that.
+   */
+  void getOldBackups(std::vector<const Backup *> &oldBackups,
+                     int depth) const;
+
+  /** @brief Estimate the space saved by extra link targets
+   * @param extra Link targets that would not have been used with a depth of 1
+   * @param baseline Link targets that would have been used with a depth of 1
+   * @return Estimated number of bytes saved
+   *
+   * A file counts as saved if it is hard-linked to a file in one of @p extra
+   * and no file in @p baseline has the same size and modification time, i.e.
+   * it would have been copied without the extra link targets.
+   */
+  uintmax_t linkDestSavings(const std::vector<const Backup *> &extra,
+                            const std::vector<const Backup *> &baseline) const;
 
   /** @brief Set up logfile IO for a subprocess
    * @param sp Subprocess
    * @param outputToo Log stdout as well as just stderr
+   *
+   * Output is written to @ref spoolPath rather than accumulated in memory
+   * while the subprocess runs.  It must be collected with @ref collectSpool.
    */
   void subprocessIO(Subprocess &sp, bool outputToo = true);
 
+  /** @brief Append the contents of the spool file to the log
+   *
+   * The spool file is removed afterwards.  Does nothing if there is no spool
+   * file.
+   *
+   * The whole log is still held in memory, since it is parsed for rsync's
+   * statistics and stored in the database as a single value.  So spooling
+   * doesn't reduce peak memory use; it only avoids growing the log from many
+   * small appends while rsync runs.
+   */
+  void collectSpool();
+
   /** @brief Run rsync to make the backup
    * @return Wait status
    */
@@ -160,26 +211,79 @@ MakeBackup::MakeBackup(Volume *volume_, const Device *device_):
                                + PATH_SEP + volume->name),
     backupPath(volumePath + PATH_SEP + id),
     incompletePath(backupPath + ".incomplete"),
-    noLinkPath(volumePath + ".nolink") {}
+    noLinkPath(volumePath + ".nolink"),
+    spoolPath(globalConfig.logs + PATH_SEP + id + "-" + device->name + "-"
+              + host->name + "-" + volume->name + ".spool") {}
 
 // Find backups to link to.
-void MakeBackup::getOldBackups(std::vector<const Backup *> &oldBackups) const {
+void MakeBackup::getOldBackups(std::vector<const Backup *> &oldBackups,
+                               int depth) const {
+  bool haveComplete = false;
   // Start with the most recent backup and work back
   for(const Backup *backup: boost::adaptors::reverse(volume->backups)) {
     // Consider only backups on the right device
-    if(device->name == backup->deviceName) {
-      if(backup->getStatus() == COMPLETE) {
-        // Always link against the most recent complete backup
+    if(device->name != backup->deviceName)
+      continue;
+    // Backups that are being pruned may vanish at any moment
+    if(backup->getStatus() == PRUNING)
+      continue;
+    bool complete = backup->getStatus() == COMPLETE;
+    if(oldBackups.size() < static_cast<size_t>(depth)) {
+      // Link against the most recent backups, whether complete or not
+      oldBackups.push_back(backup);
+      haveComplete |= complete;
+    } else if(complete && !haveComplete) {
+      // Always link against the most recent complete backup, even if it's
+      // further back.  Stay within rsync's limit.
+      if(oldBackups.size() >= MAX_LINK_DEST)
+        oldBackups.back() = backup;
+      else
         oldBackups.push_back(backup);
-        // Once we have a complete backup, stop searching.
+      haveComplete = true;
+    }
+    // Once we have enough backups including a complete one, stop searching.
+    if(oldBackups.size() >= static_cast<size_t>(depth) && haveComplete)
+      break;
+  }
+}
+
+uintmax_t MakeBackup::linkDestSavings(
+    const std::vector<const Backup *> &extra,
+    const std::vector<const Backup *> &baseline) const {
+  uintmax_t saved = 0;
+  struct stat sb, lb;
+  for(boost::filesystem::recursive_directory_iterator it(backupPath), end;
+      it != end; ++it) {
+    const std::string path = it->path().string();
+    if(lstat(path.c_str(), &sb) < 0)
+      throw SystemError("lstat " + path, errno);
+    // Only regular files that have been linked to something
+    if(!S_ISREG(sb.st_mode) || sb.st_nlink < 2)
+      continue;
+    const std::string relative = path.substr(backupPath.size());
+    bool linked = false;
+    for(const Backup *backup: extra) {
+      if(lstat((backup->backupPath() + relative).c_str(), &lb) == 0
+         && lb.st_dev == sb.st_dev && lb.st_ino == sb.st_ino) {
+        linked = true;
+        break;
+      }
+    }
+    if(!linked)
+      continue;
+    // See if the file would have been linked anyway
+    for(const Backup *backup: baseline) {
+      if(lstat((backup->backupPath() + relative).c_str(), &lb) == 0
+         && S_ISREG(lb.st_mode) && lb.st_size == sb.st_size
+         && lb.st_mtime == sb.st_mtime) {
+        linked = false;
         break;
-      } else {
-        // If the most recent backup is incomplete, link against that.
-        if(oldBackups.size() == 0)
-          oldBackups.push_back(backup);
       }
     }
+    if(linked)
+      saved += sb.st_size;
   }
+  return saved;
 }
 
 /** @brief Set up the common environment for a subprocess
@@ -198,7 +302,36 @@ void setEnvironment(const Volume *volume, Subprocess &sp) {
 }
 
 void MakeBackup::subprocessIO(Subprocess &sp, bool outputToo) {
-  sp.capture(2, &log, outputToo ? 1 : -1);
+  spoolFD = open(spoolPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0600);
+  if(spoolFD < 0)
+    throw IOError("opening " + spoolPath, errno);
+  sp.captureFile(2, spoolFD, outputToo ? 1 : -1);
+}
+
+void MakeBackup::collectSpool() {
+  if(spoolFD < 0)
+    return;
+  close(spoolFD);
+  spoolFD = -1;
+  // Append the output straight onto the log in large reads, without a second
+  // copy of it
+  int fd = open(spoolPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    throw IOError("opening " + spoolPath, errno);
+  struct stat sb;
+  if(fstat(fd, &sb) == 0)
+    log.reserve(log.size() + sb.st_size);
+  std::vector<char> buffer(SPOOL_READ_BUFFER);
+  ssize_t n;
+  while((n = read(fd, buffer.data(), buffer.size())) > 0)
+    log.append(buffer.data(), n);
+  const int errno_value = errno;
+  close(fd);
+  if(n < 0)
+    throw IOError("reading " + spoolPath, errno_value);
+  if(remove(spoolPath.c_str()) < 0)
+    throw SystemError("removing " + spoolPath, errno);
 }
 
 /** @brief Action performed before each backup
@@ -254,7 +387,13 @@ int MakeBackup::rsyncBackup(const std::string &sourcePath) {
     // Synthesize command
     what = "constructing command";
     std::vector<std::string> cmd;
+    std::vector<const Backup *> baselineBackups, extraBackups;
     cmd.push_back(host->rsyncCommand);
+    // Use the shared SSH connection.  This comes first so that it can be
+    // overridden by configured options.
+    std::string rsh = host->rsyncShell();
+    if(rsh.size())
+      cmd.push_back("--rsh=" + rsh);
     cmd.insert(cmd.end(), volume->rsyncBaseOptions.begin(),
                volume->rsyncBaseOptions.end());
     cmd.insert(cmd.end(), volume->rsyncExtraOptions.begin(),
@@ -278,7 +417,7 @@ int MakeBackup::rsyncBackup(const std::string &sourcePath) {
       if(stat(noLinkPath.c_str(), &sb) == 0)
         suppressLinkDest = true;
       std::vector<const Backup *> oldBackups;
-      getOldBackups(oldBackups);
+      getOldBackups(oldBackups, volume->linkDestDepth);
       if(oldBackups.size() > 0 && suppressLinkDest) {
         warning(WARNING_ALWAYS,
                 "suppressing %zu --link-dest candidates due because %s exists",
@@ -287,6 +426,14 @@ int MakeBackup::rsyncBackup(const std::string &sourcePath) {
         for(auto oldBackup: oldBackups) {
           cmd.push_back("--link-dest=" + oldBackup->backupPath());
         }
+        // Identify the candidates that a depth of 1 would not have offered,
+        // so that their benefit can be measured.
+        getOldBackups(baselineBackups, 1);
+        for(auto oldBackup: oldBackups)
+          if(std::find(baselineBackups.begin(), baselineBackups.end(),
+                       oldBackup)
+             == baselineBackups.end())
+            extraBackups.push_back(oldBackup);
       }
     }
     // Timeout
@@ -316,7 +463,9 @@ int MakeBackup::rsyncBackup(const std::string &sourcePath) {
       release_guard<std::mutex> globalRelease(globalLock);
       al.go();
     }
+    collectSpool();
     rc = sp.getStatus();
+    rsyncUsage = sp.getResourceUsage();
     what = "rsync";
     // Suppress exit status 24 "Partial transfer due to vanished source files"
     if(WIFEXITED(rc) && WEXITSTATUS(rc) == RERR_VANISHED) {
@@ -332,8 +481,42 @@ int MakeBackup::rsyncBackup(const std::string &sourcePath) {
       if(remove(noLinkPath.c_str()) < 0 && errno != ENOENT) {
         throw SystemError("removing " + noLinkPath, errno);
       }
+      // Record what the extra link targets bought us.  This means walking
+      // the whole of the new backup, so only do it when asked to.
+      if(extraBackups.size() > 0 && (globalWarningMask & WARNING_VERBOSE)) {
+        try {
+          uintmax_t saved;
+          {
+            release_guard<std::mutex> globalRelease(globalLock);
+            saved = linkDestSavings(extraBackups, baselineBackups);
+          }
+          char buffer[128];
+          snprintf(buffer, sizeof buffer,
+                   "link-dest-depth %d saved %ju bytes",
+                   volume->linkDestDepth, saved);
+          log += buffer;
+          log += "\n";
+          warning(WARNING_VERBOSE, "backup of %s:%s to %s: %s",
+                  host->name.c_str(), volume->name.c_str(),
+                  device->name.c_str(), buffer);
+        } catch(std::runtime_error &e) {
+          // The backup is fine, we just don't know how much was saved
+          warning(WARNING_ALWAYS,
+                  "backup of %s:%s to %s: measuring link-dest savings: %s",
+                  host->name.c_str(), volume->name.c_str(),
+                  device->name.c_str(), e.what());
+        }
+      }
     }
   } catch(std::runtime_error &e) {
+    // Keep whatever rsync managed to say before the error
+    try {
+      collectSpool();
+    } catch(std::runtime_error &spoolError) {
+      log += "ERROR: ";
+      log += spoolError.what();
+      log += "\n";
+    }
     // Try to handle any other errors the same way as rsync failures.  If we
     // can't even write to the logfile we error out.
     log += "ERROR: ";
@@ -357,9 +540,10 @@ void MakeBackup::performBackup(const std::string &sourcePath) {
   if(globalCommand.act) {
     // Record in the database that the backup is underway
     // If this fails then the backup just fails.
-    globalConfig.getdb().begin();
-    outcome->insert(globalConfig.getdb(), true /*replace*/);
-    globalConfig.getdb().commit();
+    DatabaseWriter &writer = globalConfig.getWriter();
+    release_guard<std::mutex> globalRelease(globalLock);
+    writer.execute(
+        [outcome](Database &db) { outcome->insert(db, true /*replace*/); });
   }
   // Make the backup
   int rc = rsyncBackup(sourcePath);
@@ -370,7 +554,11 @@ void MakeBackup::performBackup(const std::string &sourcePath) {
   }
   // Update the backup record
   outcome->waitStatus = rc;
-  outcome->contents = log;
+  if(log.size() && log[log.size() - 1] != '\n')
+    log += '\n';
+  outcome->setContents(log);
+  outcome->stats.parse(log);
+  outcome->setResourceUsage(rsyncUsage);
   outcome->finishTime = Date::now("FINISH");
   // Enforce explicit time setings in tests
   if(Date::override_time("BACKUP") && !Date::override_time("FINISH"))
@@ -384,9 +572,6 @@ void MakeBackup::performBackup(const std::string &sourcePath) {
     if(Date::override_time("FINISH"))
       throw Error("time traveling clock override");
   }
-  if(outcome->contents.size()
-     && outcome->contents[outcome->contents.size() - 1] != '\n')
-    outcome->contents += '\n';
   //
   if(outcome->waitStatus) {
     // Backup failed
@@ -395,7 +580,7 @@ void MakeBackup::performBackup(const std::string &sourcePath) {
       warning(WARNING_VERBOSE | WARNING_ERRORLOGS, "backup of %s:%s to %s: %s",
               host->name.c_str(), volume->name.c_str(), device->name.c_str(),
               SubprocessFailed::format(what, outcome->waitStatus).c_str());
-      IO::err.write(outcome->contents);
+      IO::err.write(outcome->getContents());
       IO::err.writef("\n");
     }
     outcome->setStatus(FAILED);
@@ -403,27 +588,13 @@ void MakeBackup::performBackup(const std::string &sourcePath) {
     outcome->setStatus(COMPLETE);
   // Attach the backup to the volume
   outcome->volume->addBackup(outcome);
-  // Store the result in the database
-  // We really care about 'busy' errors - the backup has been made, we must
-  // record this fact.
-  for(;;) {
-    int retries = 0;
-    try {
-      globalConfig.getdb().begin();
-      outcome->update(globalConfig.getdb());
-      globalConfig.getdb().commit();
-      break;
-    } catch(DatabaseBusy &) {
-      // Log a message every second or so
-      if(!(retries++ & 1023))
-        warning(WARNING_DATABASE,
-                "backup of %s:%s to %s: retrying database update",
-                host->name.c_str(), volume->name.c_str(), device->name.c_str());
-      // Wait a millisecond and try again
-      usleep(1000);
-      continue;
-    }
-  }
+  // Store the result in the database.  The writer keeps trying if the
+  // database is busy; the backup has been made, we must record this fact.
+  // The update is made from a copy, since the volume may discard the
+  // original before the writer gets to it.
+  globalConfig.getWriter().submit(
+      [record = *outcome](Database &db) { record.update(db); });
+  outcome->contentsStored();
 }
 
 // Run the pre-volume-hook for VOLUME, if it hasn't been run already.
@@ -556,9 +727,22 @@ static void maybeBackupVolumeToDevice(Volume *volume, const Device *device,
   switch(br) {
   case BackupRequired:
     globalConfig.identifyDevices(Store::Enabled);
-    if(device->store && device->store->state == Store::Enabled)
+    if(device->store && device->store->state == Store::Enabled) {
+      // Don't start a backup that will probably run out of space
+      std::string why;
+      try {
+        if(device->store->overLimit(why)) {
+          error("cannot backup %s:%s to %s - device has %s", host->name.c_str(),
+                volume->name.c_str(), device->name.c_str(), why.c_str());
+          break;
+        }
+      } catch(IOError &e) {
+        error("cannot backup %s:%s to %s - %s", host->name.c_str(),
+              volume->name.c_str(), device->name.c_str(), e.what());
+        break;
+      }
       backupVolumeToDevice(volume, device, pvh);
-    else if(globalWarningMask & WARNING_STORE) {
+    } else if(globalWarningMask & WARNING_STORE) {
       globalConfig.identifyDevices(Store::Disabled);
       if(device->store)
         switch(device->store->state) {
@@ -601,69 +785,397 @@ static void maybeBackupVolumeToDevice(Volume *volume, const Device *device,
   }
 }
 
-// Backup VOLUME on all devices.
-static void
-backupVolumeToAllDevices(Volume *volume,
-                         std::map<std::string, ConcurrencyLimit> *concurrencyGroups) {
-  std::unique_lock<std::mutex> globalGuard(globalLock);
-  // Build a list of devices
-  std::set<Device *> devices;
-  for(auto &d: globalConfig.devices) {
-    devices.insert(d.second);
+// Estimate how long a backup of VOLUME to DEVICE will take, or 0 if it
+// looks like no backup will be needed.
+//
+// This is only a cheap approximation to Volume::needsBackup(); in particular
+// it doesn't check whether the volume is available.
+static time_t estimateBackup(const Volume *volume, const Device *device) {
+  if(fnmatch(volume->devicePattern.c_str(), device->name.c_str(),
+             FNM_NOESCAPE)
+     == FNM_NOMATCH)
+    return 0;
+  const BackupPolicy *policy = BackupPolicy::find(volume->backupPolicy);
+  if(!policy->backup(volume, device))
+    return 0;
+  return volume->estimateDuration(device);
+}
+
+/** @brief A volume waiting to be backed up, as seen by @ref BackupScheduler */
+struct BackupJob {
+  /** @brief Constructor
+   * @param volume_ Volume to back up
+   */
+  BackupJob(Volume *volume_): volume(volume_) {
+    std::map<const Device *, time_t> estimates;
+    for(auto &d: globalConfig.devices) {
+      Device *device = d.second;
+      devices.push_back(device);
+      estimates[device] = estimateBackup(volume, device);
+      estimate += estimates[device];
+    }
+    // Longest backup first
+    std::stable_sort(devices.begin(), devices.end(),
+                     [&estimates](const Device *a, const Device *b) {
+                       return estimates[a] > estimates[b];
+                     });
+    getMonotonicTime(queued);
+  }
+
+  /** @brief Test whether one remaining device is preferred to another
+   * @param a Device
+   * @param b Device
+   * @return @c true if @p a comes before @p b in @ref devices
+   */
+  bool prefer(const Device *a, const Device *b) const {
+    return std::find(devices.begin(), devices.end(), a)
+           < std::find(devices.begin(), devices.end(), b);
   }
+
+  /** @brief Volume to back up */
+  Volume *volume;
+
+  /** @brief Devices not yet considered for this volume
+   *
+   * These are in descending order of estimated backup duration.
+   */
+  std::vector<Device *> devices;
+
+  /** @brief Estimated total duration of backups of this volume */
+  time_t estimate = 0;
+
+  /** @brief Pre-volume-hook state */
   PRE_VOLUME_HOOK_STATE pvh = PVH_NOT_RUN;
-  while(devices.size() > 0 && pvh != PVH_FAILED) {
-    bool worked = false;
-    {
-      if((*concurrencyGroups)[volume->group].usable()) {
-        // Look for a device we can lock
-        for(auto device: devices) {
-          if(device->concurrency.usable()) {
-            TakeConcurrencyLimit dcl(device->concurrency), vcl((*concurrencyGroups)[volume->group]);
-            maybeBackupVolumeToDevice(volume, device, pvh);
-            devices.erase(device);
-            worked = true;
-            cond.notify_all();
-            break;
-          }
-        }
-      }
+
+  /** @brief When the job last became ready to run */
+  struct timespec queued;
+};
+
+// Order jobs by priority, then longest first, then by name
+static bool order_job(const BackupJob *a, const BackupJob *b) {
+  const Host *ha = a->volume->parent, *hb = b->volume->parent;
+  if(ha->priority != hb->priority)
+    return ha->priority > hb->priority;
+  if(a->estimate != b->estimate)
+    return a->estimate > b->estimate;
+  if(ha->name != hb->name)
+    return ha->name < hb->name;
+  return a->volume->name < b->volume->name;
+}
+
+/** @brief Comparison functor wrapping @ref order_job */
+struct JobOrder {
+  /** @brief Compare two jobs
+   * @param a Job
+   * @param b Job
+   * @return @c true if @p a should run before @p b
+   */
+  bool operator()(const BackupJob *a, const BackupJob *b) const {
+    return order_job(a, b);
+  }
+};
+
+/** @brief Fixed-size pool of worker threads for backups
+ *
+ * Each selected volume is a @ref BackupJob.  Once its host is known to be
+ * reachable, the job waits in one ready queue for each (concurrency group,
+ * device) pair it still needs.  An idle worker only looks at the queues
+ * whose group and device both have spare capacity, and takes the best job
+ * from the front of them.  The cost of a dispatch therefore depends on the
+ * number of groups and devices, not the number of volumes.
+ *
+ * The queues are in host priority order, and within each priority the jobs
+ * expected to take longest come first, based on their recent history.  This
+ * is the "longest processing time" rule, and keeps a single long backup from
+ * starting last and stretching the whole run.  When a worker
+ * releases a limit it wakes a single idle worker, rather than every waiting
+ * thread.
+ *
+ * Host reachability is checked by a worker once the host is the most
+ * important thing left to do, so unreachable hosts don't stall everything
+ * else.
+ *
+ * All state is protected by @ref globalLock.
+ */
+class BackupScheduler {
+public:
+  /** @brief Constructor
+   * @param hosts Hosts to back up, in priority order
+   */
+  BackupScheduler(const std::vector<Host *> &hosts);
+
+  BackupScheduler(const BackupScheduler &) = delete;
+  BackupScheduler &operator=(const BackupScheduler &) = delete;
+
+  /** @brief Destructor */
+  ~BackupScheduler();
+
+  /** @brief Run all the jobs to completion
+   *
+   * The global lock must be held on entry.  It is released while the
+   * workers run.
+   */
+  void run();
+
+private:
+  /** @brief Identifies a ready queue by concurrency group and device */
+  typedef std::pair<std::string, Device *> ReadyKey;
+
+  /** @brief Worker thread body */
+  void worker();
+
+  /** @brief Find something to do
+   * @param job Set to the job to work on
+   * @param device Set to the device to use, or a null pointer if the job's
+   * host must be checked first
+   * @return @c true if work was found, @c false otherwise
+   */
+  bool dispatch(BackupJob *&job, Device *&device);
+
+  /** @brief Check whether a host is reachable
+   * @param host Host to check
+   *
+   * If it's reachable, its jobs are made ready.  Otherwise they are
+   * discarded.
+   */
+  void checkHost(Host *host);
+
+  /** @brief Run one (volume, device) backup
+   * @param job Job to work on
+   * @param device Device to back up to
+   */
+  void runJob(BackupJob *job, Device *device);
+
+  /** @brief Add a job to the ready queues for its remaining devices
+   * @param job Job to add
+   *
+   * If it has no remaining devices, it is finished instead.
+   */
+  void enqueue(BackupJob *job);
+
+  /** @brief Complete a job
+   * @param job Job that will not be run again
+   */
+  void finished(BackupJob *job);
+
+  /** @brief Ready queues, best job first */
+  std::map<ReadyKey, std::set<BackupJob *, JobOrder>> ready;
+
+  /** @brief Hosts not yet checked for reachability, in priority order */
+  std::list<Host *> unchecked;
+
+  /** @brief Jobs held back until their host has been checked */
+  std::map<const Host *, std::vector<BackupJob *>> held;
+
+  /** @brief All jobs */
+  std::vector<BackupJob *> all;
+
+  /** @brief Concurrency limits for each group */
+  std::map<std::string, ConcurrencyLimit> groups;
+
+  /** @brief Concurrency limits for each host */
+  std::map<const Host *, ConcurrencyLimit> hostLimits;
+
+  /** @brief Signaled when capacity is released or the last job finishes */
+  std::condition_variable cond;
+
+  /** @brief Number of jobs not yet finished */
+  size_t outstanding = 0;
+
+  /** @brief Number of jobs waiting to run */
+  size_t waiting = 0;
+
+  /** @brief Largest number of jobs seen waiting to run */
+  size_t maxDepth = 0;
+
+  /** @brief Number of backups dispatched */
+  size_t dispatched = 0;
+
+  /** @brief Total time jobs spent waiting in the queue */
+  double totalWait = 0;
+
+  /** @brief Longest time a job spent waiting in the queue */
+  double maxWait = 0;
+};
+
+BackupScheduler::BackupScheduler(const std::vector<Host *> &hosts) {
+  for(auto host: hosts) {
+    hostLimits[host] = host->maxConcurrency
+                           ? host->maxConcurrency
+                           : std::numeric_limits<int>::max();
+    std::vector<BackupJob *> jobs;
+    for(auto &v: host->volumes) {
+      Volume *volume = v.second;
+      auto it = globalConfig.groupConcurrency.find(volume->group);
+      groups[volume->group] =
+          it != globalConfig.groupConcurrency.end() ? it->second : 1;
+      if(volume->selected(PurposeBackup))
+        jobs.push_back(new BackupJob(volume));
     }
-    // If we didn't find a suitable volume wait a bit and try again
-    if(!worked) {
+    if(jobs.size()) {
+      unchecked.push_back(host);
+      all.insert(all.end(), jobs.begin(), jobs.end());
+      held[host] = std::move(jobs);
+    }
+  }
+  outstanding = waiting = maxDepth = all.size();
+}
+
+BackupScheduler::~BackupScheduler() {
+  deleteAll(all);
+}
+
+void BackupScheduler::run() {
+  // Don't create more threads than there could ever be work for
+  size_t nthreads = std::min(all.size(), (size_t)globalConfig.backupThreads);
+  std::vector<std::thread *> threads;
+  for(size_t n = 0; n < nthreads; ++n)
+    threads.push_back(new std::thread(&BackupScheduler::worker, this));
+  {
+    // Release the global lock while we wait for the threads
+    release_guard<std::mutex> globalRelease(globalLock);
+    for(auto t: threads)
+      t->join();
+  }
+  for(auto t: threads)
+    delete t;
+  if(globalWarningMask & WARNING_VERBOSE)
+    IO::out.writef("INFO: %zu backups dispatched from %zu volumes by %zu "
+                   "workers; max queue depth %zu; wait mean %.1fs max %.1fs\n",
+                   dispatched, all.size(), nthreads, maxDepth,
+                   dispatched ? totalWait / dispatched : 0.0, maxWait);
+}
+
+void BackupScheduler::worker() {
+  std::unique_lock<std::mutex> globalGuard(globalLock);
+  for(;;) {
+    BackupJob *job;
+    Device *device;
+    while(!dispatch(job, device)) {
+      // Nothing left at all
+      if(outstanding == 0)
+        return;
       cond.wait(globalGuard);
     }
+    // There may be further spare capacity, so pass the wakeup on
+    cond.notify_one();
+    if(device)
+      runJob(job, device);
+    else
+      checkHost(job->volume->parent);
+  }
+}
+
+bool BackupScheduler::dispatch(BackupJob *&job, Device *&device) {
+  BackupJob *best = nullptr;
+  Device *bestDevice = nullptr;
+  for(auto it = ready.begin(); it != ready.end();) {
+    if(it->second.empty()) {
+      it = ready.erase(it);
+      continue;
+    }
+    Device *d = it->first.second;
+    if(d->concurrency.usable() && groups[it->first.first].usable()) {
+      // The first job here whose host has capacity is this queue's best
+      for(auto j: it->second) {
+        if(!hostLimits[j->volume->parent].usable())
+          continue;
+        if(!best || order_job(j, best)
+           || (j == best && j->prefer(d, bestDevice))) {
+          best = j;
+          bestDevice = d;
+        }
+        break;
+      }
+    }
+    ++it;
+  }
+  // Check the next host first if it's at least as important
+  if(unchecked.size()
+     && (!best
+         || unchecked.front()->priority >= best->volume->parent->priority)) {
+    job = held[unchecked.front()].front();
+    device = nullptr;
+    unchecked.pop_front();
+    return true;
   }
-  runPostVolumeHook(volume, pvh);
+  if(!best)
+    return false;
+  for(auto d: best->devices)
+    ready[ReadyKey(best->volume->group, d)].erase(best);
+  --waiting;
+  job = best;
+  device = bestDevice;
+  D("dispatch %s:%s to %s, estimate %lds, queue depth %zu",
+    job->volume->parent->name.c_str(), job->volume->name.c_str(),
+    device->name.c_str(), (long)job->estimate, waiting);
+  return true;
 }
 
-// Backup HOST on all devices
-static void backupHost(Host *host,
-                       std::map<std::string, ConcurrencyLimit> *concurrencyGroups) {
-  // Do a quick check for unavailable hosts
-  bool available = host->available();
-  // Serialize reporting
+void BackupScheduler::checkHost(Host *host) {
+  bool available;
   {
-    std::lock_guard<std::mutex> globalGuard(globalLock);
-    if(!available) {
-      warning(WARNING_UNREACHABLE, "cannot backup %s - not reachable",
-              host->name.c_str());
-      return;
+    // Do a quick check for unavailable hosts
+    release_guard<std::mutex> globalRelease(globalLock);
+    available = host->available();
+  }
+  std::vector<BackupJob *> jobs = std::move(held[host]);
+  held.erase(host);
+  if(available) {
+    for(auto job: jobs) {
+      --waiting;
+      enqueue(job);
     }
+  } else {
+    warning(WARNING_UNREACHABLE, "cannot backup %s - not reachable",
+            host->name.c_str());
+    waiting -= jobs.size();
+    outstanding -= jobs.size();
+    if(outstanding == 0)
+      cond.notify_all();
   }
-  // Run each volume backup in its own thread
-  std::vector<std::thread *> threads;
-  for(auto &v: host->volumes) {
-    Volume *volume = v.second;
-    if(volume->selected(PurposeBackup))
-      threads.push_back(
-          new std::thread(backupVolumeToAllDevices, volume, concurrencyGroups));
+}
+
+void BackupScheduler::runJob(BackupJob *job, Device *device) {
+  struct timespec now;
+  getMonotonicTime(now);
+  struct timespec waited = now - job->queued;
+  double w = waited.tv_sec + waited.tv_nsec / 1000000000.0;
+  totalWait += w;
+  maxWait = std::max(maxWait, w);
+  ++dispatched;
+  {
+    TakeConcurrencyLimit dcl(device->concurrency),
+        gcl(groups[job->volume->group]), hcl(hostLimits[job->volume->parent]);
+    maybeBackupVolumeToDevice(job->volume, device, job->pvh);
   }
-  // Wait for all the volume threads
-  for(auto t: threads)
-    t->join();
-  for(auto t: threads)
-    delete t;
+  job->devices.erase(
+      std::find(job->devices.begin(), job->devices.end(), device));
+  if(job->pvh == PVH_FAILED)
+    finished(job);
+  else {
+    getMonotonicTime(job->queued);
+    enqueue(job);
+  }
+  // Wake up one idle worker to use the capacity just released
+  cond.notify_one();
+}
+
+void BackupScheduler::enqueue(BackupJob *job) {
+  if(job->devices.size() == 0) {
+    finished(job);
+    return;
+  }
+  for(auto d: job->devices)
+    ready[ReadyKey(job->volume->group, d)].insert(job);
+  maxDepth = std::max(maxDepth, ++waiting);
+}
+
+void BackupScheduler::finished(BackupJob *job) {
+  runPostVolumeHook(job->volume, job->pvh);
+  // If everything is done then all the workers can exit
+  if(--outstanding == 0)
+    cond.notify_all();
 }
 
 static bool order_host(const Host *a, const Host *b) {
@@ -686,29 +1198,9 @@ void makeBackups() {
       hosts.push_back(host);
   }
   std::sort(hosts.begin(), hosts.end(), order_host);
-  // Create concurrency group locks
-  std::map<std::string, ConcurrencyLimit> concurrencyGroups;
-  for(auto host: hosts) {
-    for(auto &it: host->volumes) {
-      const Volume *volume = it.second;
-      concurrencyGroups[volume->group] = 1;
-    }
-  }
-  // Initiate backups in threads
-  std::map<std::string, std::thread *> threads;
-  for(auto host: hosts) {
-    threads[host->name] = new std::thread(backupHost, host, &concurrencyGroups);
-  }
-  {
-    // Release the global lock while we wait for the threads
-    release_guard<std::mutex> globalRelease(globalLock);
-    // Wait for the threads
-    for(auto it: threads) {
-      it.second->join();
-    }
-  }
-  // Clean up the locks and threads
-  for(auto it: threads) {
-    delete it.second;
-  }
+  // Close shared SSH connections on the way out, however we leave
+  SshMultiplex::Session session;
+  // Run the backups
+  BackupScheduler scheduler(hosts);
+  scheduler.run();
 }
@@ -25,6 +25,7 @@
 #include "Utils.h"
 #include "Store.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 #include "Prune.h"
 #include "PrunePolicy.h"
 #include "BulkRemove.h"
@@ -32,159 +33,31 @@
 #include <regex>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <cerrno>
+#include <csignal>
 #include <unistd.h>
 
-#include <boost/core/noncopyable.hpp>
-
-class RemovableBackup;
-
-/** @brief Action class to clean up after a backup has been removed */
-class RemovedBackup: public Action {
-public:
-  /** @brief Constructor */
-  RemovedBackup(const std::string &name, RemovableBackup *rb):
-      Action(name), parent(rb) {}
-
-  /** @brief Initiate cleanup */
-  void go(EventLoop *e, ActionList *al) override;
-
-private:
-  /** @brief Owning @ref RemovableBackup
-   *
-   * This forces @ref RemovableBackup to be noncopyable.
-   */
-  RemovableBackup *parent = nullptr;
-};
-
-/** @brief A removable backup */
-class RemovableBackup: boost::noncopyable {
-public:
-  /** @brief Constructor
-   * @param b Backup to remove
-   */
-  RemovableBackup(Backup *b):
-      backup(b),
-      bulkRemover("remove/" + b->volume->parent->name + "/" + b->volume->name
-                  + "/" + b->deviceName + "/" + b->id),
-      removedBackup("removed/" + b->volume->parent->name + "/" + b->volume->name
-                        + "/" + b->deviceName + "/" + b->id,
-                    this) {
-    // Cleanup happens after removal (unconditionally)
-    removedBackup.after(bulkRemover.get_name(), 0);
-  }
-
-  /** @brief Initialize the child objects */
-  void initialize(ActionList &al) {
-    bulkRemover.initialize(backup->backupPath());
-    bulkRemover.uses(backup->deviceName);
-    removedBackup.uses(backup->deviceName);
-    al.add(&bulkRemover);
-    al.add(&removedBackup);
-  }
-
-  /** @brief Called when a removal has completed (not necessarily successfully)
-   * @param timedOut Indicates the whole pruning job timed out
-   */
-  void completed(bool timedOut) {
-    // Only run once
-    if(alreadyComplete)
-      return;
-    alreadyComplete = true;
-    // Log what happened and (on success) remove .incomplete
-    const std::string backupPath = backup->backupPath();
-    int status = bulkRemover.getStatus();
-    switch(status) {
-    default: // Log failed prunes
-      // If we timed out then a SIGTERM is expected, so hide that behind
-      // WARNING_VERBOSE. Any other failure is an error.
-      if(timedOut && WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM)
-        warning(WARNING_VERBOSE, "failed to remove %s: %s", backupPath.c_str(),
-                SubprocessFailed::format(globalConfig.rm, status).c_str());
-      else
-        error("failed to remove %s: %s", backupPath.c_str(),
-              SubprocessFailed::format(globalConfig.rm, status).c_str());
-      break;
-    case -1: // Never ran
-      // This happens if we timed out or errored before getting to
-      // this backup.
-      warning(WARNING_VERBOSE, "failed to remove %s: cancelled",
-              backupPath.c_str());
-      break;
-    case 0: // Succeeded
-      const std::string incompletePath = backupPath + ".incomplete";
-      // Remove the 'incomplete' marker.
-      if(globalWarningMask & WARNING_VERBOSE)
-        IO::out.writef("INFO: removing %s\n", incompletePath.c_str());
-      if(unlink(incompletePath.c_str()) < 0 && errno != ENOENT) {
-        error("removing %s: %s", incompletePath.c_str(), strerror(errno));
-        ++globalErrors;
-      }
-    }
-    if(status == 0) {
-      backup->setStatus(PRUNED);
-      // When the state is PRUNING, the pruned date indicates
-      // when it was decided to prune the backup; when the state
-      // is PRUNED, it indicates when pruning completed.
-      backup->pruned = Date::now("PRUNE");
-      backup->update(globalConfig.getdb());
-      // Update the database
-      for(;;) {
-        int retries = 0;
-        try {
-          globalConfig.getdb().begin();
-          globalConfig.getdb().commit();
-        } catch(DatabaseBusy &) {
-          // Keep trying, database should be in sync with reality
-          // Log a message every second or so
-          if(!(retries++ & 1023))
-            warning(WARNING_DATABASE, "pruning: retrying database update");
-          // Wait a millisecond and try again
-          usleep(1000);
-          continue;
-        }
-        break; // success
-      }
-      // Update internal state
-      if(status == 0)
-        backup->volume->removeBackup(backup);
-    }
-  }
-
-  /** @brief The backup to remove */
-  Backup *backup = nullptr;
-
-  /** @brief The bulk remove instance for this backup */
-  BulkRemove bulkRemover;
-
-  /** @brief The cleanup instance for this backup */
-  RemovedBackup removedBackup;
-
-  /** @brief Completion status */
-  bool alreadyComplete = false;
-};
-
-void RemovedBackup::go(EventLoop *, ActionList *al) {
-  // Hand everything off to the parent RemovableBackup
-  parent->completed(false);
-  // Report back that we finished immediately
-  al->completed(this, true);
-}
-
 static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups);
 static void markObsoleteBackups(std::vector<Backup *> obsoleteBackups);
-static void
-findRemovableBackups(std::vector<Backup *> obsoleteBackups,
-                     std::vector<RemovableBackup *> &removableBackups);
+static size_t trashBackups(std::vector<Backup *> obsoleteBackups);
+static void moveToTrash(const Store *store, const Backup *backup);
+static std::vector<Device *> availableDevices();
+static bool trashPending();
+static bool reclaim(const std::vector<Device *> &devices,
+                    const struct timespec *deadline);
+static void pruneForSpace(const struct timespec *deadline);
+static Backup *oldestSpareBackup(const Device *device);
 
 void backupPrunable(std::vector<Backup *> &onDevice,
-                    std::map<Backup *, std::string> &prune, int total) {
+                    std::map<Backup *, std::string> &prune, int total,
+                    const Date &today) {
   if(onDevice.size() == 0)
     return;
   const Volume *volume = onDevice.at(0)->volume;
   const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
-  policy->prunable(onDevice, prune, total);
+  policy->prunable(onDevice, prune, total, today);
 }
 
 PrunePolicy::policies_type *PrunePolicy::policies;
@@ -198,10 +71,21 @@ void pruneBackups() {
   // due for removal.  This includes devices which aren't currently available.
   std::vector<Backup *> obsoleteBackups;
   findObsoleteBackups(obsoleteBackups);
-
-  // Return straight away if there's nothing to do
-  if(obsoleteBackups.size() == 0)
+  PrunePolicy::finishAll();
+
+  // If usage is limited then devices must be checked even if nothing is
+  // obsolete
+  const bool limited = globalCommand.prune
+                       && (globalConfig.maxUsage < 100
+                           || globalConfig.maxFileUsage < 100);
+
+  // If there's nothing to prune, just finish off anything left in the trash
+  // by an earlier run.  With --reclaim that happens later anyway.
+  if(obsoleteBackups.size() == 0 && !limited) {
+    if(!globalCommand.reclaim && trashPending())
+      reclaimTrash();
     return;
+  }
 
   // We set all obsolete backups to PRUNING state even if they're on currently
   // unavailable devices.  Note that this means that pruning policies are
@@ -212,43 +96,210 @@ void pruneBackups() {
   // Identify devices
   globalConfig.identifyDevices(Store::Enabled);
 
-  // A _removable_ backup is an obsolete backup which is on an available device
-  // and can therefore actually be removed.
-  std::vector<RemovableBackup *> removableBackups;
-  findRemovableBackups(obsoleteBackups, removableBackups);
-
-  if(!globalCommand.act)
-    assert(removableBackups.size() == 0);
+  // Give up if it takes too long
+  struct timespec limit, *deadline = nullptr;
+  if(globalConfig.pruneTimeout > 0) {
+    getMonotonicTime(limit);
+    limit.tv_sec += globalConfig.pruneTimeout;
+    deadline = &limit;
+  }
 
-  EventLoop e;
-  ActionList al(&e);
+  // Move the obsolete backups on available devices into the trash.  From
+  // this point on they are pruned, as far as the rest of rsbackup is
+  // concerned.
+  trashBackups(obsoleteBackups);
 
-  // Initialize the bulk remove operations
-  for(auto &removable: removableBackups) {
-    removable->initialize(al);
+  // Free up the space they used, along with anything left over from
+  // previous runs.  With --reclaim this happens later anyway, unless it's
+  // needed now to see how full the devices are.
+  if(limited || !globalCommand.reclaim) {
+    if(!reclaim(availableDevices(), deadline))
+      return;
   }
 
-  // Give up if it takes too long
+  // Prune more from any devices that are still too full
+  if(limited)
+    pruneForSpace(deadline);
+}
+
+// Remove everything in the trash directories of available devices
+void reclaimTrash() {
+  globalConfig.identifyDevices(Store::Enabled);
+  struct timespec limit, *deadline = nullptr;
   if(globalConfig.pruneTimeout > 0) {
-    struct timespec limit;
     getMonotonicTime(limit);
     limit.tv_sec += globalConfig.pruneTimeout;
+    deadline = &limit;
+  }
+  reclaim(availableDevices(), deadline);
+}
+
+// Return the devices whose stores are available
+static std::vector<Device *> availableDevices() {
+  std::vector<Device *> devices;
+  for(auto &d: globalConfig.devices) {
+    Device *device = d.second;
+    if(device->store && device->store->state == Store::Enabled)
+      devices.push_back(device);
+  }
+  return devices;
+}
+
+// Return true if any store has something in its trash directory.  Devices
+// aren't identified first, to avoid running device hooks when there's
+// nothing to do, so the trash of a store that isn't mounted looks empty.
+static bool trashPending() {
+  for(auto &s: globalConfig.stores) {
+    const std::string trash = s.second->path + PATH_SEP + TRASH_DIRECTORY;
+    Directory dir;
+    try {
+      dir.open(trash);
+    } catch(IOError &) {
+      continue;
+    }
+    std::string name;
+    while(dir.get(name))
+      if(name != "." && name != "..")
+        return true;
+  }
+  return false;
+}
+
+// Remove everything in the trash directories of some devices.  Returns false
+// if the deadline (if there is one) passed first.
+static bool reclaim(const std::vector<Device *> &devices,
+                    const struct timespec *deadline) {
+  EventLoop e;
+  ActionList al(&e);
+  std::vector<BulkRemove *> removals;
+  std::vector<std::string> paths;
+  for(Device *device: devices) {
+    Store *store = device->store;
+    // Limit concurrent removals from each device
+    al.setCapacity(device->name, device->removalConcurrency);
+    const std::string trash = store->path + PATH_SEP + TRASH_DIRECTORY;
+    Directory dir;
+    try {
+      dir.open(trash);
+    } catch(IOError &e) {
+      if(e.errno_value == ENOENT)
+        continue;
+      throw;
+    }
+    std::string name;
+    while(dir.get(name)) {
+      if(name == "." || name == "..")
+        continue;
+      const std::string path = trash + PATH_SEP + name;
+      if(globalWarningMask & WARNING_VERBOSE)
+        IO::out.writef("INFO: reclaiming %s\n", path.c_str());
+      if(!globalCommand.act)
+        continue;
+      BulkRemove *b = new BulkRemove("reclaim/" + device->name + "/" + name,
+                                     path);
+      b->uses(device->name);
+      al.add(b);
+      removals.push_back(b);
+      paths.push_back(path);
+    }
+  }
+
+  // Anything left when the deadline passes will be removed next time
+  if(deadline) {
+    struct timespec limit = *deadline;
     al.setLimit(limit);
   }
 
   // Perform the deletions
   al.go();
 
-  if(globalCommand.act) {
-    // If we timed out then complete any uncompleted removal attempts
-    if(al.timeLimitExceeded()) {
-      for(auto &removable: removableBackups) {
-        removable->completed(true);
+  // Report what happened
+  for(size_t n = 0; n < removals.size(); ++n) {
+    const int status = removals[n]->getStatus();
+    switch(status) {
+    case 0: // Succeeded
+      break;
+    case -1: // Never ran, because we timed out first
+      warning(WARNING_VERBOSE, "failed to reclaim %s: cancelled",
+              paths[n].c_str());
+      break;
+    default:
+      // If we timed out then a SIGTERM is expected, so hide that behind
+      // WARNING_VERBOSE. Any other failure is an error.
+      if(al.timeLimitExceeded() && WIFSIGNALED(status)
+         && WTERMSIG(status) == SIGTERM)
+        warning(WARNING_VERBOSE, "failed to reclaim %s: %s", paths[n].c_str(),
+                SubprocessFailed::format(globalConfig.rm, status).c_str());
+      else
+        error("failed to reclaim %s: %s", paths[n].c_str(),
+              SubprocessFailed::format(globalConfig.rm, status).c_str());
+    }
+  }
+
+  deleteAll(removals);
+  return !al.timeLimitExceeded();
+}
+
+// Prune the oldest backups from devices that are fuller than max-usage or
+// max-file-usage allow, until they are not.  Since backups share files, the
+// only way to know how much space pruning a backup frees is to prune it and
+// look.
+static void pruneForSpace(const struct timespec *deadline) {
+  for(Device *device: availableDevices()) {
+    std::string why;
+    while(device->store->overLimit(why)) {
+      Backup *backup = oldestSpareBackup(device);
+      if(!backup) {
+        warning(WARNING_ALWAYS, "device %s has %s but nothing more can be pruned",
+                device->name.c_str(), why.c_str());
+        break;
       }
+      backup->setContents(device->name + " " + why);
+      // Record the decision before acting on it
+      if(globalCommand.act)
+        markObsoleteBackups({backup});
+      // Without acting, there's no way to tell what else would go
+      if(!trashBackups({backup}) || !globalCommand.act)
+        break;
+      if(!reclaim({device}, deadline))
+        return;
     }
   }
+}
 
-  deleteAll(removableBackups);
+// Find the oldest complete backup on a device that could be pruned to free
+// space, or return a null pointer if there is none.
+static Backup *oldestSpareBackup(const Device *device) {
+  Backup *oldest = nullptr;
+  for(auto &h: globalConfig.hosts) {
+    const Host *host = h.second;
+    if(!host->selected(PurposePrune))
+      continue;
+    for(auto &v: host->volumes) {
+      Volume *volume = v.second;
+      if(!volume->selected(PurposePrune))
+        continue;
+      // Backups are ordered oldest first
+      Backup *first = nullptr;
+      int count = 0;
+      for(Backup *backup: volume->backups) {
+        if(backup->deviceName == device->name
+           && backup->getStatus() == COMPLETE) {
+          if(!first)
+            first = backup;
+          ++count;
+        }
+      }
+      // The policy determines how many must be kept, and the last complete
+      // backup is always kept
+      const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
+      if(count <= std::max(policy->minimumBackups(volume), 1))
+        continue;
+      if(!oldest || first->time < oldest->time)
+        oldest = first;
+    }
+  }
+  return oldest;
 }
 
 // Get a list of all the backups to prune. This means backups for
@@ -256,6 +307,8 @@ void pruneBackups() {
 // pruning policy for their volume. It includes backups that are
 // on unavailable devices.
 static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
+  // Every decision is made relative to the same day
+  const Date today = Date::today("PRUNE");
   for(auto &h: globalConfig.hosts) {
     const Host *host = h.second;
     if(!host->selected(PurposePrune))
@@ -276,8 +329,8 @@ static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
           if(globalCommand.pruneIncomplete) {
             // Prune incomplete backups.  Anything that failed is counted as
             // incomplete (a succesful retry will overwrite the log entry).
-            backup->contents = std::string("status=")
-                               + backup_status_names[backup->getStatus()];
+            backup->setContents(std::string("status=")
+                                + backup_status_names[backup->getStatus()]);
             obsoleteBackups.push_back(backup);
           }
           break;
@@ -299,10 +352,10 @@ static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
       for(auto &od: onDevices) {
         std::vector<Backup *> &onDevice = od.second;
         std::map<Backup *, std::string> prune;
-        backupPrunable(onDevice, prune, total);
+        backupPrunable(onDevice, prune, total, today);
         for(auto &p: prune) {
           Backup *backup = p.first;
-          backup->contents = p.second;
+          backup->setContents(p.second);
           obsoleteBackups.push_back(backup);
           --total;
         }
@@ -313,65 +366,111 @@ static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
 
 // Update the database to mark all obsolete backups for pruning.
 static void markObsoleteBackups(std::vector<Backup *> obsoleteBackups) {
-  globalConfig.getdb().begin();
+  std::vector<Backup *> changed;
   for(Backup *b: obsoleteBackups) {
     if(b->getStatus() != PRUNING) {
       b->setStatus(PRUNING);
       b->pruned = Date::now("PRUNE");
-      b->update(globalConfig.getdb());
+      changed.push_back(b);
     }
   }
-  globalConfig.getdb().commit();
-  // We don't catch DatabaseBusy here; the prune just fails.
+  // All the updates are made in a single transaction, and we wait for it so
+  // that nothing is removed before it is recorded as being pruned.  If it
+  // fails then the prune just fails.
+  globalConfig.getWriter().execute([&changed](Database &db) {
+    for(Backup *b: changed)
+      b->update(db);
+  });
+  for(Backup *b: changed)
+    b->contentsStored();
 }
 
-// Winnow down the obsolete backups to those we can actually remove,
-// i.e. those on an available device. We also create .incomplete
-// files here, to signal to the operator that these backups are
-// not suitable for restoration.
-static void
-findRemovableBackups(std::vector<Backup *> obsoleteBackups,
-                     std::vector<RemovableBackup *> &removableBackups) {
+// Move obsolete backups on available devices into the trash, and record
+// them as pruned.  Returns the number moved.
+static size_t trashBackups(std::vector<Backup *> obsoleteBackups) {
+  // Each backup is recorded as pruned as soon as it has gone from its volume
+  // directory.  It's already recorded as being pruned, so if the update is
+  // lost, it's found to be already pruned next time.
+  DatabaseWriter::Batch batch(globalConfig.getWriter());
+  size_t trashed = 0;
   for(auto backup: obsoleteBackups) {
     Device *device = globalConfig.findDevice(backup->deviceName);
     Store *store = device->store;
     // Can't delete backups from unavailable stores
     if(!store || store->state != Store::Enabled)
       continue;
-    std::string backupPath = backup->backupPath();
-    std::string incompletePath = backupPath + ".incomplete";
+    const std::string backupPath = backup->backupPath();
+    if(globalWarningMask & WARNING_VERBOSE)
+      IO::out.writef("INFO: pruning %s because: %s\n", backupPath.c_str(),
+                     backup->getContents().c_str());
+    if(!globalCommand.act)
+      continue;
     try {
-      // Schedule removal of the backup
-      if(globalWarningMask & WARNING_VERBOSE)
-        IO::out.writef("INFO: pruning %s because: %s\n", backupPath.c_str(),
-                       backup->contents.c_str());
-      if(globalCommand.act) {
-        // Create the .incomplete flag file so that the operator knows this
-        // backup is now partial
-        IO ifile;
-        ifile.open(incompletePath, "w");
-        ifile.close();
-        // Queue up a bulk remove operation
-        removableBackups.push_back(new RemovableBackup(backup));
-      }
+      moveToTrash(store, backup);
     } catch(std::runtime_error &exception) {
       // Log anything that goes wrong
-      error("failed to remove %s: %s\n", backupPath.c_str(), exception.what());
-      ++globalErrors;
+      error("failed to remove %s: %s", backupPath.c_str(), exception.what());
+      continue;
+    }
+    // When the state is PRUNING, the pruned date indicates when it was
+    // decided to prune the backup; when the state is PRUNED, it indicates
+    // when pruning completed.
+    backup->setStatus(PRUNED);
+    backup->pruned = Date::now("PRUNE");
+    batch.add([record = *backup](Database &db) { record.update(db); });
+    // Update internal state
+    backup->volume->removeBackup(backup);
+    ++trashed;
+  }
+  batch.flush();
+  globalConfig.getWriter().sync();
+  return trashed;
+}
+
+// Rename a backup into the trash directory of its store.  Backups that have
+// already gone are ignored.  If the backup is on a different filesystem from
+// the trash (e.g. because the host directory is a separate mount), it is
+// removed in place instead.
+static void moveToTrash(const Store *store, const Backup *backup) {
+  const std::string trash = store->path + PATH_SEP + TRASH_DIRECTORY;
+  if(mkdir(trash.c_str(), 0700) < 0 && errno != EEXIST)
+    throw IOError("creating " + trash, errno);
+  const std::string backupPath = backup->backupPath();
+  // Host and volume names cannot contain '+', so this only clashes with the
+  // remains of an earlier backup with the same ID.
+  const std::string base = trash + PATH_SEP + backup->volume->parent->name
+                           + "+" + backup->volume->name + "+" + backup->id;
+  std::string trashPath = base;
+  for(int n = 1; rename(backupPath.c_str(), trashPath.c_str()) < 0; ++n) {
+    if(errno == ENOENT)
+      break;
+    if(errno == EXDEV) {
+      BulkRemove remove("prune/" + backupPath, backupPath);
+      remove.runAndWait();
+      break;
     }
+    if(errno != EEXIST && errno != ENOTEMPTY)
+      throw IOError("renaming " + backupPath + " to " + trashPath, errno);
+    trashPath = base + "+" + std::to_string(n);
   }
+  // The operator no longer needs to be told the backup is partial
+  const std::string incompletePath = backupPath + ".incomplete";
+  if(unlink(incompletePath.c_str()) < 0 && errno != ENOENT)
+    throw IOError("removing " + incompletePath, errno);
 }
 
 // Remove old prune logfiles
 void prunePruneLogs() {
-  if(globalCommand.act)
+  if(globalCommand.act) {
     // Delete status=PRUNED records that are too old
-    Database::Statement(
-        globalConfig.getdb(),
-        "DELETE FROM backup"
-        " WHERE status=?"
-        " AND pruned < ?",
-        SQL_INT, PRUNED, SQL_INT64,
-        (int64_t)(Date::now("PRUNE") - globalConfig.keepPruneLogs), SQL_END)
-        .next();
+    const int64_t cutoff = Date::now("PRUNE") - globalConfig.keepPruneLogs;
+    globalConfig.getWriter().submit([cutoff](Database &db) {
+      Database::Statement(db,
+                          "DELETE FROM backup"
+                          " WHERE status=?"
+                          " AND pruned < ?",
+                          SQL_INT, PRUNED, SQL_INT64, cutoff, SQL_END)
+          .next();
+    });
+  }
 }
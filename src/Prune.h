@@ -25,14 +25,17 @@
 #include <string>
 
 class Backup;
+class Date;
 
 /** @brief Identify prunable backups
  * @param onDevice Number of backups of same volume on same device
  * @param prune Map of backups to prune to reason strings
  * @param total Number of backups anywhere
+ * @param today Today's date
  */
 void backupPrunable(std::vector<Backup *> &onDevice,
-                    std::map<Backup *, std::string> &prune, int total);
+                    std::map<Backup *, std::string> &prune, int total,
+                    const Date &today);
 
 /** @brief Identify the bucket for a backup
  * @param w Decay window
@@ -45,6 +45,12 @@ const PolicyParameter PrunePolicy::get(const Volume *volume,
     return def;
 }
 
+int PrunePolicy::minimumBackups(const Volume *) const {
+  return 1;
+}
+
+void PrunePolicy::finish() const {}
+
 const PrunePolicy *PrunePolicy::find(const std::string &name) {
   assert(policies != nullptr); // policies not statically initialized
   auto it = policies->find(name);
@@ -53,7 +59,18 @@ const PrunePolicy *PrunePolicy::find(const std::string &name) {
   return it->second;
 }
 
-void validatePrunePolicy(const Volume *volume) {
+const PruneParameters &PrunePolicy::parameters(const Volume *volume) {
+  assert(volume->prunePolicyParameters); // policy not validated
+  return *volume->prunePolicyParameters;
+}
+
+void PrunePolicy::finishAll() {
+  assert(policies != nullptr); // policies not statically initialized
+  for(auto &p: *policies)
+    p.second->finish();
+}
+
+void validatePrunePolicy(Volume *volume) {
   const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
-  policy->validate(volume);
+  volume->prunePolicyParameters.reset(policy->compile(volume));
 }
@@ -25,9 +25,21 @@
 #include <string>
 
 class Backup;
+class Date;
 class Volume;
 class PolicyParameter;
 
+/** @brief Pruning parameters of one volume, ready for use
+ *
+ * Each policy that has parameters derives its own class from this, and
+ * creates an instance for each volume in @ref PrunePolicy::compile.
+ */
+class PruneParameters {
+public:
+  /** @brief Destructor */
+  virtual ~PruneParameters() = default;
+};
+
 /** @brief Base class for pruning policies
  */
 class PrunePolicy {
@@ -38,10 +50,15 @@ public:
    */
   PrunePolicy(const std::string &name);
 
-  /** @brief Validate a pruning policy
+  /** @brief Validate and convert the pruning parameters of a volume
    * @param volume Volume to validate
+   * @return Converted parameters
+   * @throws ConfigError if the parameters are not valid
+   *
+   * This happens once for each volume, when the configuration is validated.
+   * The result is saved as @ref Volume::prunePolicyParameters.
    */
-  virtual void validate(const Volume *volume) const = 0;
+  virtual PruneParameters *compile(const Volume *volume) const = 0;
 
   /** @brief Get a parameter value
    * @param volume Volume to validate
@@ -62,13 +79,30 @@ public:
    * @param onDevice Surviving backups of same volume on same device
    * @param total Number of backups anywhere
    * @param prune Map of backups to prune to reason strings
+   * @param today Today's date
    *
    * @p total does not include backups on other devices that have "only just"
    * been selected for pruning.
    */
   virtual void prunable(std::vector<Backup *> &onDevice,
-                        std::map<Backup *, std::string> &prune,
-                        int total) const = 0;
+                        std::map<Backup *, std::string> &prune, int total,
+                        const Date &today) const = 0;
+
+  /** @brief Number of backups to keep when pruning to free space
+   * @param volume Volume
+   * @return Minimum number of backups of @p volume to keep on each device
+   *
+   * When a device is fuller than @c max-usage or @c max-file-usage allow, the
+   * oldest backups on it are pruned, regardless of @ref prunable, down to this
+   * number for each volume.  The default is 1.
+   */
+  virtual int minimumBackups(const Volume *volume) const;
+
+  /** @brief Called when no more pruning decisions are needed
+   *
+   * The default does nothing.
+   */
+  virtual void finish() const;
 
   /** @brief Find a prune policy by name
    * @param name Name of policy
@@ -76,6 +110,16 @@ public:
    */
   static const PrunePolicy *find(const std::string &name);
 
+  /** @brief Call @ref finish for all policies */
+  static void finishAll();
+
+protected:
+  /** @brief Get the converted pruning parameters of a volume
+   * @param volume Volume
+   * @return Parameters returned by @ref compile for @p volume
+   */
+  static const PruneParameters &parameters(const Volume *volume);
+
 private:
   /** @brief Type for @ref policies */
   typedef std::map<std::string, const PrunePolicy *> policies_type;
@@ -84,9 +128,11 @@ private:
   static policies_type *policies;
 };
 
-/** @brief Validate a pruning policy
+/** @brief Validate the pruning policy for a volume
  * @param volume Volume to validate
+ *
+ * Sets @ref Volume::prunePolicyParameters.
  */
-void validatePrunePolicy(const Volume *volume);
+void validatePrunePolicy(Volume *volume);
 
 #endif // PRUNEPOLICY_H
@@ -22,37 +22,55 @@
 #include "Errors.h"
 #include <sstream>
 
+/** @brief Parameters for the @c age pruning policy */
+struct AgeParameters: public PruneParameters {
+  /** @brief Age after which backups may be pruned, in days */
+  int pruneAge;
+
+  /** @brief Minimum number of backups to keep on each device */
+  int minBackups;
+};
+
 /** @brief The @c age pruning policy */
 class PruneAge: public PrunePolicy {
 public:
   PruneAge(): PrunePolicy("age") {}
 
-  void validate(const Volume *volume) const override {
+  PruneParameters *compile(const Volume *volume) const override {
     const PolicyParameter pruneAge =
         get(volume, "prune-age", DEFAULT_PRUNE_AGE);
     const PolicyParameter minBackups =
         get(volume, "min-backups", DEFAULT_MIN_BACKUPS);
-    if(parseTimeInterval(pruneAge.value) < 86400)
-      throw ConfigError(pruneAge.location, "prune-age is too small");
+    AgeParameters p;
+    try {
+      const long long age = parseTimeInterval(pruneAge.value);
+      if(age < 86400)
+        throw SyntaxError("prune-age is too small");
+      p.pruneAge = age / 86400;
+    } catch(SyntaxError &e) {
+      throw ConfigError(pruneAge.location, e.what());
+    }
     try {
-      parseInteger(minBackups.value, 1, std::numeric_limits<int>::max());
+      p.minBackups =
+          parseInteger(minBackups.value, 1, std::numeric_limits<int>::max());
     } catch(SyntaxError &e) {
       throw ConfigError(minBackups.location, e.what());
     }
+    return new AgeParameters(p);
+  }
+
+  int minimumBackups(const Volume *volume) const override {
+    return ageParameters(volume).minBackups;
   }
 
   void prunable(std::vector<Backup *> &onDevice,
-                std::map<Backup *, std::string> &prune, int) const override {
-    const Volume *volume = onDevice.at(0)->volume;
-    int pruneAge =
-        parseTimeInterval(get(volume, "prune-age", DEFAULT_PRUNE_AGE).value)
-        / 86400;
-    int minBackups =
-        parseInteger(get(volume, "min-backups", DEFAULT_MIN_BACKUPS).value, 1,
-                     std::numeric_limits<int>::max());
+                std::map<Backup *, std::string> &prune, int,
+                const Date &today) const override {
+    const AgeParameters &p = ageParameters(onDevice.at(0)->volume);
+    const int pruneAge = p.pruneAge, minBackups = p.minBackups;
     size_t left = onDevice.size();
     for(Backup *backup: onDevice) {
-      int age = Date::today("PRUNE") - Date(backup->time);
+      int age = today - Date(backup->time);
       // Keep backups that are young enough
       if(age <= pruneAge)
         continue;
@@ -66,4 +84,13 @@ public:
       --left;
     }
   }
+
+private:
+  /** @brief Get the converted parameters of a volume
+   * @param volume Volume
+   * @return Parameters
+   */
+  static const AgeParameters &ageParameters(const Volume *volume) {
+    return static_cast<const AgeParameters &>(parameters(volume));
+  }
 } prune_age;
@@ -27,82 +27,96 @@ int prune_decay_bucket(double w, double s, int a) {
   return ceil(logbase((s - 1) * a / w + 1, s)) - 1;
 }
 
+/** @brief Parameters for the @c decay pruning policy */
+struct DecayParameters: public PruneParameters {
+  /** @brief Age after which backups may be pruned, in days */
+  int decayStart;
+
+  /** @brief Size of the first window, in days */
+  int decayWindow;
+
+  /** @brief Ratio of successive window sizes */
+  double decayScale;
+
+  /** @brief Age after which backups are always pruned, in days */
+  int decayLimit;
+};
+
+/** @brief Parse a decay interval parameter
+ * @param parameter Parameter
+ * @param what Parameter name
+ * @return Interval in days
+ */
+static int decayDays(const PolicyParameter &parameter, const char *what) {
+  try {
+    const long long n = parseTimeInterval(parameter.value);
+    if(n < 1)
+      throw SyntaxError(std::string(what) + " too small");
+    return n / 86400;
+  } catch(SyntaxError &e) {
+    throw ConfigError(parameter.location, e.what());
+  }
+}
+
 /** @brief The @c decay pruning policy */
 class PruneDecay: public PrunePolicy {
 public:
   PruneDecay(): PrunePolicy("decay") {}
 
-  void validate(const Volume *volume) const override {
-    PolicyParameter decayStart =
-        get(volume, "decay-start", DEFAULT_DECAY_START);
-    PolicyParameter decayWindow =
-        get(volume, "decay-window", DEFAULT_DECAY_WINDOW);
+  PruneParameters *compile(const Volume *volume) const override {
+    DecayParameters p;
+    p.decayStart =
+        decayDays(get(volume, "decay-start", DEFAULT_DECAY_START), "decay-start");
+    p.decayWindow = decayDays(get(volume, "decay-window", DEFAULT_DECAY_WINDOW),
+                              "decay-window");
     PolicyParameter decayScale =
         get(volume, "decay-scale", DEFAULT_DECAY_SCALE);
-    PolicyParameter decayLimit = get(volume, "decay-limit", DEFAULT_PRUNE_AGE);
     try {
-      if(parseTimeInterval(decayStart.value) < 1)
-        throw SyntaxError("decay-start too small");
-    } catch(SyntaxError &e) {
-      throw ConfigError(decayStart.location, e.what());
-    }
-    try {
-      if(parseTimeInterval(decayWindow.value) < 1)
-        throw SyntaxError("decay-window too small");
-    } catch(SyntaxError &e) {
-      throw ConfigError(decayWindow.location, e.what());
-    }
-    try {
-      parseFloat(decayScale.value, 1, std::numeric_limits<double>::max(),
-                 ExclusiveLimit);
+      p.decayScale = parseFloat(decayScale.value, 1,
+                                std::numeric_limits<double>::max(),
+                                ExclusiveLimit);
     } catch(SyntaxError &e) {
       throw ConfigError(decayScale.location, e.what());
     }
-    try {
-      if(parseTimeInterval(decayLimit.value) < 1)
-        throw SyntaxError("decay-limit too small");
-    } catch(SyntaxError &e) {
-      throw ConfigError(decayLimit.location, e.what());
-    }
+    p.decayLimit =
+        decayDays(get(volume, "decay-limit", DEFAULT_PRUNE_AGE), "decay-limit");
+    return new DecayParameters(p);
   }
 
   void prunable(std::vector<Backup *> &onDevice,
-                std::map<Backup *, std::string> &prune, int) const override {
-    const Volume *volume = onDevice.at(0)->volume;
-    int decayStart =
-        parseTimeInterval(get(volume, "decay-start", DEFAULT_DECAY_START).value)
-        / 86400;
-    int decayWindow =
-        parseTimeInterval(
-            get(volume, "decay-window", DEFAULT_DECAY_WINDOW).value)
-        / 86400;
-    double decayScale =
-        parseFloat(get(volume, "decay-scale", DEFAULT_DECAY_SCALE).value, 1,
-                   std::numeric_limits<double>::max(), ExclusiveLimit);
-    int decayLimit =
-        parseTimeInterval(get(volume, "decay-limit", DEFAULT_PRUNE_AGE).value)
-        / 86400;
+                std::map<Backup *, std::string> &prune, int,
+                const Date &today) const override {
+    const DecayParameters &p = static_cast<const DecayParameters &>(
+        parameters(onDevice.at(0)->volume));
     if(onDevice.size() == 1)
       return;
+    // Age and bucket of each backup that is a candidate for thinning out
+    struct Candidate {
+      Backup *backup;
+      int age;
+      int bucket;
+    };
+    std::vector<Candidate> candidates;
     // Map of bucket numbers to oldest backup in the bucket.  These will be
     // preserved.
     std::map<int, const Backup *> oldest;
     for(Backup *backup: onDevice) {
-      int age = Date::today("PRUNE") - Date(backup->time);
+      int age = today - Date(backup->time);
       // Keep backups that are young enough
-      int a = age - decayStart;
+      int a = age - p.decayStart;
       if(a <= 0)
         continue;
       // Prune backups that are much too old
-      if(age > decayLimit) {
+      if(age > p.decayLimit) {
         std::ostringstream ss;
-        ss << "age " << age << " > " << decayLimit
+        ss << "age " << age << " > " << p.decayLimit
            << " and other backups exist";
         prune[backup] = ss.str();
         continue;
       }
       // Assign backups to buckets
-      int bucket = prune_decay_bucket(decayWindow, decayScale, a);
+      int bucket = prune_decay_bucket(p.decayWindow, p.decayScale, a);
+      candidates.push_back({backup, age, bucket});
       // Track the oldest backup in this bucket
       auto bucket_iterator = oldest.find(bucket);
       if(bucket_iterator == oldest.end()
@@ -111,21 +125,15 @@ public:
     }
     // Now that we know what the oldest backup in each bucket is, we can prune
     // the rest.
-    for(Backup *backup: onDevice) {
-      int age = Date::today("PRUNE") - Date(backup->time);
-      // Keep backups that are young enough
-      int a = age - decayStart;
-      if(a <= 0 || age > decayLimit)
-        continue;
-      int bucket = prune_decay_bucket(decayWindow, decayScale, a);
-      auto bucket_iterator = oldest.find(bucket);
+    for(const Candidate &c: candidates) {
+      auto bucket_iterator = oldest.find(c.bucket);
       assert(bucket_iterator != oldest.end());
       const Backup *oldest_in_this_bucket = bucket_iterator->second;
-      if(backup != oldest_in_this_bucket) {
+      if(c.backup != oldest_in_this_bucket) {
         std::ostringstream ss;
-        ss << "age " << age << " > " << decayStart << " and oldest in bucket "
-           << bucket;
-        prune[backup] = ss.str();
+        ss << "age " << c.age << " > " << p.decayStart
+           << " and oldest in bucket " << c.bucket;
+        prune[c.backup] = ss.str();
       }
     }
   }
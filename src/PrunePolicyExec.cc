@@ -20,36 +20,257 @@
 #include "Host.h"
 #include "PrunePolicy.h"
 #include "Subprocess.h"
+#include "Json.h"
 #include "Utils.h"
 #include "Errors.h"
-#include <unistd.h>
+#include "Defaults.h"
+#include <cerrno>
+#include <csignal>
 #include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <set>
 #include <sstream>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** @brief A long-lived pruning subprogram
+ *
+ * Used for the @c batch mode of @ref PruneExec.  The subprogram's standard
+ * input and output are both connected to a socket.  Each request is written
+ * as a single line, and the subprogram must answer each with a single line.
+ */
+class PruneCoprocess {
+public:
+  /** @brief Constructor
+   * @param path_ Path to subprogram
+   */
+  PruneCoprocess(const std::string &path_):
+      path(path_), sp(std::vector<std::string>{path_}) {
+    int sv[2];
+    // A socket, rather than a pair of pipes, so that writes to a subprogram
+    // that has gone away fail rather than raising SIGPIPE.
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+      throw IOError("creating socket for " + path, errno);
+    sp.addChildFD(0, sv[1], -1, 1);
+    try {
+      pid = sp.run();
+    } catch(...) {
+      // The subprocess could not be created, so both ends are still open
+      ::close(sv[0]);
+      ::close(sv[1]);
+      throw;
+    }
+    fd = sv[0];
+  }
+
+  PruneCoprocess(const PruneCoprocess &) = delete;
+  PruneCoprocess &operator=(const PruneCoprocess &) = delete;
+
+  /** @brief Destructor
+   *
+   * If the subprogram is still running it is killed.
+   */
+  ~PruneCoprocess() {
+    if(fd >= 0)
+      ::close(fd);
+  }
+
+  /** @brief Send a request and wait for the reply
+   * @param request Request, without a newline
+   * @return Reply, without a newline
+   */
+  std::string request(const std::string &request) {
+    struct timespec deadline;
+    getMonotonicTime(deadline);
+    deadline.tv_sec += PRUNE_EXEC_TIMEOUT;
+    const std::string line = request + "\n";
+    for(size_t written = 0; written < line.size();) {
+      await(POLLOUT, deadline);
+      ssize_t n = send(fd, line.data() + written, line.size() - written,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(n < 0) {
+        if(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+          continue;
+        throw IOError("writing to " + path, errno);
+      }
+      written += n;
+    }
+    size_t newline;
+    while((newline = input.find('\n')) == std::string::npos) {
+      char buffer[4096];
+      await(POLLIN, deadline);
+      ssize_t n = recv(fd, buffer, sizeof buffer, MSG_DONTWAIT);
+      if(n < 0) {
+        if(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+          continue;
+        throw IOError("reading from " + path, errno);
+      }
+      if(n == 0)
+        throw InvalidPruneList("unexpected end of file from " + path);
+      input.append(buffer, n);
+    }
+    std::string reply(input, 0, newline);
+    input.erase(0, newline + 1);
+    return reply;
+  }
+
+  /** @brief Tell the subprogram there are no more requests and wait for it
+   *
+   * An exception is thrown if it fails, or is killed for taking too long to
+   * exit.
+   */
+  void close() {
+    shutdown(fd, SHUT_WR);
+    sp.setTimeout(PRUNE_EXEC_TIMEOUT);
+    sp.wait();
+    ::close(fd);
+    fd = -1;
+  }
+
+private:
+  /** @brief Wait until the socket is ready
+   * @param events Events to wait for
+   * @param deadline When to give up
+   * @throws InvalidPruneList if @p deadline passes first
+   *
+   * If the deadline passes, the subprogram is killed.
+   */
+  void await(short events, const struct timespec &deadline) {
+    for(;;) {
+      struct timespec now;
+      getMonotonicTime(now);
+      if(now >= deadline) {
+        kill(pid, SIGKILL);
+        throw InvalidPruneList(path + " did not reply within "
+                               + std::to_string(PRUNE_EXEC_TIMEOUT)
+                               + " seconds");
+      }
+      const struct timespec left = deadline - now;
+      struct pollfd pfd = {fd, events, 0};
+      int n = poll(&pfd, 1, left.tv_sec * 1000 + left.tv_nsec / 1000000 + 1);
+      if(n < 0) {
+        if(errno == EINTR)
+          continue;
+        throw IOError("waiting for " + path, errno);
+      }
+      if(n > 0)
+        return;
+    }
+  }
+
+  /** @brief Path to subprogram */
+  std::string path;
+
+  /** @brief Subprocess running the subprogram */
+  Subprocess sp;
+
+  /** @brief Process ID of the subprogram */
+  pid_t pid = -1;
+
+  /** @brief Socket connected to the subprogram */
+  int fd = -1;
+
+  /** @brief Input read but not yet returned */
+  std::string input;
+};
+
+/** @brief Long-lived subprograms for @c batch mode, by path
+ *
+ * These are kept here rather than in @ref PruneExec, since pruning policies
+ * are shared and immutable.
+ */
+static std::map<std::string, std::unique_ptr<PruneCoprocess>> coprocesses;
+
+/** @brief Parameters for the @c exec pruning policy */
+struct ExecParameters: public PruneParameters {
+  /** @brief Path to subprogram */
+  std::string path;
+
+  /** @brief @c true for @c batch mode */
+  bool batch;
+};
 
 /** @brief Pruning policy that executes a program */
 class PruneExec: public PrunePolicy {
 public:
   PruneExec(): PrunePolicy("exec") {}
 
-  void validate(const Volume *volume) const override {
+  PruneParameters *compile(const Volume *volume) const override {
     const PolicyParameter &path = get(volume, "path");
     if(access(path.value.c_str(), X_OK) < 0)
       throw ConfigError(path.location,
                         "cannot execute pruning policy " + volume->prunePolicy);
+    const PolicyParameter mode = get(volume, "mode", "environment");
+    if(mode.value != "environment" && mode.value != "batch")
+      throw ConfigError(mode.location,
+                        "invalid pruning parameter 'mode' value '" + mode.value
+                            + "'");
     for(auto &p: volume->pruneParameters)
       for(auto ch: p.first)
         if(ch != '_' && !isalnum(ch))
           throw ConfigError(p.second.location,
                             "invalid pruning parameter '" + p.first
                                 + "' for executable policies");
+    ExecParameters *p = new ExecParameters();
+    p->path = path.value;
+    p->batch = mode.value == "batch";
+    return p;
   }
 
   void prunable(std::vector<Backup *> &onDevice,
-                std::map<Backup *, std::string> &prune,
-                int total) const override {
+                std::map<Backup *, std::string> &prune, int total,
+                const Date &) const override {
+    const ExecParameters &p =
+        static_cast<const ExecParameters &>(parameters(onDevice.at(0)->volume));
+    // Backups are identified to the subprogram by time.  In the unlikely
+    // event that two share a time, selecting that time selects both.
+    std::unordered_map<time_t, std::vector<Backup *>> byTime;
+    for(Backup *backup: onDevice)
+      byTime[backup->time].push_back(backup);
+    std::set<time_t> selected;
+    auto select = [&](time_t pruneTime, const std::string &reason) {
+      auto it = byTime.find(pruneTime);
+      if(it == byTime.end())
+        throw InvalidPruneList("nonexistent entry in prune list");
+      if(!selected.insert(pruneTime).second)
+        throw InvalidPruneList("duplicate entry in prune list");
+      for(Backup *backup: it->second)
+        prune[backup] = reason;
+    };
+    if(p.batch)
+      prunableBatch(p.path, onDevice, total, select);
+    else
+      prunableEnvironment(p.path, onDevice, total, select);
+  }
+
+  void finish() const override {
+    // If a subprogram fails, the rest are killed when they are destroyed
+    std::map<std::string, std::unique_ptr<PruneCoprocess>> stopping;
+    stopping.swap(coprocesses);
+    for(auto &c: stopping)
+      c.second->close();
+  }
+
+private:
+  /** @brief Type of callback to select a backup for pruning */
+  typedef std::function<void(time_t, const std::string &)> Selector;
+
+  /** @brief Identify prunable backups with a subprogram per request
+   * @param path Path to subprogram
+   * @param onDevice Surviving backups of same volume on same device
+   * @param total Number of backups anywhere
+   * @param select Called for each backup to prune
+   */
+  void prunableEnvironment(const std::string &path,
+                           std::vector<Backup *> &onDevice, int total,
+                           const Selector &select) const {
     char buffer[64];
     const Volume *volume = onDevice.at(0)->volume;
-    std::vector<std::string> command = {get(volume, "path").value};
+    std::vector<std::string> command = {path};
     Subprocess sp(command);
     for(auto &p: volume->pruneParameters)
       sp.setenv("PRUNE_" + p.first, p.second.value);
@@ -78,20 +299,69 @@ public:
         throw InvalidPruneList("no colon found");
       std::string timestr(reasons, pos, colon - pos);
       std::string reason(reasons, colon + 1, newline - (colon + 1));
-      time_t pruneTime =
-          parseInteger(timestr, 0, std::numeric_limits<time_t>::max());
-      bool found = false;
-      for(Backup *backup: onDevice) {
-        if(backup->time == pruneTime) {
-          if(contains(prune, backup))
-            throw InvalidPruneList("duplicate entry in prune list");
-          prune[backup] = reason;
-          found = true;
-        }
-      }
-      if(!found)
-        throw InvalidPruneList("nonexistent entry in prune list");
+      select(parseInteger(timestr, 0, std::numeric_limits<time_t>::max()),
+             reason);
       pos = newline + 1;
     }
   }
+
+  /** @brief Identify prunable backups with a long-lived subprogram
+   * @param path Path to subprogram
+   * @param onDevice Surviving backups of same volume on same device
+   * @param total Number of backups anywhere
+   * @param select Called for each backup to prune
+   */
+  void prunableBatch(const std::string &path, std::vector<Backup *> &onDevice,
+                     int total, const Selector &select) const {
+    const Volume *volume = onDevice.at(0)->volume;
+    std::unique_ptr<PruneCoprocess> &coprocess = coprocesses[path];
+    if(!coprocess)
+      coprocess.reset(new PruneCoprocess(path));
+    std::stringstream ss;
+    ss << "{\"host\":" << Json::quote(volume->parent->name)
+       << ",\"volume\":" << Json::quote(volume->name)
+       << ",\"device\":" << Json::quote(onDevice.at(0)->deviceName)
+       << ",\"total\":" << total << ",\"backups\":[";
+    for(size_t i = 0; i < onDevice.size(); ++i) {
+      if(i)
+        ss << ',';
+      ss << onDevice[i]->time;
+    }
+    ss << "],\"parameters\":{";
+    bool first = true;
+    for(auto &p: volume->pruneParameters) {
+      if(!first)
+        ss << ',';
+      ss << Json::quote(p.first) << ':' << Json::quote(p.second.value);
+      first = false;
+    }
+    ss << "}}";
+    std::string line;
+    try {
+      line = coprocess->request(ss.str());
+    } catch(...) {
+      // Discard the subprogram, killing it if necessary
+      coprocesses.erase(path);
+      throw;
+    }
+    Json reply;
+    try {
+      reply = Json::parse(line);
+    } catch(SyntaxError &e) {
+      throw InvalidPruneList(e.what());
+    }
+    const Json *list = reply.find("prune");
+    if(!list || list->type != Json::Array)
+      throw InvalidPruneList("no prune list found");
+    for(const Json &entry: list->array) {
+      const Json *pruneTime = entry.find("time"),
+                 *reason = entry.find("reason");
+      if(!pruneTime || pruneTime->type != Json::Number || !reason
+         || reason->type != Json::String)
+        throw InvalidPruneList("invalid entry in prune list");
+      select(parseInteger(pruneTime->string, 0,
+                          std::numeric_limits<time_t>::max()),
+             reason->string);
+    }
+  }
 } prune_exec;
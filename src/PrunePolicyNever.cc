@@ -15,14 +15,22 @@
 #include <config.h>
 #include "rsbackup.h"
 #include "PrunePolicy.h"
+#include <limits>
 
 /** @brief The @c never pruning policy */
 class PruneNever: public PrunePolicy {
 public:
   PruneNever(): PrunePolicy("never") {}
 
-  void validate(const Volume *) const override {}
+  PruneParameters *compile(const Volume *) const override {
+    return new PruneParameters();
+  }
+
+  int minimumBackups(const Volume *) const override {
+    // Never prune anything, even to free space
+    return std::numeric_limits<int>::max();
+  }
 
   void prunable(std::vector<Backup *> &, std::map<Backup *, std::string> &,
-                int) const override {}
+                int, const Date &) const override {}
 } prune_never;
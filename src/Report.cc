@@ -29,6 +29,7 @@
 #include "Command.h"
 #include "IO.h"
 #include "Database.h"
+#include "LogCodec.h"
 #include "Report.h"
 #include "Utils.h"
 #include "Subprocess.h"
@@ -164,6 +165,22 @@ int Report::warningCount() const {
   return warnings;
 }
 
+// Format a size in bytes compactly
+static std::string formatSize(long long size) {
+  std::stringstream ss;
+  if(size < 1024)
+    ss << size;
+  else if(size < (1LL << 20))
+    ss << (size >> 10) << "K";
+  else if(size < (1LL << 30))
+    ss << (size >> 20) << "M";
+  else if(size < (1LL << 40))
+    ss << (size >> 30) << "G";
+  else
+    ss << (size >> 40) << "T";
+  return ss.str();
+}
+
 // Generate the summary table
 void Report::summary() {
   Document::Table *t = new Document::Table();
@@ -239,20 +256,10 @@ void Report::summary() {
         t->addCell(new Document::Cell(new Document::String(perDeviceCount)))
             ->style = perDeviceCount ? "good" : "bad";
         // Log the size
-        std::stringstream size;
-        if(perDevice && perDevice->size >= 0) {
-          if(perDevice->size < 1024)
-            size << perDevice->size;
-          else if(perDevice->size < (1LL << 20))
-            size << (perDevice->size >> 10) << "K";
-          else if(perDevice->size < (1LL << 30))
-            size << (perDevice->size >> 20) << "M";
-          else if(perDevice->size < (1LL << 40))
-            size << (perDevice->size >> 30) << "G";
-          else
-            size << (perDevice->size >> 40) << "T";
-        }
-        t->addCell(new Document::Cell(new Document::String(size.str())));
+        std::string size;
+        if(perDevice && perDevice->size >= 0)
+          size = formatSize(perDevice->size);
+        t->addCell(new Document::Cell(new Document::String(size)));
       }
       // Median/maximum elapsed time
       std::vector<int64_t> times;
@@ -284,10 +291,66 @@ void Report::summary() {
   d.append(t);
 }
 
+// Generate the resource usage table
+void Report::resources() {
+  Document::Table *t = new Document::Table();
+
+  t->addCell(new Document::Cell("Host", 1, 2, true));
+  t->addCell(new Document::Cell("Volume", 1, 2, true));
+  t->addCell(new Document::Cell("Device", 1, 2, true));
+  t->addCell(new Document::Cell("Latest", 5, 1, true));
+  t->addCell(new Document::Cell("Peak", 1, 1, true));
+  t->newRow();
+  t->addCell(new Document::Cell("User", 1, 1, true));
+  t->addCell(new Document::Cell("System", 1, 1, true));
+  t->addCell(new Document::Cell("RSS", 1, 1, true));
+  t->addCell(new Document::Cell("Read", 1, 1, true));
+  t->addCell(new Document::Cell("Written", 1, 1, true));
+  t->addCell(new Document::Cell("RSS", 1, 1, true));
+  t->newRow();
+
+  char buffer[64];
+  for(auto &h: globalConfig.hosts) {
+    const Host *host = h.second;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      for(auto &d: globalConfig.devices) {
+        const Device *device = d.second;
+        // Find the most recent backup with resource usage recorded, and the
+        // largest RSS.
+        const Backup *latest = nullptr;
+        int64_t peakRSS = 0;
+        for(const Backup *backup: volume->backups) {
+          if(backup->deviceName != device->name || backup->maxRSS <= 0)
+            continue;
+          latest = backup;
+          peakRSS = std::max(peakRSS, backup->maxRSS);
+        }
+        if(!latest)
+          continue;
+        t->addCell(new Document::Cell(host->name))->style = "host";
+        t->addCell(new Document::Cell(volume->name))->style = "volume";
+        t->addCell(new Document::Cell(device->name));
+        snprintf(buffer, sizeof buffer, "%.1fs", latest->userTime / 1e6);
+        t->addCell(new Document::Cell(buffer));
+        snprintf(buffer, sizeof buffer, "%.1fs", latest->systemTime / 1e6);
+        t->addCell(new Document::Cell(buffer));
+        t->addCell(new Document::Cell(formatSize(latest->maxRSS * 1024)));
+        t->addCell(new Document::Cell(std::to_string(latest->inBlocks)));
+        t->addCell(new Document::Cell(std::to_string(latest->outBlocks)));
+        t->addCell(new Document::Cell(formatSize(peakRSS * 1024)));
+        t->newRow();
+      }
+    }
+  }
+
+  d.append(t);
+}
+
 // Return true if this is a suitable log for the report
 bool Report::suitableLog(const Volume *volume, const Backup *backup) {
   // Empty logs are never shown.
-  if(!backup->contents.size())
+  if(!backup->hasContents())
     return false;
   switch(globalCommand.logVerbosity) {
   case Command::All:
@@ -343,7 +406,11 @@ void Report::logs(const Volume *volume) {
       lc->append(heading);
       Document::Verbatim *v = new Document::Verbatim();
       v->style = "log";
-      v->append(backup->contents);
+      // Don't cache logs in the backup object if they weren't already
+      // loaded; the report may include a great many of them.
+      v->append(backup->contentsLoaded()
+                    ? backup->getContents()
+                    : globalConfig.readLog(*backup));
       lc->append(v);
     }
     devicesSeen.insert(backup->deviceName);
@@ -378,12 +445,15 @@ void Report::pruneLogs(const std::string &interval) {
   t->newRow();
 
   const int64_t cutoff = Date::now("REPORT") - 86400 * ndays;
-  Database::Statement stmt(globalConfig.getdb(),
-                           "SELECT host,volume,device,time,pruned,log"
-                           " FROM backup"
-                           " WHERE (status=? OR status=?) AND pruned >= ?"
-                           " ORDER BY pruned DESC",
-                           SQL_INT, PRUNING, SQL_INT, PRUNED, SQL_INT64, cutoff,
+  // Older databases have no logCodec column; 0 means uncompressed
+  const std::string cmd
+      = std::string("SELECT host,volume,device,time,pruned,log,")
+        + (globalDatabaseVersion < 11 ? "0" : "logCodec")
+        + " FROM backup"
+          " WHERE (status=? OR status=?) AND pruned >= ?"
+          " ORDER BY pruned DESC";
+  Database::Statement stmt(globalConfig.getReaderDb(), cmd.c_str(), SQL_INT,
+                           PRUNING, SQL_INT, PRUNED, SQL_INT64, cutoff,
                            SQL_END);
   Table<std::string> st;
   while(stmt.next()) {
@@ -394,7 +464,7 @@ void Report::pruneLogs(const std::string &interval) {
     std::string deviceName = stmt.get_string(2);
     time_t when = stmt.get_int64(3);
     time_t pruned = stmt.get_int64(4);
-    std::string reason = stmt.get_blob(5);
+    std::string reason = decodeLog(stmt.get_blob(5), stmt.get_int(6));
     std::vector<std::string> row;
 
     strftime(timestr, sizeof timestr, "%Y-%m-%d", localtime(&when));
@@ -468,6 +538,8 @@ void Report::section(const std::string &n) {
     warnings();
   else if(name == "summary")
     summary();
+  else if(name == "resources")
+    resources();
   else if(name == "logs")
     logs();
   else if(name == "prune-logs")
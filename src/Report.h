@@ -81,6 +81,9 @@ private:
   /** @brief Generate the summary table and set counters */
   void summary();
 
+  /** @brief Generate the table of @c rsync resource usage */
+  void resources();
+
   /** @brief Return @c true if this is a suitable log for the report */
   bool suitableLog(const Volume *volume, const Backup *backup);
 
@@ -19,6 +19,7 @@
 #include "Utils.h"
 #include "IO.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 #include <cerrno>
 #include <cstring>
 
@@ -31,15 +32,14 @@ static void retireDevice(const std::string &deviceName) {
       return;
   }
   // Remove all the log records for this device.
-  if(globalCommand.act) {
-    globalConfig.getdb().begin();
-    Database::Statement(globalConfig.getdb(),
-                        "DELETE FROM backup"
-                        " WHERE device=?",
-                        SQL_STRING, &deviceName, SQL_END)
-        .next();
-    globalConfig.getdb().commit();
-  }
+  if(globalCommand.act)
+    globalConfig.getWriter().execute([&deviceName](Database &db) {
+      Database::Statement(db,
+                          "DELETE FROM backup"
+                          " WHERE device=?",
+                          SQL_STRING, &deviceName, SQL_END)
+          .next();
+    });
 }
 
 void retireDevices() {
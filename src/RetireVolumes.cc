@@ -22,6 +22,7 @@
 #include "Errors.h"
 #include "IO.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
 #include "BulkRemove.h"
 #include "Backup.h"
 #include <cerrno>
@@ -35,6 +36,35 @@ static void removeDirectory(const std::string &path) {
   }
 }
 
+struct Retirable;
+
+/** @brief Removal of one retirable backup
+ *
+ * The outcome is dealt with as soon as the removal completes, rather than
+ * once all removals have completed.
+ */
+class RetireRemove: public BulkRemove {
+public:
+  /** @brief Constructor
+   * @param name Action name
+   * @param path Path to remove
+   * @param r Backup being retired
+   * @param batch_ Batch to record database updates in
+   */
+  RetireRemove(const std::string &name, const std::string &path, Retirable *r,
+               DatabaseWriter::Batch &batch_):
+      BulkRemove(name, path), retirable(r), batch(batch_) {}
+
+  void done(EventLoop *e, ActionList *al) override;
+
+private:
+  /** @brief Backup being retired */
+  Retirable *retirable;
+
+  /** @brief Batch to record database updates in */
+  DatabaseWriter::Batch &batch;
+};
+
 /** @brief One retirable backup  */
 struct Retirable {
   /** @brief Host name */
@@ -68,24 +98,29 @@ struct Retirable {
     delete b;
   }
 
-  /** @brief Schedule retire of this backup */
-  void scheduleRetire(ActionList &al) {
+  /** @brief Schedule retire of this backup
+   * @param al Action list
+   * @param batch Batch to record database updates in
+   */
+  void scheduleRetire(ActionList &al, DatabaseWriter::Batch &batch) {
     assert(!b);
     const std::string backupPath = (device->store->path + PATH_SEP + hostName
                                     + PATH_SEP + volumeName + PATH_SEP + id);
     if(globalWarningMask & WARNING_VERBOSE)
       IO::out.writef("INFO: removing %s\n", backupPath.c_str());
     if(globalCommand.act) {
-      b = new BulkRemove("remove/" + hostName + "/" + volumeName + "/"
-                             + device->name + "/" + id,
-                         backupPath);
+      b = new RetireRemove("remove/" + hostName + "/" + volumeName + "/"
+                               + device->name + "/" + id,
+                           backupPath, this, batch);
       b->uses(device->name);
       al.add(b);
     }
   }
 
-  /** @brief Clean up after retire of this backup */
-  void retired() {
+  /** @brief Clean up after retire of this backup
+   * @param batch Batch to record database updates in
+   */
+  void retired(DatabaseWriter::Batch &batch) {
     const std::string backupPath = (device->store->path + PATH_SEP + hostName
                                     + PATH_SEP + volumeName + PATH_SEP + id);
     if(globalCommand.act) {
@@ -100,21 +135,35 @@ struct Retirable {
         error("removing %s: %s", incompletePath.c_str(), strerror(errno));
         return;
       }
-      forget();
+      forget(batch);
     }
   }
 
-  /** @brief Remove backup record from the database */
-  void forget() {
-    Database::Statement(globalConfig.getdb(),
-                        "DELETE FROM backup"
-                        " WHERE host=? AND volume=? AND device=? AND id=?",
-                        SQL_STRING, &hostName, SQL_STRING, &volumeName,
-                        SQL_STRING, &device->name, SQL_STRING, &id, SQL_END)
-        .next();
+  /** @brief Remove backup record from the database
+   * @param batch Batch to record database updates in
+   *
+   * The backup must already have been removed from its device, so that if
+   * the update is lost, the backup is retired again next time.
+   */
+  void forget(DatabaseWriter::Batch &batch) {
+    batch.add(
+        [hostName = hostName, volumeName = volumeName,
+         deviceName = device->name, id = id](Database &db) {
+          Database::Statement(
+              db,
+              "DELETE FROM backup"
+              " WHERE host=? AND volume=? AND device=? AND id=?",
+              SQL_STRING, &hostName, SQL_STRING, &volumeName, SQL_STRING,
+              &deviceName, SQL_STRING, &id, SQL_END)
+              .next();
+        });
   }
 };
 
+void RetireRemove::done(EventLoop *, ActionList *) {
+  retirable->retired(batch);
+}
+
 // Schedule the retire of one volume or host
 static void identifyVolumes(std::vector<Retirable> &retire,
                             std::set<std::string> &volume_directories,
@@ -139,8 +188,9 @@ static void identifyVolumes(std::vector<Retirable> &retire,
       return;
   }
   // Find all the backups to retire
+  globalConfig.identifyDevices(Store::Enabled);
   {
-    Database::Statement stmt(globalConfig.getdb());
+    Database::Statement stmt(globalConfig.getReaderDb());
     if(volumeName == "*")
       stmt.prepare("SELECT volume,device,id FROM backup"
                    " WHERE host=? AND status!=?",
@@ -152,7 +202,6 @@ static void identifyVolumes(std::vector<Retirable> &retire,
                    PRUNED, SQL_END);
     while(stmt.next()) {
       std::string deviceName = stmt.get_string(1);
-      globalConfig.identifyDevices(Store::Enabled);
       Device *device = globalConfig.findDevice(deviceName);
       if(!device) {
         // User should use --retire-device instead
@@ -194,21 +243,26 @@ void retireVolumes(bool remove) {
     // Schedule removal
     EventLoop e;
     ActionList al(&e);
+    // Database updates are committed in bounded batches.  Removals can take
+    // a long time, so the batch is also flushed from the event loop.
+    DatabaseWriter::Batch batch(globalConfig.getWriter(), &e);
+    for(auto &d: globalConfig.devices)
+      al.setCapacity(d.first, d.second->removalConcurrency);
     for(Retirable &r: retire)
-      r.scheduleRetire(al);
-    // Perform removal
+      r.scheduleRetire(al, batch);
+    // Perform removal.  As each backup is removed, its .incomplete file is
+    // cleaned up and its database record deleted.
     al.go();
-    // Clean up .incomplete files and db after removal
-    for(Retirable &r: retire)
-      r.retired();
     // Clean up redundant directories
     for(auto &d: volume_directories)
       removeDirectory(d);
     for(auto &d: host_directories)
       removeDirectory(d);
   } else {
-    if(globalCommand.act)
+    if(globalCommand.act) {
+      DatabaseWriter::Batch batch(globalConfig.getWriter());
       for(Retirable &r: retire)
-        r.forget();
+        r.forget(batch);
+    }
   }
 }
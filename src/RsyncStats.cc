@@ -0,0 +1,76 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "RsyncStats.h"
+#include "Utils.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/** @brief Parse a number that may contain thousands separators
+ * @param s Start of number
+ * @param value Where to store value
+ *
+ * @p value is unchanged if there are no digits.
+ */
+static void parseCount(const char *s, int64_t &value) {
+  int64_t n = 0;
+  bool found = false;
+  while(*s == ' ')
+    ++s;
+  for(; isdigit((unsigned char)*s) || *s == ','; ++s) {
+    if(*s == ',')
+      continue;
+    n = n * 10 + (*s - '0');
+    found = true;
+  }
+  if(found)
+    value = n;
+}
+
+void RsyncStats::parse(const std::string &log) {
+  static const struct {
+    const char *name;
+    int64_t RsyncStats::*member;
+  } fields[] = {
+      {"Number of regular files transferred:", &RsyncStats::filesTransferred},
+      {"Number of files transferred:", &RsyncStats::filesTransferred},
+      {"Total file size:", &RsyncStats::totalSize},
+      {"Total transferred file size:", &RsyncStats::transferredSize},
+      {"Literal data:", &RsyncStats::literalData},
+      {"Matched data:", &RsyncStats::matchedData},
+  };
+  std::vector<std::string> lines;
+  toLines(lines, log);
+  for(const auto &line: lines) {
+    for(const auto &field: fields) {
+      size_t len = strlen(field.name);
+      if(line.compare(0, len, field.name) == 0) {
+        parseCount(line.c_str() + len, this->*field.member);
+        break;
+      }
+    }
+    // total size is 4198407  speedup is 1.00
+    size_t pos = line.find("speedup is ");
+    if(line.compare(0, 14, "total size is ") == 0 && pos != std::string::npos) {
+      const char *start = line.c_str() + pos + 11;
+      char *end;
+      double value = strtod(start, &end);
+      if(end != start)
+        speedup = value;
+    }
+  }
+}
@@ -0,0 +1,56 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef RSYNCSTATS_H
+#define RSYNCSTATS_H
+/** @file RsyncStats.h
+ * @brief Statistics from rsync --stats
+ */
+
+#include <cstdint>
+#include <string>
+
+/** @brief Statistics reported by @c rsync @c --stats
+ *
+ * Any value that could not be found is -1.
+ */
+struct RsyncStats {
+  /** @brief Number of regular files transferred */
+  int64_t filesTransferred = -1;
+
+  /** @brief Total size of all files, in bytes */
+  int64_t totalSize = -1;
+
+  /** @brief Total size of transferred files, in bytes */
+  int64_t transferredSize = -1;
+
+  /** @brief Number of bytes sent literally */
+  int64_t literalData = -1;
+
+  /** @brief Number of bytes matched against existing data */
+  int64_t matchedData = -1;
+
+  /** @brief Speedup ratio */
+  double speedup = -1;
+
+  /** @brief Extract statistics from @c rsync output
+   * @param log Output from @c rsync
+   *
+   * Values not found in @p log are left unchanged.
+   */
+  void parse(const std::string &log);
+};
+
+#endif /* RSYNCSTATS_H */
@@ -0,0 +1,134 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "Conf.h"
+#include "Host.h"
+#include "SshMultiplex.h"
+#include "Subprocess.h"
+#include "Utils.h"
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/stat.h>
+
+std::mutex SshMultiplex::lock;
+std::string SshMultiplex::directory;
+std::map<std::string, SshMultiplex::Master *> SshMultiplex::masters;
+
+SshMultiplex::Master *SshMultiplex::find(const Host *host) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(!directory.size()) {
+    // Control socket paths are limited to about 100 bytes, so use a short
+    // private directory rather than anything derived from the host name.
+    const char *base = getenv("XDG_RUNTIME_DIR");
+    std::string templ = std::string(base && *base ? base : "/tmp")
+                        + "/rsbackup.XXXXXX";
+    std::vector<char> buffer(templ.begin(), templ.end());
+    buffer.push_back(0);
+    if(!mkdtemp(buffer.data()))
+      throw SystemError("creating " + templ, errno);
+    directory = buffer.data();
+    D("ssh control directory %s", directory.c_str());
+  }
+  const std::string target = host->userAndHost();
+  Master *&m = masters[target];
+  if(!m) {
+    m = new Master();
+    m->target = target;
+    m->path = directory + "/" + std::to_string(masters.size());
+  }
+  return m;
+}
+
+bool SshMultiplex::start(const Host *host) {
+  Master *m = find(host);
+  std::lock_guard<std::mutex> guard(m->lock);
+  if(m->attempted) {
+    // If the master has gone away (e.g. because it was idle for too long)
+    // then start another one.
+    struct stat sb;
+    if(!m->running || stat(m->path.c_str(), &sb) == 0)
+      return m->running;
+  }
+  std::vector<std::string> args = {
+      "ssh",
+      "-oControlMaster=yes",
+      "-oControlPath=" + m->path,
+      "-oControlPersist=" + std::to_string(DEFAULT_SSH_CONTROL_PERSIST),
+      "-N", // no command
+      "-f", // background once authenticated
+  };
+  if(host->sshTimeout > 0)
+    args.push_back("-oConnectTimeout=" + std::to_string(host->sshTimeout));
+  args.push_back(m->target);
+  Subprocess sp(args);
+  // The master outlives this process, so mustn't hold any of our pipes open
+  sp.nullChildFD(0);
+  sp.nullChildFD(1);
+  sp.nullChildFD(2);
+  m->running = sp.runAndWait(Subprocess::THROW_ON_CRASH) == 0;
+  m->attempted = true;
+  D("ssh master for %s %s", m->target.c_str(),
+    m->running ? "started" : "failed");
+  return m->running;
+}
+
+void SshMultiplex::options(const Host *host, std::vector<std::string> &args) {
+  start(host);
+  Master *m = find(host);
+  // If there's no master then ssh will connect directly
+  args.push_back("-oControlMaster=no");
+  args.push_back("-oControlPath=" + m->path);
+}
+
+void SshMultiplex::shutdown() {
+  std::lock_guard<std::mutex> guard(lock);
+  for(auto &it: masters) {
+    Master *m = it.second;
+    if(m->running) {
+      std::vector<std::string> args = {"ssh", "-oControlPath=" + m->path,
+                                       "-Oexit", m->target};
+      Subprocess sp(args);
+      sp.nullChildFD(0);
+      sp.nullChildFD(1);
+      sp.nullChildFD(2);
+      try {
+        sp.runAndWait(Subprocess::THROW_ON_CRASH);
+      } catch(std::runtime_error &e) {
+        warning(WARNING_ALWAYS, "stopping SSH master for %s: %s",
+                m->target.c_str(), e.what());
+      }
+    }
+    delete m;
+  }
+  masters.clear();
+  if(directory.size()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+    directory.clear();
+  }
+}
+
+SshMultiplex::Session::~Session() {
+  try {
+    shutdown();
+  } catch(std::exception &e) {
+    // Don't let an exception escape a destructor
+    warning(WARNING_ALWAYS, "shutting down SSH connections: %s", e.what());
+  }
+}
@@ -0,0 +1,119 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SSHMULTIPLEX_H
+#define SSHMULTIPLEX_H
+/** @file SshMultiplex.h
+ * @brief Shared SSH connections
+ */
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Host;
+
+/** @brief Manage one SSH master connection per host
+ *
+ * Master connections are started on demand, with their control sockets in a
+ * private directory, and shut down by @ref SshMultiplex::shutdown.  Every
+ * other SSH connection to the same host, including the ones made by @c rsync,
+ * is multiplexed over the master, so there is only one TCP connection and
+ * authentication per host.
+ *
+ * All methods are thread-safe.
+ */
+class SshMultiplex {
+public:
+  /** @brief Ensure there is a master connection to a host
+   * @param host Host to connect to
+   * @return @c true if a master connection is available
+   *
+   * If no master is running, one is started and this method waits until
+   * authentication has completed or failed.
+   */
+  static bool start(const Host *host);
+
+  /** @brief Get the SSH options to use for a host
+   * @param host Host to connect to
+   * @param args Where to append the options
+   *
+   * Starts a master connection if necessary.  If that fails, the options are
+   * still safe to use; @c ssh will just connect directly.
+   */
+  static void options(const Host *host, std::vector<std::string> &args);
+
+  /** @brief Shut down all master connections and remove control sockets
+   *
+   * Failure to stop one master is reported but does not prevent the others
+   * being stopped.
+   */
+  static void shutdown();
+
+  /** @brief Shut down master connections when leaving a scope
+   *
+   * Ensures that master connections and their control sockets are cleaned up
+   * even if the code that started them exits with an exception.
+   */
+  class Session {
+  public:
+    Session() = default;
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    /** @brief Destructor
+     *
+     * Calls @ref SshMultiplex::shutdown.
+     */
+    ~Session();
+  };
+
+private:
+  /** @brief State for one SSH target */
+  struct Master {
+    /** @brief Serializes starting the master */
+    std::mutex lock;
+
+    /** @brief Path to control socket */
+    std::string path;
+
+    /** @brief SSH target for the master */
+    std::string target;
+
+    /** @brief Set once an attempt to start the master has been made */
+    bool attempted = false;
+
+    /** @brief Set if the master started successfully */
+    bool running = false;
+  };
+
+  /** @brief Find or create the state for a host
+   * @param host Host to connect to
+   * @return Master connection state
+   */
+  static Master *find(const Host *host);
+
+  /** @brief Protects @ref directory and @ref masters */
+  static std::mutex lock;
+
+  /** @brief Directory containing control sockets, or empty */
+  static std::string directory;
+
+  /** @brief Masters by SSH target */
+  static std::map<std::string, Master *> masters;
+};
+
+#endif /* SSHMULTIPLEX_H */
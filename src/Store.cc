@@ -21,8 +21,10 @@
 #include "Utils.h"
 #include "DeviceAccess.h"
 #include <cerrno>
+#include <cstdio>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 
 // Identify the device on this store, if any
 void Store::identify() {
@@ -87,3 +89,32 @@ void Store::identify() {
     throw;
   }
 }
+
+void Store::getUsage(double &blocks, double &files) const {
+  struct statvfs fs;
+  if(statvfs(path.c_str(), &fs) < 0)
+    throw IOError("statvfs " + path, errno);
+  const double used = (double)(fs.f_blocks - fs.f_bfree);
+  const double usable = used + fs.f_bavail;
+  blocks = usable > 0 ? 100 * used / usable : 0;
+  files = fs.f_files > 0 ? 100.0 * (fs.f_files - fs.f_ffree) / fs.f_files : 0;
+}
+
+bool Store::overLimit(std::string &why) const {
+  double blocks, files;
+  getUsage(blocks, files);
+  char buffer[128];
+  if(blocks > globalConfig.maxUsage) {
+    snprintf(buffer, sizeof buffer, "space usage %.1f%% > %d%%", blocks,
+             globalConfig.maxUsage);
+    why = buffer;
+    return true;
+  }
+  if(files > globalConfig.maxFileUsage) {
+    snprintf(buffer, sizeof buffer, "inode usage %.1f%% > %d%%", files,
+             globalConfig.maxFileUsage);
+    why = buffer;
+    return true;
+  }
+  return false;
+}
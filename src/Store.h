@@ -66,6 +66,24 @@ public:
    * @throw UnavailableStore
    */
   void identify();
+
+  /** @brief Measure how full the store is
+   * @param blocks Where to store the percentage of space in use
+   * @param files Where to store the percentage of inodes in use
+   * @throw IOError
+   *
+   * As with @c df, space reserved for the superuser is not counted as
+   * available.  If the file system doesn't have a fixed number of inodes then
+   * @p files is set to 0.
+   */
+  void getUsage(double &blocks, double &files) const;
+
+  /** @brief Check whether the store is fuller than allowed
+   * @param why Where to store an explanation, if it is
+   * @return @c true if the store exceeds @c max-usage or @c max-file-usage
+   * @throw IOError
+   */
+  bool overLimit(std::string &why) const;
 };
 
 #endif /* STORE_H */
@@ -47,6 +47,8 @@ Subprocess::~Subprocess() {
   for(const auto &c: captures) {
     close(c.first);
   }
+  for(const auto &c: fileCaptures)
+    close(c.first);
   delete eventloop;
 }
 
@@ -71,6 +73,14 @@ void Subprocess::capture(int childFD, std::string *s, int otherChildFD) {
   captures[p[0]] = s;
 }
 
+void Subprocess::captureFile(int childFD, int fileFD, int otherChildFD) {
+  int p[2];
+  if(pipe(p) < 0)
+    throw IOError("creating pipe", errno);
+  addChildFD(childFD, p[1], p[0], otherChildFD);
+  fileCaptures[p[0]] = fileFD;
+}
+
 pid_t Subprocess::run() {
   assert(!eventloop);
   eventloop = new EventLoop();
@@ -169,12 +179,15 @@ pid_t Subprocess::launch(EventLoop *e) {
 }
 
 void Subprocess::onReadable(EventLoop *e, int fd, const void *ptr, size_t n) {
-  if(n)
-    captures[fd]->append((char *)ptr, n);
-  else {
+  if(n) {
+    // File captures are written by the event loop
+    if(ptr)
+      captures[fd]->append((char *)ptr, n);
+  } else {
     e->cancelRead(fd);
     close(fd);
     captures.erase(fd);
+    fileCaptures.erase(fd);
   }
 }
 
@@ -183,14 +196,22 @@ void Subprocess::onReadError(EventLoop *, int, int errno_value) {
 }
 
 void Subprocess::onTimeout(EventLoop *, const struct timespec &) {
+  timeoutId = 0;
   warning(WARNING_ALWAYS, "%s exceeded timeout of %d seconds", cmd[0].c_str(),
           timeout);
   if(pid > 0)
     kill(pid, SIGKILL);
 }
 
-void Subprocess::onWait(EventLoop *, pid_t, int status, const struct rusage &) {
+void Subprocess::onWait(EventLoop *e, pid_t, int status,
+                        const struct rusage &ru) {
+  // The timeout is no longer needed
+  if(timeoutId) {
+    e->cancelTimeout(timeoutId);
+    timeoutId = 0;
+  }
   this->status = status;
+  resourceUsage = ru;
   this->pid = -1;
   if(actionlist)
     actionlist->completed(this, getActionStatus());
@@ -205,6 +226,8 @@ void Subprocess::setup(EventLoop *e) {
     throw std::logic_error("Subprocess::setup but not running");
   for(auto &c: captures)
     e->whenReadable(c.first, static_cast<Reactor *>(this));
+  for(auto &c: fileCaptures)
+    e->whenReadable(c.first, static_cast<Reactor *>(this), c.second);
   if(timeout > 0) {
     struct timespec timeLimit;
     getMonotonicTime(timeLimit);
@@ -212,7 +235,7 @@ void Subprocess::setup(EventLoop *e) {
       timeLimit.tv_sec += timeout;
     else
       timeLimit.tv_sec = std::numeric_limits<time_t>::max();
-    e->whenTimeout(timeLimit, this);
+    timeoutId = e->whenTimeout(timeLimit, this);
   }
   e->whenWaited(pid, this);
 }
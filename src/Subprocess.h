@@ -23,6 +23,7 @@
 #include <string>
 #include <map>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include "EventLoop.h"
 #include "Action.h"
 
@@ -132,6 +133,19 @@ public:
    */
   void capture(int childFD, std::string *s, int otherChildFD = -1);
 
+  /** @brief Capture output from the child to a file
+   * @param childFD Child file descriptor to capture
+   * @param fileFD File descriptor to write output to
+   * @param otherChildFD Another child file descriptor to capture
+   *
+   * The output is copied from a pipe to @p fileFD within the kernel where
+   * possible, rather than being accumulated in memory.  @p fileFD remains
+   * owned by the caller.
+   *
+   * The capture is performed in wait();
+   */
+  void captureFile(int childFD, int fileFD, int otherChildFD = -1);
+
   /** @brief Set an environment variable in the child
    * @param name Environment variable name
    * @param value Environment variable value
@@ -204,6 +218,15 @@ public:
     return status;
   }
 
+  /** @brief Return the resource usage of the process
+   * @return Resource usage
+   *
+   * All zeros until the process has terminated.
+   */
+  const struct rusage &getResourceUsage() const {
+    return resourceUsage;
+  }
+
   /** @brief Get the status to report to @ref ActionList::completed */
   virtual bool getActionStatus() const;
 
@@ -215,6 +238,10 @@ public:
 
   void go(EventLoop *e, ActionList *al) override;
 
+protected:
+  /** @brief Wait status */
+  int status = -1;
+
 private:
   /** @brief Process ID of child
    * Set to -1 before there is a child.
@@ -269,6 +296,13 @@ private:
    */
   std::map<int, std::string *> captures;
 
+  /** @brief Outputs to capture from the child to files
+   *
+   * Keys are file descriptors to read from, values are the file descriptors
+   * to write the output to.
+   */
+  std::map<int, int> fileCaptures;
+
   /** @brief Launch subprocess
    * @param e Event loop
    * @return Process ID
@@ -288,14 +322,17 @@ private:
    */
   int timeout = 0;
 
+  /** @brief Identifies the pending timeout, or 0 */
+  EventLoop::TimeoutId timeoutId = 0;
+
   void onReadable(EventLoop *e, int fd, const void *ptr, size_t n) override;
   void onReadError(EventLoop *e, int fd, int errno_value) override;
   void onTimeout(EventLoop *e, const struct timespec &now) override;
   void onWait(EventLoop *e, pid_t pid, int status,
               const struct rusage &ru) override;
 
-  /** @brief Wait status */
-  int status = -1;
+  /** @brief Resource usage */
+  struct rusage resourceUsage = {};
 
   /** @brief Containing action list */
   ActionList *actionlist = nullptr;
@@ -0,0 +1,163 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "TimerWheel.h"
+#include "Utils.h"
+#include <climits>
+
+uint64_t TimerWheel::tickFloor(const struct timespec &t) {
+  return (uint64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+uint64_t TimerWheel::tickCeil(const struct timespec &t) {
+  return (uint64_t)t.tv_sec * 1000 + (t.tv_nsec + 999999) / 1000000;
+}
+
+TimerWheel::Id TimerWheel::add(const struct timespec &when, Reactor *r) {
+  if(timers.size() == 0) {
+    // Nothing is filed relative to the current tick, so it can be brought up
+    // to date without advancing through the intervening slots.
+    struct timespec now;
+    getMonotonicTime(now);
+    current = std::max(current, tickFloor(now));
+  }
+  const Id id = ++lastId;
+  Slot pending;
+  pending.push_back({id, tickCeil(when), r, EXPIRED_LEVEL, 0});
+  auto it = pending.begin();
+  place(pending, it);
+  timers[id] = it;
+  return id;
+}
+
+bool TimerWheel::cancel(Id id) {
+  auto ti = timers.find(id);
+  if(ti == timers.end())
+    return false;
+  auto it = ti->second;
+  const int level = it->level, slot = it->slot;
+  list(level, slot).erase(it);
+  if(level < LEVELS)
+    mark(level, slot);
+  timers.erase(ti);
+  return true;
+}
+
+Reactor *TimerWheel::expire(const struct timespec &now) {
+  if(timers.size() == 0)
+    return nullptr;
+  if(expired.empty())
+    advance(tickFloor(now));
+  if(expired.empty())
+    return nullptr;
+  Reactor *r = expired.front().reactor;
+  timers.erase(expired.front().id);
+  expired.pop_front();
+  return r;
+}
+
+bool TimerWheel::next(const struct timespec &now, struct timespec &delay) {
+  if(timers.size() == 0)
+    return false;
+  delay = {0, 0};
+  if(!expired.empty())
+    return true;
+  const uint64_t tick = nextTick();
+  const struct timespec when = {(time_t)(tick / 1000),
+                                (long)(tick % 1000) * 1000000};
+  if(now < when)
+    delay = when - now;
+  return true;
+}
+
+void TimerWheel::place(Slot &from, Slot::iterator it) {
+  Timer &t = *it;
+  int level = EXPIRED_LEVEL, slot = 0;
+  if(t.tick > current) {
+    // The highest bit that differs from the current tick determines the level
+    const int bit = 63 - __builtin_clzll(t.tick ^ current);
+    level = bit / BITS;
+    if(level >= LEVELS)
+      level = OVERFLOW_LEVEL;
+    else
+      slot = (t.tick >> (level * BITS)) & (SLOTS - 1);
+  }
+  Slot &to = list(level, slot);
+  to.splice(to.end(), from, it);
+  t.level = level;
+  t.slot = slot;
+  if(level < LEVELS)
+    mark(level, slot);
+}
+
+void TimerWheel::mark(int level, int slot) {
+  const uint64_t bit = (uint64_t)1 << (slot % 64);
+  if(wheel[level][slot].empty())
+    occupied[level][slot / 64] &= ~bit;
+  else
+    occupied[level][slot / 64] |= bit;
+}
+
+uint64_t TimerWheel::nextTick() const {
+  for(int level = 0; level < LEVELS; ++level) {
+    // Only slots after the current one can be occupied
+    const int first = ((current >> (level * BITS)) & (SLOTS - 1)) + 1;
+    for(int w = first / 64; w < SLOTS / 64; ++w) {
+      uint64_t bits = occupied[level][w];
+      if(w == first / 64)
+        bits &= ~(uint64_t)0 << (first % 64);
+      if(bits) {
+        const uint64_t slot = w * 64 + __builtin_ctzll(bits);
+        const int shift = (level + 1) * BITS;
+        return ((current >> shift) << shift) | (slot << (level * BITS));
+      }
+    }
+  }
+  if(!overflow.empty()) {
+    const int shift = LEVELS * BITS;
+    return ((current >> shift) + 1) << shift;
+  }
+  return UINT64_MAX;
+}
+
+void TimerWheel::advance(uint64_t target) {
+  for(;;) {
+    const uint64_t tick = nextTick();
+    if(tick > target) {
+      // No slot starts in between, so nothing needs to move
+      current = std::max(current, target);
+      return;
+    }
+    current = tick;
+    // Redistribute timeouts in every slot that starts at this tick, highest
+    // level first, so that they can fall all the way through to expiry.
+    if((tick & (((uint64_t)1 << (LEVELS * BITS)) - 1)) == 0) {
+      // Some may belong in the overflow list again
+      Slot pending;
+      pending.splice(pending.end(), overflow);
+      while(!pending.empty())
+        place(pending, pending.begin());
+    }
+    for(int level = LEVELS - 1; level >= 0; --level) {
+      if(tick & (((uint64_t)1 << (level * BITS)) - 1))
+        continue;
+      const int slot = (tick >> (level * BITS)) & (SLOTS - 1);
+      Slot &s = wheel[level][slot];
+      while(!s.empty())
+        place(s, s.begin());
+      mark(level, slot);
+    }
+  }
+}
@@ -0,0 +1,196 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+/** @file TimerWheel.h
+ * @brief Hierarchical timer wheel
+ */
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <unordered_map>
+
+class Reactor;
+
+/** @brief A collection of pending timeouts
+ *
+ * Timeouts are kept in a hierarchical timer wheel with a resolution of one
+ * millisecond.  There are @ref LEVELS wheels of @ref SLOTS slots each; a slot
+ * in level @c L covers <tt>SLOTS<sup>L</sup></tt> milliseconds.  A timeout is
+ * placed in the lowest level whose range covers it, and moves down a level
+ * each time the wheel reaches its slot, until it reaches level 0 and expires.
+ * Timeouts too far in the future for the highest level wait in an overflow
+ * list.
+ *
+ * Adding and cancelling a timeout are O(1).  Each timeout is moved at most
+ * once per level.
+ */
+class TimerWheel {
+public:
+  /** @brief Identifies a timeout */
+  typedef uint64_t Id;
+
+  TimerWheel() = default;
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  /** @brief Add a timeout
+   * @param when (Monotonic) time at which to expire
+   * @param r Reactor to notify
+   * @return Identifier for the timeout
+   *
+   * Identifiers are never 0.
+   */
+  Id add(const struct timespec &when, Reactor *r);
+
+  /** @brief Cancel a timeout
+   * @param id Identifier returned by @ref add
+   * @return @c true if the timeout was pending
+   */
+  bool cancel(Id id);
+
+  /** @brief Return the number of pending timeouts */
+  size_t size() const {
+    return timers.size();
+  }
+
+  /** @brief Remove an expired timeout
+   * @param now (Monotonic) current time
+   * @return Reactor to notify, or a null pointer if none have expired
+   *
+   * Timeouts are returned in order of expiry, to a resolution of one
+   * millisecond.  A timeout is never returned before it has expired.
+   */
+  Reactor *expire(const struct timespec &now);
+
+  /** @brief Find how long to wait before calling @ref expire again
+   * @param now (Monotonic) current time
+   * @param delay Where to store the delay
+   * @return @c true if there are pending timeouts, otherwise @c false
+   *
+   * The delay may be shorter than the time until the next timeout, if
+   * timeouts need to be moved between levels before then.
+   */
+  bool next(const struct timespec &now, struct timespec &delay);
+
+private:
+  /** @brief Number of bits of the tick used to index each level */
+  static constexpr int BITS = 8;
+
+  /** @brief Number of slots per level */
+  static constexpr int SLOTS = 1 << BITS;
+
+  /** @brief Number of levels */
+  static constexpr int LEVELS = 4;
+
+  /** @brief Pseudo-level for the overflow list */
+  static constexpr int OVERFLOW_LEVEL = LEVELS;
+
+  /** @brief Pseudo-level for expired timeouts */
+  static constexpr int EXPIRED_LEVEL = LEVELS + 1;
+
+  /** @brief A pending timeout */
+  struct Timer {
+    /** @brief Identifier */
+    Id id;
+
+    /** @brief Expiry tick */
+    uint64_t tick;
+
+    /** @brief Reactor to notify */
+    Reactor *reactor;
+
+    /** @brief Level containing this timeout */
+    int level;
+
+    /** @brief Slot containing this timeout */
+    int slot;
+  };
+
+  /** @brief Type of a slot */
+  typedef std::list<Timer> Slot;
+
+  /** @brief Convert a time to a tick, rounding down
+   * @param t (Monotonic) time
+   * @return Tick
+   */
+  static uint64_t tickFloor(const struct timespec &t);
+
+  /** @brief Convert a time to a tick, rounding up
+   * @param t (Monotonic) time
+   * @return Tick
+   */
+  static uint64_t tickCeil(const struct timespec &t);
+
+  /** @brief Return the list for a level and slot */
+  Slot &list(int level, int slot) {
+    if(level == OVERFLOW_LEVEL)
+      return overflow;
+    if(level == EXPIRED_LEVEL)
+      return expired;
+    return wheel[level][slot];
+  }
+
+  /** @brief File a timeout according to its expiry tick
+   * @param from List currently containing the timeout
+   * @param it Timeout
+   */
+  void place(Slot &from, Slot::iterator it);
+
+  /** @brief Record whether a slot is empty
+   * @param level Level
+   * @param slot Slot
+   */
+  void mark(int level, int slot);
+
+  /** @brief Find the next tick at which a slot must be processed
+   * @return Tick, or @c UINT64_MAX if there are none
+   */
+  uint64_t nextTick() const;
+
+  /** @brief Advance the wheel
+   * @param target Tick to advance to
+   */
+  void advance(uint64_t target);
+
+  /** @brief Slots, by level */
+  Slot wheel[LEVELS][SLOTS];
+
+  /** @brief Bitmaps of non-empty slots, by level */
+  uint64_t occupied[LEVELS][SLOTS / 64] = {};
+
+  /** @brief Timeouts beyond the range of the highest level */
+  Slot overflow;
+
+  /** @brief Timeouts that have expired but not yet been returned */
+  Slot expired;
+
+  /** @brief Location of each pending timeout */
+  std::unordered_map<Id, Slot::iterator> timers;
+
+  /** @brief Current tick
+   *
+   * Each level holds only timeouts that agree with this tick in all the
+   * higher levels' bits, and are later than it in their own level's bits.
+   */
+  uint64_t current = 0;
+
+  /** @brief Last identifier issued */
+  Id lastId = 0;
+};
+
+#endif /* TIMERWHEEL_H */
@@ -0,0 +1,305 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "TreeRemover.h"
+#include "Defaults.h"
+#include "Utils.h"
+#include <cerrno>
+#include <cstddef>
+#include <functional>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if HAVE_DECL_SYS_GETDENTS64 || HAVE_DECL_SYS_IOPRIO_SET
+#include <sys/syscall.h>
+#endif
+
+/** @brief Size of buffer for reading directory entries */
+#define DIRENT_BUFFER 32768
+
+void TreeRemover::Job::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  while(!finished)
+    done.wait(guard);
+}
+
+int TreeRemover::Job::getError(std::string &path) const {
+  std::lock_guard<std::mutex> guard(lock);
+  path = errorPath;
+  return error;
+}
+
+void TreeRemover::Job::failed(const std::string &path, int errno_value) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(!error) {
+    error = errno_value;
+    errorPath = path;
+  }
+}
+
+TreeRemover::TreeRemover(size_t nthreads, IOClass ioClass_, int ioLevel_):
+    workers(nthreads), ioClass(ioClass_), ioLevel(ioLevel_) {
+  for(size_t n = 0; n < nthreads; ++n)
+    threads.push_back(std::thread(&TreeRemover::worker, this, n));
+}
+
+TreeRemover::~TreeRemover() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    work.notify_all();
+  }
+  for(auto &t: threads)
+    t.join();
+}
+
+std::shared_ptr<TreeRemover::Job> TreeRemover::remove(const std::string &path,
+                                                      int notifyFD) {
+  auto job = std::make_shared<Job>();
+  job->notifyFD = notifyFD;
+  struct stat sb;
+  if(lstat(path.c_str(), &sb) < 0) {
+    if(errno != ENOENT)
+      job->failed(path, errno);
+    complete(job);
+  } else if(!S_ISDIR(sb.st_mode)) {
+    if(unlink(path.c_str()) < 0) {
+      if(errno != ENOENT)
+        job->failed(path, errno);
+    } else if(sb.st_nlink == 1) {
+      ++job->inodes;
+      job->bytes += sb.st_blocks * 512;
+    }
+    complete(job);
+  } else {
+    Dir *d = new Dir();
+    d->job = job;
+    d->parent = nullptr;
+    d->path = path;
+    size_t w;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      w = next++ % workers.size();
+    }
+    push(w, d);
+  }
+  return job;
+}
+
+void TreeRemover::worker(size_t self) {
+#if HAVE_DECL_SYS_IOPRIO_SET
+  // Who 1 is IOPRIO_WHO_PROCESS; on Linux, 0 then means this thread only
+  if(ioClass != IO_DEFAULT)
+    syscall(SYS_ioprio_set, 1, 0, (int)ioClass << 13 | ioLevel);
+#endif
+  for(;;) {
+    Dir *d = take(self);
+    if(d) {
+      process(self, d);
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    // Outstanding tasks are drained (as cancelled) before stopping
+    while(queued == 0 && !stopping)
+      work.wait(guard);
+    if(queued == 0)
+      return;
+  }
+}
+
+void TreeRemover::push(size_t w, Dir *d) {
+  {
+    std::lock_guard<std::mutex> guard(workers[w].lock);
+    workers[w].tasks.push_back(d);
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  ++queued;
+  work.notify_one();
+}
+
+TreeRemover::Dir *TreeRemover::take(size_t self) {
+  Dir *d = nullptr;
+  // Own tasks first, newest first, so the tree is walked depth-first
+  {
+    Worker &w = workers[self];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if(!w.tasks.empty()) {
+      d = w.tasks.back();
+      w.tasks.pop_back();
+    }
+  }
+  // Otherwise steal the oldest task from some other thread
+  for(size_t n = 1; !d && n < workers.size(); ++n) {
+    Worker &w = workers[(self + n) % workers.size()];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if(!w.tasks.empty()) {
+      d = w.tasks.front();
+      w.tasks.pop_front();
+    }
+  }
+  if(d) {
+    std::lock_guard<std::mutex> guard(lock);
+    --queued;
+  }
+  return d;
+}
+
+// Call a function for each entry in a directory, until it returns false.
+// Returns 0 or an errno value.
+static int readEntries(
+    int fd, const std::function<bool(const char *, unsigned char)> &entry) {
+#if HAVE_DECL_SYS_GETDENTS64
+  // Layout used by getdents64(2)
+  struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  };
+  alignas(linux_dirent64) char buffer[DIRENT_BUFFER];
+  for(;;) {
+    long n = syscall(SYS_getdents64, fd, buffer, sizeof buffer);
+    if(n < 0)
+      return errno;
+    if(n == 0)
+      return 0;
+    for(long pos = 0; pos < n;) {
+      const linux_dirent64 *de = (const linux_dirent64 *)(buffer + pos);
+      pos += de->d_reclen;
+      if(!entry(de->d_name, de->d_type))
+        return 0;
+    }
+  }
+#else
+  int listfd = dup(fd);
+  if(listfd < 0)
+    return errno;
+  DIR *dp = fdopendir(listfd);
+  if(!dp) {
+    int save_errno = errno;
+    close(listfd);
+    return save_errno;
+  }
+  int rc = 0;
+  for(;;) {
+    errno = 0;
+    const struct dirent *de = readdir(dp);
+    if(!de) {
+      rc = errno;
+      break;
+    }
+    if(!entry(de->d_name, de->d_type))
+      break;
+  }
+  closedir(dp);
+  return rc;
+#endif
+}
+
+void TreeRemover::process(size_t self, Dir *d) {
+  Job *job = d->job.get();
+  if(stopping)
+    job->cancel();
+  if(job->cancelled) {
+    release(d);
+    return;
+  }
+  int fd = open(d->path.c_str(),
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if(fd < 0) {
+    if(errno != ENOENT)
+      job->failed(d->path, errno);
+    release(d);
+    return;
+  }
+  struct stat sb;
+  if(fstat(fd, &sb) == 0)
+    job->bytes += sb.st_blocks * 512;
+  int rc = readEntries(fd, [&](const char *name, unsigned char type) {
+    if(stopping)
+      job->cancel();
+    if(job->cancelled)
+      return false;
+    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+      return true;
+    bool isdir = type == DT_DIR;
+    if(type == DT_UNKNOWN) {
+      struct stat esb;
+      isdir = fstatat(fd, name, &esb, AT_SYMLINK_NOFOLLOW) == 0
+              && S_ISDIR(esb.st_mode);
+    }
+    if(isdir) {
+      Dir *sub = new Dir();
+      sub->job = d->job;
+      sub->parent = d;
+      sub->path = d->path + PATH_SEP + name;
+      ++d->pending;
+      push(self, sub);
+    } else
+      removeEntry(d, fd, name);
+    return true;
+  });
+  if(rc)
+    job->failed(d->path, rc);
+  close(fd);
+  release(d);
+}
+
+void TreeRemover::removeEntry(Dir *d, int fd, const char *name) {
+  Job *job = d->job.get();
+  struct stat sb;
+  const bool counted = fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0;
+  if(unlinkat(fd, name, 0) < 0) {
+    if(errno != ENOENT)
+      job->failed(d->path + PATH_SEP + name, errno);
+    return;
+  }
+  // Only the last link frees anything
+  if(counted && sb.st_nlink == 1) {
+    ++job->inodes;
+    job->bytes += sb.st_blocks * 512;
+  }
+}
+
+void TreeRemover::release(Dir *d) {
+  while(d) {
+    if(--d->pending > 0)
+      return;
+    Job *job = d->job.get();
+    if(!job->cancelled) {
+      if(rmdir(d->path.c_str()) == 0)
+        ++job->inodes;
+      else if(errno != ENOENT)
+        job->failed(d->path, errno);
+    }
+    Dir *parent = d->parent;
+    if(!parent)
+      complete(d->job);
+    delete d;
+    d = parent;
+  }
+}
+
+void TreeRemover::complete(const std::shared_ptr<Job> &job) {
+  std::lock_guard<std::mutex> guard(job->lock);
+  job->finished = true;
+  if(job->notifyFD >= 0) {
+    close(job->notifyFD);
+    job->notifyFD = -1;
+  }
+  job->done.notify_all();
+}
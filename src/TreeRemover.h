@@ -0,0 +1,274 @@
+// -*-C++-*-
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef TREEREMOVER_H
+#define TREEREMOVER_H
+/** @file TreeRemover.h
+ * @brief Parallel removal of directory trees
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @brief Remove directory trees using a pool of threads
+ *
+ * Each directory is a separate task.  Listing a directory removes everything
+ * in it except subdirectories, which become new tasks; a directory is removed
+ * once everything below it has gone.  Each thread works depth-first through
+ * its own tasks, and takes the oldest (and therefore usually largest) task
+ * from another thread when it runs out.
+ *
+ * Symbolic links are removed, never followed.  Files and directories that
+ * have already gone are ignored, as with <tt>rm -rf</tt>.
+ *
+ * Threads share the underlying device, so the intention is to have one
+ * remover per device.
+ */
+class TreeRemover {
+public:
+  /** @brief One tree being removed */
+  class Job {
+  public:
+    /** @brief Stop removing the tree
+     *
+     * Tasks already started finish the directory they are listing.  The job
+     * completes (unsuccessfully) once no tasks remain.
+     */
+    void cancel() {
+      cancelled = true;
+    }
+
+    /** @brief Return @c true if the job was cancelled */
+    bool wasCancelled() const {
+      return cancelled;
+    }
+
+    /** @brief Wait for the job to complete */
+    void wait();
+
+    /** @brief Return the number of inodes freed so far
+     *
+     * Files that still have other links are not counted.
+     */
+    uint64_t getInodes() const {
+      return inodes;
+    }
+
+    /** @brief Return the number of bytes freed so far
+     *
+     * Files that still have other links are not counted.
+     */
+    uint64_t getBytes() const {
+      return bytes;
+    }
+
+    /** @brief Return the first error encountered
+     * @param path Where to store the path that could not be removed
+     * @return @c errno value, or 0 if there were no errors
+     *
+     * Only meaningful once the job has completed.
+     */
+    int getError(std::string &path) const;
+
+  private:
+    friend class TreeRemover;
+
+    /** @brief Record an error
+     * @param path Path that could not be removed
+     * @param errno_value @c errno value
+     */
+    void failed(const std::string &path, int errno_value);
+
+    /** @brief Set to stop the job */
+    std::atomic<bool> cancelled{false};
+
+    /** @brief Inodes freed */
+    std::atomic<uint64_t> inodes{0};
+
+    /** @brief Bytes freed */
+    std::atomic<uint64_t> bytes{0};
+
+    /** @brief Protects everything below */
+    mutable std::mutex lock;
+
+    /** @brief Signaled when the job completes */
+    std::condition_variable done;
+
+    /** @brief Set when the job completes */
+    bool finished = false;
+
+    /** @brief First error, or 0 */
+    int error = 0;
+
+    /** @brief Path associated with @ref error */
+    std::string errorPath;
+
+    /** @brief File descriptor to close on completion, or -1 */
+    int notifyFD = -1;
+  };
+
+  /** @brief I/O scheduling classes
+   *
+   * The values match Linux's @c IOPRIO_CLASS_... constants.
+   */
+  enum IOClass {
+    /** @brief Leave the I/O priority alone */
+    IO_DEFAULT = 0,
+
+    /** @brief Best-effort scheduling at a given level */
+    IO_BEST_EFFORT = 2,
+
+    /** @brief Only use the device when nothing else wants it */
+    IO_IDLE = 3,
+  };
+
+  /** @brief Constructor
+   * @param threads Number of threads
+   * @param ioClass I/O scheduling class for the threads
+   * @param ioLevel I/O priority level within @p ioClass, from 0 (highest) to 7
+   *
+   * The I/O priority is only set where the platform supports it (i.e. on
+   * Linux) and failure to set it is ignored.
+   */
+  TreeRemover(size_t threads, IOClass ioClass = IO_DEFAULT, int ioLevel = 0);
+
+  TreeRemover(const TreeRemover &) = delete;
+  TreeRemover &operator=(const TreeRemover &) = delete;
+
+  /** @brief Destructor
+   *
+   * Cancels outstanding jobs, waits for them to complete and stops the
+   * threads.
+   */
+  ~TreeRemover();
+
+  /** @brief Start removing a tree
+   * @param path Tree to remove
+   * @param notifyFD File descriptor to close on completion, or -1
+   * @return Job
+   *
+   * If @p notifyFD is not -1, it is owned by the remover, and is closed when
+   * the job completes.  If it is the write end of a pipe, the read end will
+   * see end of file.
+   */
+  std::shared_ptr<Job> remove(const std::string &path, int notifyFD = -1);
+
+private:
+  /** @brief A directory to be listed and removed */
+  struct Dir {
+    /** @brief Job this directory belongs to */
+    std::shared_ptr<Job> job;
+
+    /** @brief Containing directory, or a null pointer for the root */
+    Dir *parent;
+
+    /** @brief Path to directory */
+    std::string path;
+
+    /** @brief Number of subdirectories still present, plus one until the
+     * directory has been listed */
+    std::atomic<size_t> pending{1};
+  };
+
+  /** @brief Tasks belonging to one thread */
+  struct Worker {
+    /** @brief Protects @ref tasks */
+    std::mutex lock;
+
+    /** @brief Directories to process
+     *
+     * The owner takes from the back, other threads from the front.
+     */
+    std::deque<Dir *> tasks;
+  };
+
+  /** @brief Thread body
+   * @param self Index of this thread's @ref Worker
+   */
+  void worker(size_t self);
+
+  /** @brief Queue a task
+   * @param w Worker to queue it on
+   * @param d Directory
+   */
+  void push(size_t w, Dir *d);
+
+  /** @brief Find a task
+   * @param self Index of calling thread's @ref Worker
+   * @return Directory, or a null pointer if there are no tasks
+   */
+  Dir *take(size_t self);
+
+  /** @brief List a directory, removing everything except subdirectories
+   * @param self Index of calling thread's @ref Worker
+   * @param d Directory
+   */
+  void process(size_t self, Dir *d);
+
+  /** @brief Remove a directory entry that is not a directory
+   * @param d Containing directory
+   * @param fd File descriptor for @p d
+   * @param name Name of entry
+   */
+  void removeEntry(Dir *d, int fd, const char *name);
+
+  /** @brief Note that a directory has one less thing in it
+   * @param d Directory
+   *
+   * When nothing remains, the directory is removed, and so on up the tree.
+   */
+  void release(Dir *d);
+
+  /** @brief Complete a job
+   * @param job Job
+   */
+  static void complete(const std::shared_ptr<Job> &job);
+
+  /** @brief Per-thread task lists */
+  std::vector<Worker> workers;
+
+  /** @brief Threads */
+  std::vector<std::thread> threads;
+
+  /** @brief Protects everything below */
+  std::mutex lock;
+
+  /** @brief Signaled when there are tasks or when threads should stop */
+  std::condition_variable work;
+
+  /** @brief Number of queued tasks */
+  size_t queued = 0;
+
+  /** @brief Worker to give the next new job to */
+  size_t next = 0;
+
+  /** @brief Set to cancel outstanding jobs and stop the threads */
+  std::atomic<bool> stopping{false};
+
+  /** @brief I/O scheduling class for the threads */
+  IOClass ioClass;
+
+  /** @brief I/O priority level within @ref ioClass */
+  int ioLevel;
+};
+
+#endif /* TREEREMOVER_H */
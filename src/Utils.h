@@ -65,6 +65,15 @@ void progressBar(IO &stream, const char *prompt, size_t done, size_t total);
  */
 size_t toLines(std::vector<std::string> &lines, const std::string &s);
 
+/** @brief Quote a string for use in a shell command
+ * @param s String to quote
+ * @return @p s, quoted if necessary
+ *
+ * The result is suitable for use as a single word in a POSIX shell command
+ * line.
+ */
+std::string shellQuote(const std::string &s);
+
 /** @brief Expand a filename glob pattern
  * @param files List of filenames
  * @param pattern Pattern
@@ -20,11 +20,15 @@
 #include "Host.h"
 #include "Subprocess.h"
 #include "Utils.h"
+#include "Errors.h"
 #include "Store.h"
 #include "BackupPolicy.h"
 #include <cstdio>
 #include <ostream>
 #include <fnmatch.h>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/range/adaptor/reversed.hpp>
 
 Volume::Volume(Host *parent_, const std::string &name_,
                const std::string &path_):
@@ -46,8 +50,21 @@ bool Volume::valid(const std::string &name) {
          && name.find_first_not_of(VOLUME_VALID) == std::string::npos;
 }
 
-void Volume::calculate() {
+/** @brief Calculate statistics for a collection of backups
+ * @param backups Backups to summarize
+ * @param completed Number of complete backups
+ * @param oldest Time of oldest complete backup
+ * @param newest Time of newest complete backup
+ * @param perDevice Per-device information
+ *
+ * @p perDevice will not contain any entries with @ref Volume::PerDevice::count
+ * equal to 0.
+ */
+static void calculateTotals(const backups_type &backups, int &completed,
+                            time_t &oldest, time_t &newest,
+                            Volume::perdevice_type &perDevice) {
   completed = 0;
+  oldest = newest = 0;
   for(auto &pd: perDevice)
     pd.second.count = 0;
   for(const Backup *backup: backups) {
@@ -80,25 +97,127 @@ void Volume::calculate() {
   }
 }
 
+void Volume::addTotals(const Backup *backup) {
+  if(backup->getStatus() != COMPLETE)
+    return;
+  auto it = backups.find(const_cast<Backup *>(backup));
+  if(it == backups.end() || *it != backup)
+    return;
+  // Global figures
+  ++completed;
+  if(completed == 1 || backup->time < oldest)
+    oldest = backup->time;
+  if(completed == 1 || backup->time > newest)
+    newest = backup->time;
+  // Per-device figures
+  Volume::PerDevice &pd = perDevice[backup->deviceName];
+  ++pd.count;
+  if(pd.count == 1 || backup->time < pd.oldest)
+    pd.oldest = backup->time;
+  if(pd.count == 1 || backup->time > pd.newest) {
+    pd.newest = backup->time;
+    pd.size = backup->getSize();
+  }
+}
+
+void Volume::removeTotals(const Backup *backup) {
+  if(backup->getStatus() != COMPLETE)
+    return;
+  auto it = backups.find(const_cast<Backup *>(backup));
+  if(it == backups.end() || *it != backup)
+    return;
+  const time_t t = backup->time;
+  // Global figures
+  if(--completed == 0)
+    oldest = newest = 0;
+  else {
+    // Backups are ordered by time, so the replacement for the oldest or
+    // newest complete backup is found by searching outwards from this one,
+    // starting from the first or last backup with the same time.
+    if(t == oldest) {
+      auto first = it;
+      while(first != backups.begin() && (*std::prev(first))->time == t)
+        --first;
+      for(auto jt = first; jt != backups.end(); ++jt) {
+        if(jt != it && (*jt)->getStatus() == COMPLETE) {
+          oldest = (*jt)->time;
+          break;
+        }
+      }
+    }
+    if(t == newest) {
+      auto last = std::next(it);
+      while(last != backups.end() && (*last)->time == t)
+        ++last;
+      for(auto jt = last; jt != backups.begin();) {
+        --jt;
+        if(jt != it && (*jt)->getStatus() == COMPLETE) {
+          newest = (*jt)->time;
+          break;
+        }
+      }
+    }
+  }
+  // Per-device figures.  There is only one backup per device at any given
+  // time, so there are no ties to worry about.
+  auto pdit = perDevice.find(backup->deviceName);
+  Volume::PerDevice &pd = pdit->second;
+  if(--pd.count == 0) {
+    perDevice.erase(pdit);
+    return;
+  }
+  if(t == pd.oldest) {
+    for(auto jt = std::next(it); jt != backups.end(); ++jt) {
+      if((*jt)->deviceName == backup->deviceName
+         && (*jt)->getStatus() == COMPLETE) {
+        pd.oldest = (*jt)->time;
+        break;
+      }
+    }
+  }
+  if(t == pd.newest) {
+    for(auto jt = it; jt != backups.begin();) {
+      --jt;
+      if((*jt)->deviceName == backup->deviceName
+         && (*jt)->getStatus() == COMPLETE) {
+        pd.newest = (*jt)->time;
+        pd.size = (*jt)->getSize();
+        break;
+      }
+    }
+  }
+}
+
+void Volume::checkTotals() const {
+  if(!globalDebug)
+    return;
+  int c;
+  time_t o, n;
+  perdevice_type pd;
+  calculateTotals(backups, c, o, n, pd);
+  if(c != completed || o != oldest || n != newest || pd != perDevice)
+    throw std::logic_error("Volume::checkTotals: inconsistent totals for "
+                           + parent->name + ":" + name);
+}
+
 bool Volume::addBackup(Backup *backup) {
   bool inserted = backups.insert(backup).second;
-  if(inserted)
-    calculate();
+  if(inserted) {
+    addTotals(backup);
+    checkTotals();
+  }
   return inserted;
 }
 
 bool Volume::removeBackup(const Backup *backup) {
-  for(auto it = backups.begin(); it != backups.end(); ++it) {
-    Backup *s = *it;
-    if(s == backup) {
-      backups.erase(it);
-      delete s;
-      // Recalculate totals
-      calculate();
-      return true;
-    }
-  }
-  return false;
+  auto it = backups.find(const_cast<Backup *>(backup));
+  if(it == backups.end() || *it != backup)
+    return false;
+  removeTotals(backup);
+  backups.erase(it);
+  delete backup;
+  checkTotals();
+  return true;
 }
 
 const Backup *Volume::mostRecentBackup(const Device *device) const {
@@ -114,6 +233,28 @@ const Backup *Volume::mostRecentBackup(const Device *device) const {
   return result;
 }
 
+time_t Volume::estimateDuration(const Device *device) const {
+  std::vector<time_t> times;
+  for(const Backup *backup: boost::adaptors::reverse(backups)) {
+    if(times.size() >= DURATION_ESTIMATE_BACKUPS)
+      break;
+    if(backup->getStatus() != COMPLETE || backup->finishTime < backup->time)
+      continue;
+    if(device && backup->deviceName != device->name)
+      continue;
+    times.push_back(backup->finishTime - backup->time);
+  }
+  size_t ntimes = times.size();
+  if(ntimes == 0)
+    return device ? estimateDuration(nullptr) : 0;
+  std::sort(times.begin(), times.end());
+  // If there is no true median then average the two middle values
+  if(ntimes & 1)
+    return times[ntimes / 2];
+  else
+    return (times[ntimes / 2 - 1] + times[ntimes / 2]) / 2;
+}
+
 const Backup *Volume::mostRecentFailedBackup(const Device *device) const {
   const Backup *result = nullptr;
   for(const Backup *backup: backups) {
@@ -135,41 +276,63 @@ const Backup *Volume::mostRecentFailedBackup(const Device *device) const {
 }
 
 bool Volume::available() const {
+  if(!checkMounted && !checkFile.size())
+    return true;
+  // The pre-volume-hook may change the path, so only reuse the answer if it
+  // hasn't.
+  if(availabilityKnown && availabilityPath == path)
+    return availabilityCache;
+  availabilityCache = probe();
+  availabilityPath = path;
+  availabilityKnown = true;
+  return availabilityCache;
+}
+
+bool Volume::probe() const {
+  // Do all the checks with a single remote command.  The output is:
+  //   os OS
+  //   dev DEVICE DEVICE         (if checkMounted)
+  //   check yes|no              (if checkFile)
+  std::string script = "os=`uname -s`; echo os $os";
   if(checkMounted) {
-    std::string os, stats;
-    std::string parent_directory = path + "/..";
-    const char *option;
     // Guess which version of stat to use based on uname.
-    if(parent->invoke(&os, "uname", "-s", (const char *)nullptr) != 0)
-      return false;
-    if(os == "Darwin"
-       || (os.size() >= 3 && os.compare(os.size() - 3, 3, "BSD") == 0)) {
-      option = "-f";
-    } else {
-      // For everything else assume coreutils stat(1)
-      option = "-c";
-    }
-    // Get the device numbers for path and its parent
-    if(parent->invoke(&stats, "stat", option, "%d", path.c_str(),
-                      parent_directory.c_str(), (const char *)nullptr))
-      return false;
-    // Split output into lines
-    std::vector<std::string> lines;
-    toLines(lines, stats);
-    // If stats is malformed, or if device numbers match (implying path is not
-    // a mount point), volume is not available.
-    if(lines.size() != 2 || lines[0].size() == 0 || lines[1].size() == 0
-       || lines[0] == lines[1])
-      return false;
+    // For everything else assume coreutils stat(1)
+    script += "; case \"$os\" in Darwin | *BSD ) o=-f;; * ) o=-c;; esac"
+              "; echo dev `stat $o %d "
+              + shellQuote(path) + " " + shellQuote(path + "/..") + "`";
   }
   if(checkFile.size()) {
     std::string file =
         (checkFile[0] == '/' ? checkFile : path + "/" + checkFile);
-    if(parent->invoke(nullptr, "test", "-e", file.c_str(),
-                      (const char *)nullptr)
-       != 0)
+    script += "; if test -e " + shellQuote(file)
+              + "; then echo check yes; else echo check no; fi";
+  }
+  std::string output;
+  try {
+    if(parent->invokeScript(&output, script) != 0)
       return false;
+  } catch(SubprocessFailed &) {
+    return false;
+  }
+  // Split output into lines
+  std::vector<std::string> lines, bits;
+  toLines(lines, output);
+  bool mounted = false, checked = false;
+  for(auto &line: lines) {
+    split(bits, line);
+    if(bits.size() == 0)
+      continue;
+    // If device numbers match (implying path is not a mount point), volume is
+    // not available.
+    if(bits[0] == "dev")
+      mounted = bits.size() == 3 && bits[1] != bits[2];
+    else if(bits[0] == "check")
+      checked = bits.size() == 2 && bits[1] == "yes";
   }
+  if(checkMounted && !mounted)
+    return false;
+  if(checkFile.size() && !checked)
+    return false;
   return true;
 }
 
@@ -19,11 +19,14 @@
  * @brief Configuration and state of a volume
  */
 
+#include <memory>
 #include <set>
 #include "ConfBase.h"
 #include "Date.h"
 #include "Backup.h"
 #include "Selection.h"
+#include "BackupPolicy.h"
+#include "PrunePolicy.h"
 
 class Host;
 class Device;
@@ -82,6 +85,18 @@ public:
   /** @brief Check that root path is a mount point before backing up */
   bool checkMounted = false;
 
+  /** @brief Backup policy parameters, converted by the backup policy
+   *
+   * Set by @ref Conf::validate.
+   */
+  std::unique_ptr<const BackupParameters> backupPolicyParameters;
+
+  /** @brief Pruning policy parameters, converted by the pruning policy
+   *
+   * Set by @ref Conf::validate.
+   */
+  std::unique_ptr<const PruneParameters> prunePolicyParameters;
+
   /** @brief Return true if volume is selected */
   bool selected(SelectionPurpose purpose) const {
     return isSelected[purpose];
@@ -100,6 +115,9 @@ public:
 
   /** @brief Test if volume available
    * @return true if volume is available
+   *
+   * The answer is remembered for the rest of the run, unless @ref path
+   * changes.
    */
   bool available() const;
 
@@ -119,6 +137,15 @@ public:
 
     /** @brief Size of newest backup on device, or -1 if unknown */
     long long size;
+
+    /** @brief Compare per-device information
+     * @param that Other per-device information
+     * @return @c true if identical
+     */
+    bool operator==(const PerDevice &that) const {
+      return count == that.count && oldest == that.oldest
+             && newest == that.newest && size == that.size;
+    }
   };
 
   /** @brief Number of completed backups */
@@ -164,6 +191,16 @@ public:
    */
   const Backup *mostRecentFailedBackup(const Device *device = nullptr) const;
 
+  /** @brief Estimate how long a backup of this volume will take
+   * @param device If not null pointer, estimate for this device
+   * @return Estimated duration in seconds, or 0 if there is no history
+   *
+   * The estimate is the median duration of the most recent @ref
+   * DURATION_ESTIMATE_BACKUPS complete backups.  If there are none on @p
+   * device then backups on any device are used.
+   */
+  time_t estimateDuration(const Device *device = nullptr) const;
+
   /** @brief Identify whether this volume needs backing up on a particular
    * device
    * @param device Target device
@@ -181,19 +218,50 @@ private:
   /** @brief Set to @c true if this volume is selected */
   bool isSelected[PurposeMax] = {false};
 
-  /** @brief Recalculate statistics
+  /** @brief Check whether the volume is available, ignoring any cached result
+   * @return true if volume is available
+   */
+  bool probe() const;
+
+  /** @brief Set once @ref availabilityCache is valid */
+  mutable bool availabilityKnown = false;
+
+  /** @brief Cached result of @ref available */
+  mutable bool availabilityCache = false;
+
+  /** @brief Value of @ref path when @ref availabilityCache was set */
+  mutable std::string availabilityPath;
+
+  /** @brief Update statistics for a backup becoming visible
+   * @param backup Backup that has been added or become complete
+   *
+   * Does nothing if @p backup is not a complete member of @ref backups.
+   */
+  void addTotals(const Backup *backup);
+
+  /** @brief Update statistics for a backup ceasing to be visible
+   * @param backup Backup about to be removed or stop being complete
+   *
+   * Does nothing if @p backup is not a complete member of @ref backups.
+   * Must be called while @p backup is still complete and still in @ref
+   * backups.
+   */
+  void removeTotals(const Backup *backup);
+
+  /** @brief Check the incrementally maintained statistics
+   * @throws std::logic_error if they disagree with a full recalculation
    *
-   * After calling this method the following members will accurately reflect
-   * the contents of the @ref backups container:
+   * The following members are maintained incrementally by @ref addTotals and
+   * @ref removeTotals, as backups are added, removed and change status:
    * - @ref completed
    * - @ref oldest
    * - @ref newest
    * - @ref perDevice
    *
-   * @ref perDevice will not contain any entries with @ref PerDevice::count
-   * equal to 0.
+   * This method recalculates them from scratch and compares.  Since that is
+   * expensive, it only does anything if @ref globalDebug is set.
    */
-  void calculate();
+  void checkTotals() const;
 
   friend void Backup::setStatus(int);
 };
@@ -0,0 +1,106 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Utils.h"
+#include "EventLoop.h"
+#include "Action.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <sys/resource.h>
+
+// Benchmark for ActionList scheduling
+//
+// The actions mimic a large prune: a removal action and a cleanup action for
+// each backup, sharing a per-device resource with a few slots, plus a
+// per-device action that follows all of that device's cleanups via a glob
+// pattern.  Removals complete from the event loop, so most of them spend time
+// waiting for their device; everything else completes immediately.  The time
+// measured is all scheduling overhead.
+
+class BenchAction: public Action, public Reactor {
+public:
+  BenchAction(const std::string &n, bool async = false):
+      Action(n), async(async) {}
+
+  void go(EventLoop *e, ActionList *al) override {
+    this->al = al;
+    if(async) {
+      struct timespec now;
+      getMonotonicTime(now);
+      e->whenTimeout(now, this);
+    } else
+      onTimeout(e, {0, 0});
+  }
+
+  void onTimeout(EventLoop *, const struct timespec &) override {
+    ++completed;
+    al->completed(this, true);
+  }
+
+  bool async;
+  ActionList *al = nullptr;
+  static size_t completed;
+};
+
+size_t BenchAction::completed;
+
+static double cpuTime() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+         + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv) {
+  const size_t nactions = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  const int ndevices = 8, slots = 4;
+  EventLoop e;
+  ActionList al(&e);
+  std::vector<std::unique_ptr<BenchAction>> actions;
+  auto add = [&](const std::string &name, const std::string &device,
+                 bool async = false) -> BenchAction * {
+    actions.emplace_back(new BenchAction(name, async));
+    BenchAction *a = actions.back().get();
+    a->uses(device);
+    al.add(a);
+    return a;
+  };
+  const double start = cpuTime();
+  for(int d = 0; d < ndevices; ++d) {
+    const std::string device = "device" + std::to_string(d);
+    al.setCapacity(device, slots);
+    add("report/" + device, device)
+        ->after("removed/" + device + "/*", ACTION_SUCCEEDED | ACTION_GLOB);
+  }
+  for(size_t n = 0; actions.size() + 2 <= nactions; ++n) {
+    const std::string device = "device" + std::to_string(n % ndevices);
+    const std::string id = device + "/" + std::to_string(n);
+    BenchAction *remove = add("remove/" + id, device, true);
+    remove->set_priority(n % 3);
+    add("removed/" + id, device)->after(remove->get_name(), 0);
+  }
+  const double built = cpuTime();
+  al.go(true);
+  const double finished = cpuTime();
+  printf("%zu actions: %.3fs to build, %.3fs to schedule\n", actions.size(),
+         built - start, finished - built);
+  if(BenchAction::completed != actions.size()) {
+    fprintf(stderr, "only %zu actions completed\n", BenchAction::completed);
+    return 1;
+  }
+  return 0;
+}
@@ -72,8 +72,9 @@ int main(int argc, char **argv) {
     // Take the lock, if one is defined.
     FileLock lockFile(globalConfig.lock);
     if((globalCommand.backup || globalCommand.prune
-        || globalCommand.pruneIncomplete || globalCommand.retireDevice
-        || globalCommand.retire)
+        || globalCommand.pruneIncomplete || globalCommand.reclaim
+        || globalCommand.retireDevice || globalCommand.retire
+        || globalCommand.compactLogs)
        && globalConfig.lock.size()) {
       D("attempting to acquire lockfile %s", globalConfig.lock.c_str());
       if(!lockFile.acquire(globalCommand.wait)) {
@@ -99,12 +100,19 @@ int main(int argc, char **argv) {
       retireDevices();
     if(globalCommand.prune || globalCommand.pruneIncomplete)
       pruneBackups();
+    if(globalCommand.reclaim)
+      reclaimTrash();
     if(globalCommand.prune)
       prunePruneLogs();
     if(globalCommand.checkUnexpected)
       checkUnexpected();
     if(globalCommand.latest)
       findLatest();
+    if(globalCommand.compactLogs)
+      compactLogs();
+
+    // Wait for database updates to be committed
+    globalConfig.syncDatabase();
 
     // Run post-device hook
     postDeviceAccess();
@@ -37,6 +37,9 @@ void retireDevices();
 /** @brief Prune backups */
 void pruneBackups();
 
+/** @brief Remove pruned backups from the trash directories of devices */
+void reclaimTrash();
+
 /** @brief Prune redundant logs */
 void prunePruneLogs();
 
@@ -46,6 +49,9 @@ void checkUnexpected();
 /** @brief Find latest backups */
 void findLatest();
 
+/** @brief Compress uncompressed logs in the database */
+void compactLogs();
+
 /** @brief HTML stylesheet */
 extern char stylesheet[];
 
@@ -0,0 +1,34 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Defaults.h"
+#include "Utils.h"
+
+std::string shellQuote(const std::string &s) {
+  // Leave strings that are obviously safe alone
+  if(s.size()
+     && s.find_first_not_of(ALPHA DIGIT "-_./,:=+@%") == std::string::npos)
+    return s;
+  std::string q = "'";
+  for(char c: s) {
+    if(c == '\'')
+      q += "'\\''";
+    else
+      q += c;
+  }
+  q += "'";
+  return q;
+}
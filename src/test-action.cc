@@ -17,7 +17,9 @@
 #include "EventLoop.h"
 #include "Action.h"
 #include "Subprocess.h"
+#include <algorithm>
 #include <signal.h>
+#include <stdexcept>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -115,6 +117,43 @@ static void test_action_resources() {
   assert(!a3.acting);
 }
 
+class CountedAction: public SlowAction {
+public:
+  CountedAction(const std::string &n): SlowAction(n) {}
+
+  void go(EventLoop *e, ActionList *al) override {
+    peak = std::max(++concurrent, peak);
+    SlowAction::go(e, al);
+  }
+
+  void onTimeout(EventLoop *e, const struct timespec &now) override {
+    --concurrent;
+    SlowAction::onTimeout(e, now);
+  }
+
+  static int concurrent, peak;
+};
+
+int CountedAction::concurrent, CountedAction::peak;
+
+static void test_action_capacity() {
+  CountedAction a1("a1"), a2("a2"), a3("a3"), a4("a4"), a5("a5");
+  CountedAction *all[] = {&a1, &a2, &a3, &a4, &a5};
+  EventLoop e;
+  ActionList al(&e);
+  al.setCapacity("r1", 2);
+  for(auto a: all) {
+    a->uses("r1");
+    al.add(a);
+  }
+  al.go(true);
+  for(auto a: all) {
+    assert(a->acted);
+    assert(!a->acting);
+  }
+  assert(CountedAction::peak == 2);
+}
+
 static void test_action_dependencies() {
   SlowAction a1("a1"), a2("a2"), a3("a3");
   EventLoop e;
@@ -305,15 +344,73 @@ static void test_action_timelimit(void) {
   assert(a.acted == 0);
 }
 
+static void test_action_timelimit_waiting(void) {
+  EventLoop e;
+  ActionList al(&e);
+  struct timespec limit;
+  SlowAction a1("a1");
+  {
+    // a2 waits for a1 to release r, by which time the limit has passed
+    SlowAction a2("a2");
+    getMonotonicTime(limit);
+    limit.tv_nsec += 1000000 * 50;
+    if(limit.tv_nsec >= 1000000000) {
+      limit.tv_nsec -= 1000000000;
+      ++limit.tv_sec;
+    }
+    al.setLimit(limit);
+    a1.uses("r");
+    a2.uses("r");
+    al.add(&a1);
+    al.add(&a2);
+    al.go(true);
+    assert(a1.acted);
+    assert(!a2.acted);
+  }
+  // Nothing refers to a2 any more
+  limit = {0, 0};
+  al.setLimit(limit);
+  SlowAction b("b");
+  b.uses("r");
+  al.add(&b);
+  al.go(true);
+  assert(b.acted);
+}
+
+static void test_action_cycle() {
+  EventLoop e;
+  ActionList al(&e);
+  SimpleAction a("a"), b("b"), c("c");
+  a.after("c", 0);
+  b.after("a", 0);
+  c.after("b", 0);
+  al.add(&a);
+  al.add(&b);
+  al.add(&c);
+  bool thrown = false;
+  try {
+    al.go();
+  } catch(std::logic_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+  assert(!a.acted);
+  assert(!b.acted);
+  assert(!c.acted);
+}
+
 int main() {
   // debug = true;
   test_action_simple();
   test_action_resources();
+  test_action_capacity();
   test_action_dependencies();
   test_action_status();
   test_action_glob();
   test_action_glob_status();
   test_action_priority();
   test_action_timelimit();
+  test_action_timelimit_waiting();
+  test_action_cycle();
   return 0;
 }
@@ -70,6 +70,21 @@ static void test_action_prune_incomplete(void) {
   assert(c.pruneIncomplete == true);
 }
 
+static void test_action_reclaim(void) {
+  static const char *argv[] = {"rsbackup", "--reclaim", "VOLUME", nullptr};
+  Command c;
+  assert(c.reclaim == false);
+  c.parse(2, argv);
+  assert(c.reclaim == true);
+
+  Command d;
+  try {
+    d.parse(3, argv);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+  }
+}
+
 static void test_action_retire(void) {
   static const char *argv[] = {"rsbackup", "--retire", "VOLUME", nullptr};
   Command c;
@@ -244,6 +259,7 @@ int main() {
   test_action_email();
   test_action_prune();
   test_action_prune_incomplete();
+  test_action_reclaim();
   test_action_retire();
   test_action_retire_device();
   test_action_dump_config();
@@ -15,7 +15,10 @@
 #include <config.h>
 #include "Utils.h"
 #include "Database.h"
+#include "Defaults.h"
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <unistd.h>
 
 #define DBPATH "test.db"
@@ -23,7 +26,7 @@
 static void test_create() {
   Database d(DBPATH);
   assert(!d.hasTable("t"));
-  d.execute("CREATE TABLE t (i INT PRIMARY KEY, s TEXT)");
+  d.execute("CREATE TABLE t (i INT PRIMARY KEY, s TEXT, f REAL)");
   assert(d.hasTable("t"));
 }
 
@@ -33,8 +36,9 @@ static void test_populate() {
   Database::Statement(d, "INSERT INTO t (i, s) VALUES (?, ?)", SQL_INT, 0,
                       SQL_CSTRING, "zero", SQL_END)
       .next();
-  Database::Statement(d, "INSERT INTO t (i, s) VALUES (?, ?)", SQL_INT64,
-                      (sqlite_int64)1, SQL_CSTRING, "one", SQL_END)
+  Database::Statement(d, "INSERT INTO t (i, s, f) VALUES (?, ?, ?)",
+                      SQL_INT64, (sqlite_int64)1, SQL_CSTRING, "one",
+                      SQL_DOUBLE, 1.5, SQL_END)
       .next();
   d.commit();
 }
@@ -65,6 +69,80 @@ static void test_retrieve() {
     assert(n == 0);
     assert(!s.next());
   }
+  {
+    Database::Statement s(d);
+    s.prepare("SELECT f FROM t WHERE i = ?", SQL_INT, 1, SQL_END);
+    assert(s.next());
+    double f = s.get_double(0);
+    assert(f == 1.5);
+    assert(!s.next());
+  }
+}
+
+static void test_cache() {
+  Database d(DBPATH);
+  const size_t before = d.getStatementsPrepared();
+  for(int n = 0; n < 10; ++n) {
+    Database::Statement s(d, "SELECT s FROM t WHERE i = ?", SQL_INT, 0,
+                          SQL_END);
+    assert(s.next());
+    assert(s.get_string(0) == "zero");
+  }
+  // Only the first use prepares the statement
+  assert(d.getStatementsPrepared() == before + 1);
+  // Concurrent uses of the same command get separate statements
+  {
+    Database::Statement s1(d, "SELECT s FROM t WHERE i = ?", SQL_INT, 0,
+                           SQL_END);
+    Database::Statement s2(d, "SELECT s FROM t WHERE i = ?", SQL_INT, 1,
+                           SQL_END);
+    assert(s1.next());
+    assert(s2.next());
+    assert(s1.get_string(0) == "zero");
+    assert(s2.get_string(0) == "one");
+  }
+  assert(d.getStatementsPrepared() == before + 2);
+  // Least recently used statements are evicted
+  d.setStatementCacheSize(1);
+  Database::Statement(d, "SELECT i FROM t WHERE s = ?", SQL_CSTRING, "one",
+                      SQL_END)
+      .next();
+  Database::Statement(d, "SELECT s FROM t WHERE i = ?", SQL_INT, 0, SQL_END)
+      .next();
+  assert(d.getStatementsPrepared() == before + 4);
+}
+
+// Insert and then update many rows, with and without the statement cache
+static double benchmark(size_t cacheSize) {
+  const int rows = 20000;
+  Database d(DBPATH);
+  d.setStatementCacheSize(cacheSize);
+  d.execute("DELETE FROM b");
+  auto start = std::chrono::steady_clock::now();
+  d.begin();
+  for(int i = 0; i < rows; ++i)
+    Database::Statement(d, "INSERT INTO b (i, s) VALUES (?, ?)", SQL_INT, i,
+                        SQL_CSTRING, "insert", SQL_END)
+        .next();
+  for(int i = 0; i < rows; ++i)
+    Database::Statement(d, "UPDATE b SET s=? WHERE i=?", SQL_CSTRING, "update",
+                        SQL_INT, i, SQL_END)
+        .next();
+  d.commit();
+  auto finish = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(finish - start).count();
+  printf("statement cache %zu: %d inserts and updates in %.3fs (%.0f/s)\n",
+         cacheSize, rows, elapsed, 2 * rows / elapsed);
+  return elapsed;
+}
+
+static void test_benchmark() {
+  {
+    Database d(DBPATH);
+    d.execute("CREATE TABLE b (i INT PRIMARY KEY, s TEXT)");
+  }
+  benchmark(0);
+  benchmark(DEFAULT_STATEMENT_CACHE_SIZE);
 }
 
 int main() {
@@ -72,6 +150,8 @@ int main() {
   test_create();
   test_populate();
   test_retrieve();
+  test_cache();
+  test_benchmark();
   unlink(DBPATH);
   return 0;
 }
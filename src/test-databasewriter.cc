@@ -0,0 +1,216 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Utils.h"
+#include "Database.h"
+#include "DatabaseWriter.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <unistd.h>
+
+#define DBPATH "test-databasewriter.db"
+
+static int count(Database &d) {
+  Database::Statement s(d, "SELECT COUNT(*) FROM t", SQL_END);
+  assert(s.next());
+  return s.get_int(0);
+}
+
+static void insert(Database &d, int i) {
+  Database::Statement(d, "INSERT INTO t (i) VALUES (?)", SQL_INT, i, SQL_END)
+      .next();
+}
+
+// Jobs that accumulate while a commit is in progress share the next one
+static void test_group_commit() {
+  Database d(DBPATH);
+  Database reader(DBPATH, false);
+  {
+    DatabaseWriter w(d);
+    std::atomic<bool> started(false);
+    w.submit([&started](Database &db) {
+      started = true;
+      insert(db, 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    });
+    // Wait for the writer to pick up the first job
+    while(!started)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    for(int i = 1; i < 100; ++i)
+      w.submit([i](Database &db) { insert(db, i); });
+    w.sync();
+    assert(count(reader) == 100);
+    assert(w.getCommits() == 2);
+  }
+}
+
+// A failing job doesn't take the rest of its batch with it
+static void test_errors() {
+  Database d(DBPATH);
+  Database reader(DBPATH, false);
+  DatabaseWriter w(d);
+  w.submit([](Database &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  });
+  w.submit([](Database &db) { insert(db, 100); });
+  bool failed = false;
+  try {
+    // Duplicate primary key
+    w.execute([](Database &db) { insert(db, 0); });
+  } catch(DatabaseError &) {
+    failed = true;
+  }
+  assert(failed);
+  w.sync();
+  assert(count(reader) == 101);
+}
+
+// Failures of submitted jobs are reported by the next caller, not the writer
+static void test_error_reporting() {
+  Database d(DBPATH);
+  DatabaseWriter w(d);
+  const int errors = globalErrors;
+  // Duplicate primary key
+  w.submit([](Database &db) { insert(db, 0); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  assert(globalErrors == errors);
+  w.sync();
+  assert(globalErrors == errors + 1);
+}
+
+// Updates are retried if the database is busy
+static void test_busy() {
+  Database d(DBPATH, true, 50);
+  Database other(DBPATH);
+  DatabaseWriter w(d);
+  other.execute("BEGIN IMMEDIATE");
+  w.submit([](Database &db) { insert(db, 101); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  other.rollback();
+  w.sync();
+  assert(count(other) == 102);
+}
+
+// Updates eventually give up if the database stays busy
+static void test_busy_give_up() {
+  Database d(DBPATH, true, 1);
+  Database other(DBPATH);
+  DatabaseWriter w(d);
+  other.execute("BEGIN IMMEDIATE");
+  bool failed = false;
+  try {
+    w.execute([](Database &db) { insert(db, 102); });
+  } catch(DatabaseBusy &) {
+    failed = true;
+  }
+  assert(failed);
+  other.rollback();
+  assert(count(other) == 102);
+}
+
+// Clock for batch tests
+static struct timespec fakeNow;
+
+static void fakeClock(struct timespec &now) {
+  now = fakeNow;
+}
+
+// Batches are submitted when full, or when flushed
+static void test_batch() {
+  Database d(DBPATH);
+  Database reader(DBPATH, false);
+  DatabaseWriter w(d);
+  fakeNow = {1000, 0};
+  DatabaseWriter::Batch batch(w, nullptr, fakeClock);
+  const int base = count(reader);
+  int i = 1000;
+  for(int n = 1; n < DATABASE_BATCH_JOBS; ++n, ++i)
+    batch.add([i](Database &db) { insert(db, i); });
+  w.sync();
+  assert(count(reader) == base);
+  batch.add([i](Database &db) { insert(db, i); });
+  ++i;
+  w.sync();
+  assert(count(reader) == base + DATABASE_BATCH_JOBS);
+  batch.add([i](Database &db) { insert(db, i); });
+  w.sync();
+  assert(count(reader) == base + DATABASE_BATCH_JOBS);
+  batch.flush();
+  w.sync();
+  assert(count(reader) == base + DATABASE_BATCH_JOBS + 1);
+}
+
+// Batches are submitted when the delay expires
+static void test_batch_delay() {
+  Database d(DBPATH);
+  Database reader(DBPATH, false);
+  DatabaseWriter w(d);
+  fakeNow = {1000, 500000000};
+  DatabaseWriter::Batch batch(w, nullptr, fakeClock);
+  const int base = count(reader);
+  batch.add([](Database &db) { insert(db, 2000); });
+  // Just short of the delay
+  fakeNow.tv_sec += DATABASE_BATCH_DELAY;
+  fakeNow.tv_nsec -= 1;
+  batch.add([](Database &db) { insert(db, 2001); });
+  w.sync();
+  assert(count(reader) == base);
+  // Exactly the delay
+  fakeNow.tv_nsec += 1;
+  batch.add([](Database &db) { insert(db, 2002); });
+  w.sync();
+  assert(count(reader) == base + 3);
+  // The event loop flushes without another job being added
+  batch.add([](Database &db) { insert(db, 2003); });
+  batch.onTimeout(nullptr, fakeNow);
+  w.sync();
+  assert(count(reader) == base + 4);
+}
+
+// Batches attached to an event loop are submitted from it
+static void test_batch_eventloop() {
+  Database d(DBPATH);
+  Database reader(DBPATH, false);
+  DatabaseWriter w(d);
+  EventLoop e;
+  DatabaseWriter::Batch batch(w, &e);
+  const int base = count(reader);
+  batch.add([](Database &db) { insert(db, 3000); });
+  e.wait(true);
+  w.sync();
+  assert(count(reader) == base + 1);
+}
+
+int main() {
+  unlink(DBPATH);
+  {
+    Database d(DBPATH);
+    d.execute("CREATE TABLE t (i INT PRIMARY KEY)");
+  }
+  test_group_commit();
+  test_errors();
+  test_error_reporting();
+  test_busy();
+  test_busy_give_up();
+  test_batch();
+  test_batch_delay();
+  test_batch_eventloop();
+  unlink(DBPATH);
+  return 0;
+}
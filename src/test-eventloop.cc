@@ -19,6 +19,10 @@
 #include <cerrno>
 #include <unistd.h>
 #include <cassert>
+#include <cstdio>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 class TestReactor: public Reactor {
 public:
@@ -41,27 +45,36 @@ public:
     }
   }
 
+  void onWait(EventLoop *, pid_t, int status,
+              const struct rusage &) override {
+    assert(WIFEXITED(status));
+    assert(WEXITSTATUS(status) == expect_status);
+    ++wait_calls;
+  }
+
   int read_calls = 0;
+  int wait_calls = 0;
+  int expect_status = 0;
 
   std::string writeme;
   size_t wrote_bytes = 0;
 };
 
-static void test_read_closed() {
+static void test_read_closed(EventLoop::Backend backend) {
   int p[2];
   assert(pipe(p) == 0);
   assert(close(p[1]) == 0);
-  EventLoop e;
+  EventLoop e(backend);
   TestReactor tr;
   e.whenReadable(p[0], &tr);
   e.wait();
   assert(tr.read_calls == 1);
 }
 
-static void test_write() {
+static void test_write(EventLoop::Backend backend) {
   int p[2];
   assert(pipe(p) == 0);
-  EventLoop e;
+  EventLoop e(backend);
   TestReactor tr;
   tr.writeme = "test data";
   e.whenWritable(p[1], &tr);
@@ -72,8 +85,65 @@ static void test_write() {
   assert(std::string(buffer, n) == tr.writeme);
 }
 
+// Many concurrent subprocesses, plus a file descriptor too large for select
+static void test_many_children(EventLoop::Backend backend, int nchildren) {
+  int go[2], p[2];
+  assert(pipe(go) == 0);
+  assert(pipe(p) == 0);
+  assert(close(p[1]) == 0);
+  const int bigfd = FD_SETSIZE + 100;
+  assert(dup2(p[0], bigfd) == bigfd);
+  assert(close(p[0]) == 0);
+  EventLoop e(backend);
+  TestReactor tr;
+  tr.expect_status = 7;
+  std::vector<pid_t> pids;
+  for(int i = 0; i < nchildren; ++i) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+      // Wait until all the children exist
+      char c;
+      close(go[1]);
+      while(read(go[0], &c, 1) < 0 && errno == EINTR)
+        ;
+      _exit(7);
+    }
+    e.whenWaited(pid, &tr);
+  }
+  if(backend == EventLoop::Epoll)
+    e.whenReadable(bigfd, &tr);
+  else
+    assert(close(bigfd) == 0);
+  assert(close(go[0]) == 0);
+  assert(close(go[1]) == 0);
+  struct timespec start, finish;
+  getMonotonicTime(start);
+  e.wait();
+  getMonotonicTime(finish);
+  assert(tr.wait_calls == nchildren);
+  assert(tr.read_calls == (backend == EventLoop::Epoll ? 1 : 0));
+  struct timespec elapsed = finish - start;
+  printf("%s: %d children in %ld.%03lds\n",
+         backend == EventLoop::Epoll ? "epoll" : "select", nchildren,
+         (long)elapsed.tv_sec, elapsed.tv_nsec / 1000000);
+}
+
 int main() {
-  test_read_closed();
-  test_write();
+  // Need a file descriptor per child
+  struct rlimit rl;
+  assert(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+  if(rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < 4096) {
+    rl.rlim_cur = std::min<rlim_t>(4096, rl.rlim_max);
+    assert(setrlimit(RLIMIT_NOFILE, &rl) == 0);
+  }
+  for(auto backend: {EventLoop::Epoll, EventLoop::Select}) {
+    test_read_closed(backend);
+    test_write(backend);
+  }
+  EventLoop e;
+  if(e.getBackend() == EventLoop::Epoll && rl.rlim_cur >= 4096)
+    test_many_children(EventLoop::Epoll, 2000);
+  test_many_children(EventLoop::Select, 2000);
   return 0;
 }
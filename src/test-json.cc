@@ -0,0 +1,73 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Json.h"
+#include "Errors.h"
+#include <cassert>
+
+static void bad(const char *s) {
+  try {
+    Json::parse(s);
+    assert(0);
+  } catch(SyntaxError &) {
+  }
+}
+
+int main(void) {
+  Json v = Json::parse(
+      " {\"a\": [1, -2.5e3, true, false, null], \"b\":\"x\\\"\\u00e9\\n\"} ");
+  assert(v.type == Json::Object);
+  assert(v.object.size() == 2);
+  const Json *a = v.find("a");
+  assert(a && a->type == Json::Array && a->array.size() == 5);
+  assert(a->array[0].type == Json::Number && a->array[0].string == "1");
+  assert(a->array[1].type == Json::Number && a->array[1].string == "-2.5e3");
+  assert(a->array[2].type == Json::Boolean && a->array[2].boolean);
+  assert(a->array[3].type == Json::Boolean && !a->array[3].boolean);
+  assert(a->array[4].type == Json::Null);
+  const Json *b = v.find("b");
+  assert(b && b->type == Json::String && b->string == "x\"\xc3\xa9\n");
+  assert(!v.find("c"));
+  assert(!a->find("a"));
+
+  // Large integers are kept exactly
+  assert(Json::parse("9223372036854775807").string == "9223372036854775807");
+
+  // Surrogate pairs
+  assert(Json::parse("\"\\ud83d\\ude00\"").string == "\xf0\x9f\x98\x80");
+
+  // Empty containers
+  assert(Json::parse("{}").type == Json::Object);
+  assert(Json::parse("[ ]").array.size() == 0);
+
+  bad("");
+  bad("{");
+  bad("[1,]");
+  bad("{\"a\" 1}");
+  bad("01");
+  bad("1.");
+  bad("tru");
+  bad("\"unterminated");
+  bad("\"\\x\"");
+  bad("\"\\ud83d\"");
+  bad("1 2");
+  bad(std::string(100, '[').c_str());
+
+  // Quoting round-trips
+  const std::string s = "a\"b\\c\n\t\x01\xc3\xa9";
+  assert(Json::quote(s) == "\"a\\\"b\\\\c\\n\\t\\u0001\xc3\xa9\"");
+  assert(Json::parse(Json::quote(s)).string == s);
+  return 0;
+}
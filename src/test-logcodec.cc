@@ -0,0 +1,67 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "LogCodec.h"
+#include "Errors.h"
+#include <cassert>
+
+static bool fails(const std::string &data, int codec) {
+  try {
+    decodeLog(data, codec);
+    return false;
+  } catch(Error &) {
+    return true;
+  }
+}
+
+int main(void) {
+  int codec;
+
+  // Small logs are left alone
+  std::string small = "pruned by age\n";
+  assert(encodeLog(small, codec) == small);
+  assert(codec == LOG_CODEC_RAW);
+  assert(decodeLog(small, LOG_CODEC_RAW) == small);
+
+  // Typical logs are compressed
+  std::string log;
+  for(int i = 0; i < 1000; ++i)
+    log += "rsync: send_files failed to open \"/home/user/file"
+           + std::to_string(i) + "\": Permission denied (13)\n";
+  std::string data = encodeLog(log, codec);
+  assert(codec == LOG_CODEC_ZLIB);
+  assert(data.size() < log.size() / 4);
+  assert(decodeLog(data, codec) == log);
+  std::string best = encodeLog(log, codec, true);
+  assert(codec == LOG_CODEC_ZLIB);
+  assert(best.size() <= data.size());
+  assert(decodeLog(best, codec) == log);
+
+  // Incompressible logs are left alone
+  std::string noise;
+  uint32_t x = 1;
+  for(int i = 0; i < 4096; ++i) {
+    x = x * 1103515245 + 12345;
+    noise += (char)(x >> 24);
+  }
+  assert(encodeLog(noise, codec) == noise);
+  assert(codec == LOG_CODEC_RAW);
+
+  // Damage is detected
+  assert(fails(data.substr(0, data.size() / 2), LOG_CODEC_ZLIB));
+  assert(fails("not compressed", LOG_CODEC_ZLIB));
+  assert(fails(data, 99));
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "RsyncStats.h"
+#include <cassert>
+
+int main(void) {
+  RsyncStats stats;
+  stats.parse("");
+  assert(stats.filesTransferred == -1);
+  assert(stats.totalSize == -1);
+  assert(stats.speedup == -1);
+
+  // rsync 3.1 and later
+  stats.parse("\n"
+              "Number of files: 6 (reg: 5, dir: 1)\n"
+              "Number of created files: 5 (reg: 5)\n"
+              "Number of deleted files: 0\n"
+              "Number of regular files transferred: 5\n"
+              "Total file size: 2101263 bytes\n"
+              "Total transferred file size: 2101263 bytes\n"
+              "Literal data: 2101263 bytes\n"
+              "Matched data: 0 bytes\n"
+              "File list size: 0\n"
+              "Total bytes sent: 2101770\n"
+              "Total bytes received: 118\n"
+              "\n"
+              "sent 2101770 bytes  received 118 bytes  4203776.00 bytes/sec\n"
+              "total size is 2101263  speedup is 1.00\n");
+  assert(stats.filesTransferred == 5);
+  assert(stats.totalSize == 2101263);
+  assert(stats.transferredSize == 2101263);
+  assert(stats.literalData == 2101263);
+  assert(stats.matchedData == 0);
+  assert(stats.speedup == 1.0);
+
+  // Older rsync, and thousands separators
+  RsyncStats old;
+  old.parse("Number of files: 1,234\n"
+            "Number of files transferred: 56\n"
+            "Total file size: 1,234,567 bytes\n"
+            "Total transferred file size: 4,567 bytes\n"
+            "Literal data: 4,000 bytes\n"
+            "Matched data: 567 bytes\n"
+            "total size is 1,234,567  speedup is 270.32\n");
+  assert(old.filesTransferred == 56);
+  assert(old.totalSize == 1234567);
+  assert(old.transferredSize == 4567);
+  assert(old.literalData == 4000);
+  assert(old.matchedData == 567);
+  assert(old.speedup == 270.32);
+
+  // Missing values are left alone
+  RsyncStats partial;
+  partial.parse("rsync: connection unexpectedly closed\n"
+                "Total file size: bytes\n");
+  assert(partial.totalSize == -1);
+  return 0;
+}
@@ -0,0 +1,28 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Utils.h"
+#include <cassert>
+
+int main(void) {
+  assert(shellQuote("") == "''");
+  assert(shellQuote("word") == "word");
+  assert(shellQuote("/path/to-some_file.txt") == "/path/to-some_file.txt");
+  assert(shellQuote("two words") == "'two words'");
+  assert(shellQuote("$HOME") == "'$HOME'");
+  assert(shellQuote("it's") == "'it'\\''s'");
+  assert(shellQuote("a;b") == "'a;b'");
+  return 0;
+}
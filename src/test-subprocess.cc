@@ -22,6 +22,9 @@
 #include <csignal>
 #include <cstdarg>
 #include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static const char *warnings[64];
 static size_t nwarnings;
@@ -68,6 +71,35 @@ int main() {
   assert(WIFEXITED(rc));
   assert(WEXITSTATUS(rc) == 0);
   assert(nwarnings == 1);
+  // Resource usage is collected
+  assert(sp2.getResourceUsage().ru_maxrss > 0);
+
+  // Capture to a file.  splice() refuses files opened for append, so the
+  // second time around exercises the fallback.
+  for(int append: {0, O_APPEND}) {
+    const char *path = "test-subprocess.spool";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | append, 0600);
+    assert(fd >= 0);
+    command = {"sh", "-c",
+               "echo stdout; echo >&2 stderr;"
+               " dd if=/dev/zero bs=65536 count=64 2>/dev/null"};
+    Subprocess sp3(command);
+    sp3.captureFile(1, fd, 2);
+    rc = sp3.runAndWait(0);
+    assert(WIFEXITED(rc));
+    assert(WEXITSTATUS(rc) == 0);
+    assert(close(fd) == 0);
+    struct stat sb;
+    assert(stat(path, &sb) == 0);
+    assert(sb.st_size == 14 + 65536 * 64);
+    char buffer[14];
+    fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    assert(read(fd, buffer, sizeof buffer) == sizeof buffer);
+    assert(std::string(buffer, sizeof buffer) == "stdout\nstderr\n");
+    assert(close(fd) == 0);
+    assert(unlink(path) == 0);
+  }
 
   // NB assumes the 'usual' encoding of exit status, will need to do something
   // more sophisticated if some useful platform doesn't play along.
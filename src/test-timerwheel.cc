@@ -0,0 +1,126 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Utils.h"
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include <sys/resource.h>
+
+class TestReactor: public Reactor {
+public:
+  void onTimeout(EventLoop *, const struct timespec &now) override {
+    // Never early
+    assert(now >= when);
+    assert(!fired);
+    fired = true;
+    ++*count;
+  }
+
+  struct timespec when;
+  bool fired = false;
+  int *count = nullptr;
+};
+
+static struct timespec after(const struct timespec &t, long ms) {
+  struct timespec r = t;
+  r.tv_sec += ms / 1000;
+  r.tv_nsec += (ms % 1000) * 1000000;
+  if(r.tv_nsec >= 1000000000) {
+    r.tv_nsec -= 1000000000;
+    ++r.tv_sec;
+  }
+  return r;
+}
+
+// Expiry order and cancellation, with simulated time
+static void test_wheel() {
+  TimerWheel w;
+  struct timespec now;
+  getMonotonicTime(now);
+  // Work in whole milliseconds, the wheel's resolution
+  now.tv_nsec -= now.tv_nsec % 1000000;
+  TestReactor a, b, c, d, e;
+  // One in each level, and one in the overflow list
+  const TimerWheel::Id ia = w.add(after(now, 5), &a);
+  const TimerWheel::Id ib = w.add(after(now, 300), &b);
+  const TimerWheel::Id ic = w.add(after(now, 70 * 1000), &c);
+  const TimerWheel::Id id = w.add(after(now, 20L * 86400 * 1000), &d);
+  const TimerWheel::Id ie = w.add(after(now, 100L * 86400 * 1000), &e);
+  assert(ia && ib && ic && id && ie);
+  assert(w.size() == 5);
+  struct timespec delay;
+  assert(w.next(now, delay));
+  assert(delay.tv_sec == 0 && delay.tv_nsec <= 5000000);
+  assert(w.expire(after(now, 4)) == nullptr);
+  assert(w.expire(after(now, 5)) == &a);
+  assert(w.expire(after(now, 5)) == nullptr);
+  // Cancelled timeouts don't expire
+  assert(w.cancel(ib));
+  assert(!w.cancel(ib));
+  assert(!w.cancel(ia));
+  assert(w.expire(after(now, 69999)) == nullptr);
+  assert(w.expire(after(now, 70000)) == &c);
+  // Long jumps still deliver in order
+  assert(w.expire(after(now, 200L * 86400 * 1000)) == &d);
+  assert(w.expire(after(now, 200L * 86400 * 1000)) == &e);
+  assert(w.expire(after(now, 200L * 86400 * 1000)) == nullptr);
+  assert(w.size() == 0);
+  assert(!w.next(now, delay));
+}
+
+// Many timeouts, half of them cancelled, in a real event loop
+static void test_stress(int ntimers) {
+  struct rusage before, finish;
+  getrusage(RUSAGE_SELF, &before);
+  EventLoop e;
+  std::vector<TestReactor> reactors(ntimers);
+  std::vector<EventLoop::TimeoutId> ids(ntimers);
+  int count = 0;
+  struct timespec now;
+  getMonotonicTime(now);
+  uint32_t x = 1;
+  for(int i = 0; i < ntimers; ++i) {
+    x = x * 1103515245 + 12345;
+    reactors[i].when = after(now, (x >> 8) % 1000);
+    reactors[i].count = &count;
+    ids[i] = e.whenTimeout(reactors[i].when, &reactors[i]);
+  }
+  for(int i = 0; i < ntimers; i += 2)
+    e.cancelTimeout(ids[i]);
+  e.wait(true);
+  assert(count == ntimers / 2);
+  for(int i = 0; i < ntimers; ++i)
+    assert(reactors[i].fired == (i % 2 == 1));
+  getrusage(RUSAGE_SELF, &finish);
+  const double cpu =
+      (finish.ru_utime.tv_sec - before.ru_utime.tv_sec)
+      + (finish.ru_stime.tv_sec - before.ru_stime.tv_sec)
+      + (finish.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6
+      + (finish.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+  printf("%d timeouts: %.3fs CPU, max RSS %ldKB\n", ntimers, cpu,
+         finish.ru_maxrss);
+  // Generous limits, but far below what a poll per timeout would need
+  assert(cpu < 5);
+  assert(finish.ru_maxrss < 256 * 1024);
+}
+
+int main() {
+  test_wheel();
+  test_stress(100000);
+  return 0;
+}
@@ -0,0 +1,190 @@
+// Copyright © Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Utils.h"
+#include "TreeRemover.h"
+#include "BulkRemove.h"
+#include "Action.h"
+#include "Conf.h"
+#include "EventLoop.h"
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ROOT "test-treeremover.tmp"
+
+static void mkfile(const std::string &path, size_t size = 0) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  assert(fd >= 0);
+  if(size) {
+    std::string data(size, 'x');
+    assert(write(fd, data.data(), size) == (ssize_t)size);
+  }
+  close(fd);
+}
+
+static void mkdirs(const std::string &path) {
+  assert(mkdir(path.c_str(), 0777) == 0);
+}
+
+static bool exists(const std::string &path) {
+  struct stat sb;
+  return lstat(path.c_str(), &sb) == 0;
+}
+
+// A tree with some width and depth: each level has some files, a hard link to
+// a file outside the tree, and subdirectories
+static size_t mktree(const std::string &path, int depth, int width) {
+  mkdirs(path);
+  size_t inodes = 1;
+  for(int i = 0; i < width; ++i) {
+    mkfile(path + "/f" + std::to_string(i), 100);
+    ++inodes;
+  }
+  assert(link(ROOT ".keep", (path + "/link").c_str()) == 0);
+  assert(symlink("../" ROOT ".keep", (path + "/sym").c_str()) == 0);
+  ++inodes;
+  if(depth > 0)
+    for(int i = 0; i < width; ++i)
+      inodes += mktree(path + "/d" + std::to_string(i), depth - 1, width);
+  return inodes;
+}
+
+// Trees are removed, and only the last link to a file counts as freeing it
+static void test_remove() {
+  TreeRemover r(4);
+  const size_t inodes = mktree(ROOT, 3, 4);
+  int p[2];
+  assert(pipe(p) == 0);
+  auto job = r.remove(ROOT, p[1]);
+  // The notification descriptor is closed on completion
+  char c;
+  assert(read(p[0], &c, 1) == 0);
+  close(p[0]);
+  job->wait();
+  std::string where;
+  assert(job->getError(where) == 0);
+  assert(!job->wasCancelled());
+  assert(!exists(ROOT));
+  // Symbolic links are removed, not followed
+  assert(exists(ROOT ".keep"));
+  assert(job->getInodes() == inodes);
+  assert(job->getBytes() > 0);
+}
+
+// Missing paths are not an error, and single files can be removed
+static void test_trivial() {
+  TreeRemover r(2);
+  auto job = r.remove(ROOT);
+  job->wait();
+  std::string where;
+  assert(job->getError(where) == 0);
+  mkfile(ROOT);
+  job = r.remove(ROOT);
+  job->wait();
+  assert(job->getError(where) == 0);
+  assert(!exists(ROOT));
+  assert(job->getInodes() == 1);
+}
+
+// A cancelled job completes without removing everything
+static void test_cancel() {
+  TreeRemover r(1);
+  mktree(ROOT, 3, 8);
+  auto job = r.remove(ROOT);
+  job->cancel();
+  job->wait();
+  assert(job->wasCancelled());
+  assert(exists(ROOT));
+  job = r.remove(ROOT);
+  job->wait();
+  assert(!exists(ROOT));
+}
+
+// Destroying a remover cancels outstanding jobs
+static void test_destroy() {
+  mktree(ROOT, 3, 8);
+  std::shared_ptr<TreeRemover::Job> job;
+  {
+    TreeRemover r(1);
+    job = r.remove(ROOT);
+  }
+  job->wait();
+  assert(job->wasCancelled());
+  assert(exists(ROOT));
+  TreeRemover(1).remove(ROOT)->wait();
+}
+
+// BulkRemove runs in-process as part of an action list
+static void test_bulkremove() {
+  mktree(ROOT, 2, 4);
+  EventLoop e;
+  ActionList al(&e);
+  BulkRemove b("remove", ROOT);
+  al.add(&b);
+  al.go();
+  assert(b.getStatus() == 0);
+  assert(!exists(ROOT));
+  assert(b.getInodes() > 0);
+}
+
+// The action list time limit cancels in-process removal
+class Terminator: public Action {
+public:
+  Terminator(): Action("terminate") {}
+
+  void go(EventLoop *e, ActionList *al) override {
+    e->terminateSubprocesses();
+    al->completed(this, true);
+  }
+};
+
+static void test_terminate() {
+  mktree(ROOT, 3, 8);
+  EventLoop e;
+  ActionList al(&e);
+  BulkRemove b("remove", ROOT);
+  Terminator t;
+  al.add(&b);
+  al.add(&t);
+  b.set_priority(1);
+  al.go();
+  // Either the removal was cancelled, or it was too quick for that
+  if(b.getStatus()) {
+    assert(WIFSIGNALED(b.getStatus()));
+    assert(WTERMSIG(b.getStatus()) == SIGTERM);
+    assert(exists(ROOT));
+    TreeRemover(1).remove(ROOT)->wait();
+  } else
+    assert(!exists(ROOT));
+}
+
+int main() {
+  TreeRemover(1).remove(ROOT)->wait();
+  mkfile(ROOT ".keep", 1000);
+  test_remove();
+  test_trivial();
+  test_cancel();
+  test_destroy();
+  test_bulkremove();
+  test_terminate();
+  unlink(ROOT ".keep");
+  return 0;
+}
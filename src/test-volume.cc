@@ -16,8 +16,96 @@
 #include "Conf.h"
 #include "Backup.h"
 #include "Volume.h"
+#include "Host.h"
+#include "Device.h"
+#include "Utils.h"
 #include <getopt.h>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Create a backup and add it to a volume
+static Backup *newBackup(Volume *v, const char *device, time_t time,
+                         int status) {
+  auto b = new Backup();
+  b->volume = v;
+  b->deviceName = device;
+  b->time = time;
+  b->setStatus(status);
+  v->addBackup(b);
+  return b;
+}
+
+// Random changes, with every incremental update checked against a full
+// recalculation
+static void test_totals() {
+  static const char *const devices[] = {"d1", "d2", "d3"};
+  static const int statuses[] = {UNDERWAY, COMPLETE, FAILED, PRUNING};
+  Conf c;
+  auto h = new Host(&c, "h");
+  auto v = new Volume(h, "v", "/v");
+  globalDebug = true;
+  srand(1);
+  for(int n = 0; n < 2000; ++n) {
+    switch(rand() % 3) {
+    case 0: {
+      // Several backups may share a time, on different devices
+      auto b = new Backup();
+      b->volume = v;
+      b->deviceName = devices[rand() % 3];
+      b->time = rand() % 50;
+      b->setStatus(statuses[rand() % 4]);
+      if(!v->addBackup(b))
+        delete b;
+      break;
+    }
+    case 1:
+      if(v->backups.size()) {
+        auto it = v->backups.begin();
+        std::advance(it, rand() % v->backups.size());
+        (*it)->setStatus(statuses[rand() % 4]);
+      }
+      break;
+    case 2:
+      if(v->backups.size()) {
+        auto it = v->backups.begin();
+        std::advance(it, rand() % v->backups.size());
+        assert(v->removeBackup(*it));
+      }
+      break;
+    }
+  }
+  globalDebug = false;
+}
+
+// Load and prune a large volume
+static void test_large() {
+  const int count = 50000;
+  Conf c;
+  auto h = new Host(&c, "h");
+  auto v = new Volume(h, "v", "/v");
+  auto start = std::chrono::steady_clock::now();
+  for(int n = 0; n < count; ++n)
+    newBackup(v, n % 2 ? "d2" : "d1", 3600 * (time_t)n, COMPLETE);
+  auto loaded = std::chrono::steady_clock::now();
+  assert(v->completed == count);
+  assert(v->oldest == 0);
+  assert(v->newest == 3600 * (time_t)(count - 1));
+  assert(v->findDevice("d1")->count == count / 2);
+  // Prune the oldest backups
+  while(v->completed > count / 2) {
+    Backup *b = *v->backups.begin();
+    b->setStatus(PRUNING);
+    v->removeBackup(b);
+  }
+  auto pruned = std::chrono::steady_clock::now();
+  assert(v->oldest == 3600 * (time_t)(count / 2));
+  assert(v->findDevice("d2")->oldest == 3600 * (time_t)(count / 2 + 1));
+  printf("%d backups: load %.3fs prune %.3fs\n", count,
+         std::chrono::duration<double>(loaded - start).count(),
+         std::chrono::duration<double>(pruned - loaded).count());
+}
 
 int main() {
   assert(!Volume::valid(""));
@@ -29,5 +117,50 @@ int main() {
   assert(!Volume::valid(" "));
   assert(!Volume::valid("\x1F"));
   assert(!Volume::valid("-whatever"));
+
+  // Duration estimates
+  Conf c;
+  auto h = new Host(&c, "h");
+  auto v = new Volume(h, "v", "/v");
+  Device d1("d1"), d2("d2");
+  assert(v->estimateDuration() == 0);
+  assert(v->estimateDuration(&d1) == 0);
+  // d1 backups take 100, 200, 300 seconds; failed ones don't count
+  for(int n = 1; n <= 4; ++n) {
+    auto b = new Backup();
+    b->volume = v;
+    b->deviceName = "d1";
+    b->time = 1000 * n;
+    b->finishTime = b->time + 100 * n;
+    b->setStatus(n == 4 ? FAILED : COMPLETE);
+    v->addBackup(b);
+  }
+  assert(v->estimateDuration(&d1) == 200);
+  // No history on d2, so use all devices
+  assert(v->estimateDuration(&d2) == 200);
+  // An even number of backups averages the middle two
+  auto b = new Backup();
+  b->volume = v;
+  b->deviceName = "d2";
+  b->time = 5000;
+  b->finishTime = 5500;
+  b->setStatus(COMPLETE);
+  v->addBackup(b);
+  assert(v->estimateDuration(&d2) == 500);
+  assert(v->estimateDuration() == 250);
+  // Only recent backups are considered
+  for(int n = 0; n < DURATION_ESTIMATE_BACKUPS; ++n) {
+    b = new Backup();
+    b->volume = v;
+    b->deviceName = "d1";
+    b->time = 10000 + n;
+    b->finishTime = b->time + 7;
+    b->setStatus(COMPLETE);
+    v->addBackup(b);
+  }
+  assert(v->estimateDuration(&d1) == 7);
+
+  test_totals();
+  test_large();
   return 0;
 }
@@ -0,0 +1,76 @@
+#! /bin/bash
+# Copyright © Richard Kettlewell.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+set -e
+
+# Count how many times the pruner is started
+echo started >> ${WORKSPACE}/pruner-batch.log
+
+fail() {
+  echo "$1" >&2
+  exit 1
+}
+
+field() {
+  sed -n "s/.*\"$1\":\\(\"[^\"]*\"\\|[0-9]*\\).*/\\1/p"
+}
+
+while read -r request; do
+  echo "$request" >> ${WORKSPACE}/pruner-batch.log
+  host=$(echo "$request" | field host)
+  volume=$(echo "$request" | field volume)
+  device=$(echo "$request" | field device)
+  total=$(echo "$request" | field total)
+  [ "$host" = '"host1"' ] || fail "host: got $host"
+  case "$request" in
+  *'"backups":[315532800,315619200,315705600]'* )
+    ;;
+  * )
+    fail "backups: got $request"
+    ;;
+  esac
+  case "$request" in
+  *'"mode":"batch"'* )
+    ;;
+  * )
+    fail "parameters: got $request"
+    ;;
+  esac
+  case "$volume" in
+  '"volume1"' | '"volume2"' )
+    expect_device1=6
+    expect_device2=5
+    ;;
+  '"volume3"' )
+    expect_device1=bogus
+    expect_device2=3
+    ;;
+  * )
+    fail "volume: got $volume"
+    ;;
+  esac
+  case "$device" in
+  '"device1"' )
+    [ "$total" = "$expect_device1" ] || fail "total: got $total"
+    ;;
+  '"device2"' )
+    [ "$total" = "$expect_device2" ] || fail "total: got $total"
+    ;;
+  * )
+    fail "device: got $device"
+    ;;
+  esac
+  echo '{"prune":[{"time":315619200,"reason":"zap"}]}'
+done
@@ -68,6 +68,7 @@ setup() {
   [ -n "$BACKUP_INTERVAL" ] && echo "backup-parameter min-interval ${BACKUP_INTERVAL}" >> ${WORKSPACE}/config
   echo "prune-policy ${PRUNE_POLICY}" >> ${WORKSPACE}/config
   [ -n "$PRUNE_PATH" ] && echo "prune-parameter path ${PRUNE_PATH}" >> ${WORKSPACE}/config
+  [ -n "$PRUNE_MODE" ] && echo "prune-parameter mode ${PRUNE_MODE}" >> ${WORKSPACE}/config
   [ -n "$DECAY_LIMIT" ] && echo "prune-parameter decay-limit ${DECAY_LIMIT}" >> ${WORKSPACE}/config
 
   mkdir ${WORKSPACE}/logs